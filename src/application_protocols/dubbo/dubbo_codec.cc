@@ -8,6 +8,7 @@
 #include "src/application_protocols/dubbo/dubbo_codec.h"
 #include "src/application_protocols/dubbo/protocol.h"
 #include "src/application_protocols/dubbo/message.h"
+#include "src/application_protocols/dubbo/message_impl.h"
 
 namespace Envoy {
 namespace Extensions {
@@ -15,18 +16,35 @@ namespace NetworkFilters {
 namespace MetaProtocolProxy {
 namespace Dubbo {
 
-MetaProtocolProxy::DecodeStatus DubboCodec::decode(Buffer::Instance& buffer,
-                                                   MetaProtocolProxy::Metadata& metadata) {
-  ENVOY_LOG(debug, "dubbo decoder: {} bytes available", buffer.length());
+namespace {
 
-  if (!decode_started_) {
-    start();
-  }
+/**
+ * MessageFragment refers to a slice of the message bytes kept by an invocation, the invocation is
+ * kept alive until the fragment is drained from the buffer it's added to.
+ */
+class MessageFragment : public Buffer::BufferFragment {
+public:
+  MessageFragment(const Buffer::RawSlice& slice, RpcInvocationSharedPtr invocation)
+      : slice_(slice), invocation_(std::move(invocation)) {}
+
+  // Buffer::BufferFragment
+  const void* data() const override { return slice_.mem_; }
+  size_t size() const override { return slice_.len_; }
+  void done() override { delete this; }
+
+private:
+  const Buffer::RawSlice slice_;
+  const RpcInvocationSharedPtr invocation_;
+};
+
+} // namespace
 
+MetaProtocolProxy::DecodeStatus DubboCodec::decode(Buffer::Instance& buffer,
+                                                   MetaProtocolProxy::Metadata& metadata) {
   ENVOY_LOG(debug, "dubbo decoder: protocol {}, state {}, {} bytes available", protocol_->name(),
-            ProtocolStateNameValues::name(state_machine_->currentState()), buffer.length());
+            ProtocolStateNameValues::name(state_machine_.currentState()), buffer.length());
 
-  ProtocolState state = state_machine_->run(buffer);
+  ProtocolState state = state_machine_.run(buffer);
   if (state == ProtocolState::WaitForData) {
     ENVOY_LOG(debug, "dubbo decoder: wait for data");
     return DecodeStatus::WaitForData;
@@ -34,34 +52,24 @@ MetaProtocolProxy::DecodeStatus DubboCodec::decode(Buffer::Instance& buffer,
 
   ASSERT(state == ProtocolState::Done);
 
-  toMetadata(*(state_machine_->messageMetadata()), *(state_machine_->messageContext()), metadata);
+  toMetadata(state_machine_.messageMetadata(), state_machine_.messageContext(), metadata);
 
   // Reset for next request.
-  complete();
+  state_machine_.reset();
   return DecodeStatus::Done;
 }
 
-void DubboCodec::start() {
-  state_machine_ = std::make_unique<DecoderStateMachine>(*protocol_);
-  decode_started_ = true;
-}
-
-void DubboCodec::complete() {
-  state_machine_ = nullptr;
-  decode_started_ = false;
-}
-
-void DubboCodec::encode(const MetaProtocolProxy::Metadata& metadata,
+void DubboCodec::encode(MetaProtocolProxy::Metadata& metadata,
                         const MetaProtocolProxy::Mutation& mutation, Buffer::Instance& buffer) {
-  (void)mutation;
   ASSERT(buffer.length() == 0);
   switch (metadata.getMessageType()) {
   case MetaProtocolProxy::MessageType::Heartbeat: {
     encodeHeartbeat(metadata, buffer);
     break;
   }
-  case MetaProtocolProxy::MessageType::Request: {
-    // TODO
+  case MetaProtocolProxy::MessageType::Request:
+  case MetaProtocolProxy::MessageType::Oneway: {
+    encodeRequest(metadata, mutation, buffer);
     break;
   }
   case MetaProtocolProxy::MessageType::Error: {
@@ -89,6 +97,9 @@ void DubboCodec::onError(const MetaProtocolProxy::Metadata& metadata,
   case MetaProtocolProxy::ErrorType::BadResponse:
     status = ResponseStatus::BadResponse;
     break;
+  case MetaProtocolProxy::ErrorType::Timeout:
+    status = ResponseStatus::ServerTimeout;
+    break;
   default:
     status = ResponseStatus::ServerError;
   }
@@ -99,13 +110,35 @@ void DubboCodec::onError(const MetaProtocolProxy::Metadata& metadata,
   }
 }
 
+bool DubboCodec::respondHeartbeat(Buffer::Instance& buffer, Buffer::Instance& response) {
+  // Nothing has been drained from the buffer while the state machine waits for a message header,
+  // otherwise the buffer doesn't start at a message boundary.
+  if (state_machine_.currentState() != ProtocolState::OnDecodeStreamHeader) {
+    return false;
+  }
+
+  if (!protocol_->respondHeartbeat(buffer, response)) {
+    return false;
+  }
+
+  ENVOY_LOG(debug, "dubbo decoder: answered the heartbeat from its header");
+  return true;
+}
+
 void DubboCodec::toMetadata(const MessageMetadata& msgMetadata,
                             MetaProtocolProxy::Metadata& metadata) {
   if (msgMetadata.hasInvocationInfo()) {
     metadata.putString("interface", msgMetadata.invocationInfo().serviceName());
     metadata.putString("method", msgMetadata.invocationInfo().methodName());
-    // TODO Add attachment to the metadata header
     metadata.put("InvocationInfo", msgMetadata.invocationInfoPtr());
+    // The attachments are decoded when they're looked up, the shared pointer aliases the
+    // invocation so nothing is allocated for them.
+    if (const auto* invo =
+            dynamic_cast<const RpcInvocationImpl*>(msgMetadata.invocationInfoPtr().get());
+        invo != nullptr) {
+      metadata.setLazyStrings(LazyStringsSharedPtr(msgMetadata.invocationInfoPtr(),
+                                                   static_cast<const LazyStrings*>(invo)));
+    }
   }
   metadata.put("ProtocolType", msgMetadata.protocolType());
   metadata.put("ProtocolVersion", msgMetadata.protocolVersion());
@@ -113,7 +146,8 @@ void DubboCodec::toMetadata(const MessageMetadata& msgMetadata,
   metadata.setRequestId(msgMetadata.requestId());
   auto timeout = msgMetadata.timeout();
   if (timeout.has_value()) {
-    metadata.put("Timeout", msgMetadata.timeout());
+    metadata.put("Timeout", timeout.value());
+    metadata.setTimeout(std::chrono::milliseconds(timeout.value()));
   }
   metadata.put("TwoWay", msgMetadata.isTwoWay());
   metadata.put("SerializationType", msgMetadata.serializationType());
@@ -151,11 +185,27 @@ void DubboCodec::toMetadata(const MessageMetadata& msgMetadata,
     }
   }
 }
-void DubboCodec::toMetadata(const MessageMetadata& msgMetadata, Context& context,
+void DubboCodec::toMetadata(const MessageMetadata& msgMetadata, ContextImpl& context,
                             MetaProtocolProxy::Metadata& metadata) {
   DubboCodec::toMetadata(msgMetadata, metadata);
   metadata.setHeaderSize(context.headerSize());
   metadata.setBodySize(context.bodySize());
+  metadata.setStreamedBytes(context.streamedBytes());
+
+  // The context is reused by the next message. The invocation keeps the message bytes from which
+  // its parameters and attachment are decoded on demand, and the origin message of the metadata
+  // refers to the same bytes rather than to a copy of them. A streamed request has none of them.
+  if (msgMetadata.hasInvocationInfo() && context.streamedBytes() == 0) {
+    auto* invo = dynamic_cast<RpcInvocationImpl*>(msgMetadata.invocationInfoPtr().get());
+    if (invo != nullptr) {
+      invo->message().move(context.originMessage());
+      for (const Buffer::RawSlice& slice : invo->message().getRawSlices()) {
+        metadata.getOriginMessage().addBufferFragment(
+            *new MessageFragment(slice, msgMetadata.invocationInfoPtr()));
+      }
+      return;
+    }
+  }
   metadata.setOriginMessage(context.originMessage());
 }
 
@@ -203,6 +253,34 @@ void DubboCodec::toMsgMetadata(const MetaProtocolProxy::Metadata& metadata,
   }
 }
 
+void DubboCodec::encodeRequest(MetaProtocolProxy::Metadata& metadata,
+                               const MetaProtocolProxy::Mutation& mutation,
+                               Buffer::Instance& buffer) {
+  auto ref = metadata.get("InvocationInfo");
+  if (!ref.has_value() || !mutation.hasStrings()) {
+    return;
+  }
+  const auto& invocation = std::any_cast<const RpcInvocationSharedPtr&>(ref.value());
+  auto* invo = dynamic_cast<RpcInvocationImpl*>(invocation.get());
+  if (invo == nullptr) {
+    return;
+  }
+
+  // The mutation only changes the attachment, the parameters in front of it are kept as is.
+  auto& attachment = invo->mutableAttachment();
+  mutation.iterateStrings([&attachment](absl::string_view key, absl::string_view value) {
+    const std::string name(key);
+    attachment->remove(name);
+    attachment->insert(name, std::string(value));
+  });
+
+  if (!protocol_->encodeRequest(buffer, metadata.getOriginMessage(), *invo)) {
+    throw EnvoyException("failed to encode request message");
+  }
+  ENVOY_LOG(debug, "dubbo encoder: re-encoded the attachment of the request, {} bytes",
+            buffer.length());
+}
+
 void DubboCodec::encodeHeartbeat(const MetaProtocolProxy::Metadata& metadata,
                                  Buffer::Instance& buffer) {
   MessageMetadata msgMetadata;
@@ -215,26 +293,33 @@ void DubboCodec::encodeHeartbeat(const MetaProtocolProxy::Metadata& metadata,
 }
 
 ProtocolState DecoderStateMachine::onDecodeStreamHeader(Buffer::Instance& buffer) {
-  auto ret = protocol_.decodeHeader(buffer, metadata_);
-  if (!ret.second) {
+  if (!protocol_.decodeHeader(buffer, metadata_, context_)) {
     ENVOY_LOG(debug, "dubbo decoder: need more data for {} protocol", protocol_.name());
     return ProtocolState::WaitForData;
   }
 
-  context_ = ret.first;
-  if (metadata_->messageType() == MessageType::HeartbeatRequest ||
-      metadata_->messageType() == MessageType::HeartbeatResponse) {
-    if (buffer.length() < (context_->headerSize() + context_->bodySize())) {
+  if (metadata_.messageType() == MessageType::HeartbeatRequest ||
+      metadata_.messageType() == MessageType::HeartbeatResponse) {
+    if (buffer.length() < context_.messageSize()) {
       ENVOY_LOG(debug, "dubbo decoder: need more data for {} protocol heartbeat", protocol_.name());
       return ProtocolState::WaitForData;
     }
 
     ENVOY_LOG(debug, "dubbo decoder: this is the {} heartbeat message", protocol_.name());
-    context_->originMessage().move(buffer, (context_->headerSize() + context_->bodySize()));
+    context_.originMessage().move(buffer, context_.messageSize());
     return ProtocolState::Done;
   }
 
-  context_->originMessage().move(buffer, context_->headerSize());
+  context_.originMessage().move(buffer, context_.headerSize());
+
+  // Only the two-way requests and the responses are streamed, the message of a oneway request is
+  // released as soon as it's routed.
+  if (streaming_threshold_ > 0 &&
+      (metadata_.messageType() == MessageType::Request ||
+       metadata_.messageType() == MessageType::Response) &&
+      context_.messageSize() > streaming_threshold_) {
+    return ProtocolState::OnDecodeStreamPrefix;
+  }
 
   return ProtocolState::OnDecodeStreamData;
 }
@@ -246,18 +331,42 @@ ProtocolState DecoderStateMachine::onDecodeStreamData(Buffer::Instance& buffer)
     return ProtocolState::WaitForData;
   }
 
-  context_->originMessage().move(buffer, context_->bodySize());
+  context_.originMessage().move(buffer, context_.bodySize());
 
   ENVOY_LOG(debug, "dubbo decoder: ends the deserialization of the message");
   return ProtocolState::Done;
 }
 
+ProtocolState DecoderStateMachine::onDecodeStreamPrefix(Buffer::Instance& buffer) {
+  if (!protocol_.decodeDataPrefix(buffer, context_, metadata_)) {
+    ENVOY_LOG(debug, "dubbo decoder: need more data for the prefix of a streamed message");
+    return ProtocolState::WaitForData;
+  }
+
+  // The body which has arrived goes with the decoded message, the rest of it is streamed.
+  const uint64_t buffered = std::min<uint64_t>(buffer.length(), context_.bodySize());
+  context_.originMessage().move(buffer, buffered);
+  context_.setStreamedBytes(context_.bodySize() - buffered);
+
+  ENVOY_LOG(debug, "dubbo decoder: stream the message, {} bytes of the body to come",
+            context_.streamedBytes());
+  return ProtocolState::Done;
+}
+
+void DecoderStateMachine::reset() {
+  metadata_ = MessageMetadata();
+  context_.reset();
+  state_ = ProtocolState::OnDecodeStreamHeader;
+}
+
 ProtocolState DecoderStateMachine::handleState(Buffer::Instance& buffer) {
   switch (state_) {
   case ProtocolState::OnDecodeStreamHeader:
     return onDecodeStreamHeader(buffer);
   case ProtocolState::OnDecodeStreamData:
     return onDecodeStreamData(buffer);
+  case ProtocolState::OnDecodeStreamPrefix:
+    return onDecodeStreamPrefix(buffer);
   default:
     NOT_REACHED_GCOVR_EXCL_LINE;
   }
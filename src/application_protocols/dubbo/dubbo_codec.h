@@ -22,6 +22,7 @@ namespace Dubbo {
   FUNCTION(WaitForData)                                                                            \
   FUNCTION(OnDecodeStreamHeader)                                                                   \
   FUNCTION(OnDecodeStreamData)                                                                     \
+  FUNCTION(OnDecodeStreamPrefix)                                                                   \
   FUNCTION(Done)
 
 /**
@@ -44,12 +45,15 @@ private:
   }
 };
 
+/**
+ * DecoderStateMachine decodes the messages of a connection one after another. The header fields
+ * and the context of the message being decoded are kept inline and reset for the next message, so
+ * only the objects which outlive the decoding, e.g. the invocation of a request, are allocated.
+ */
 class DecoderStateMachine : public Logger::Loggable<Logger::Id::dubbo> {
 public:
   DecoderStateMachine(Protocol& protocol)
-      : protocol_(protocol), state_(ProtocolState::OnDecodeStreamHeader) {
-    metadata_ = std::make_shared<MessageMetadata>();
-  }
+      : protocol_(protocol), state_(ProtocolState::OnDecodeStreamHeader) {}
 
   /**
    * Consumes as much data from the configured Buffer as possible and executes the decoding state
@@ -72,64 +76,82 @@ public:
    * return the message metadata
    * @return
    */
-  MessageMetadataSharedPtr messageMetadata() const { return metadata_; }
+  const MessageMetadata& messageMetadata() const { return metadata_; }
   /**
    * @return the message context
    */
-  ContextSharedPtr messageContext() { return context_; }
+  ContextImpl& messageContext() { return context_; }
+
+  /**
+   * Reset the state machine to decode the next message.
+   */
+  void reset();
+
+  /**
+   * Set the size of the requests above which they're streamed, zero disables streaming.
+   */
+  void setStreamingThreshold(uint64_t threshold) { streaming_threshold_ = threshold; }
 
 private:
   // These functions map directly to the matching ProtocolState values. Each returns the next state
   // or ProtocolState::WaitForData if more data is required.
   ProtocolState onDecodeStreamHeader(Buffer::Instance& buffer);
   ProtocolState onDecodeStreamData(Buffer::Instance& buffer);
+  ProtocolState onDecodeStreamPrefix(Buffer::Instance& buffer);
 
   // handleState delegates to the appropriate method based on state_.
   ProtocolState handleState(Buffer::Instance& buffer);
 
   Protocol& protocol_;
-  MessageMetadataSharedPtr metadata_;
-  ContextSharedPtr context_;
+  MessageMetadata metadata_;
+  ContextImpl context_;
   ProtocolState state_;
+  uint64_t streaming_threshold_{0};
 };
 
-using DecoderStateMachinePtr = std::unique_ptr<DecoderStateMachine>;
-
 /**
  * Codec for Dubbo protocol.
  */
 class DubboCodec : public MetaProtocolProxy::Codec, public Logger::Loggable<Logger::Id::dubbo> {
 public:
-  DubboCodec() {
-    protocol_ = NamedProtocolConfigFactory::getFactory(ProtocolType::Dubbo)
-                    .createProtocol(SerializationType::Hessian2);
-  };
+  DubboCodec()
+      : protocol_(NamedProtocolConfigFactory::getFactory(ProtocolType::Dubbo)
+                      .createProtocol(SerializationType::Hessian2)),
+        state_machine_(*protocol_) {}
   ~DubboCodec() override = default;
 
   MetaProtocolProxy::DecodeStatus decode(Buffer::Instance& buffer,
                                          MetaProtocolProxy::Metadata& metadata) override;
-  void encode(const MetaProtocolProxy::Metadata& metadata,
+  void encode(MetaProtocolProxy::Metadata& metadata,
               const MetaProtocolProxy::Mutation& mutation, Buffer::Instance& buffer) override;
+  bool encodesRequests() const override { return true; }
   void onError(const MetaProtocolProxy::Metadata& metadata, const MetaProtocolProxy::Error& error,
                Buffer::Instance& buffer) override;
+  bool respondHeartbeat(Buffer::Instance& buffer, Buffer::Instance& response) override;
+  void setStreamingThreshold(uint64_t threshold) override {
+    state_machine_.setStreamingThreshold(threshold);
+  }
+  bool rewriteRequestId(Buffer::Instance& message, uint64_t request_id) override {
+    return protocol_->rewriteRequestId(message, request_id);
+  }
 
 private:
   void toMetadata(const MessageMetadata& msgMetadata, MetaProtocolProxy::Metadata& metadata);
 
-  void toMetadata(const MessageMetadata& msgMetadata, Context& context,
+  void toMetadata(const MessageMetadata& msgMetadata, ContextImpl& context,
                   MetaProtocolProxy::Metadata& metadata);
   void toMsgMetadata(const MetaProtocolProxy::Metadata& metadata, MessageMetadata& msgMetadata);
 
-  void start();
-
-  void complete();
-
 private:
+  // Encodes a request with the attachment rewritten by the mutation, the buffer is left empty if
+  // there's nothing to rewrite.
+  void encodeRequest(MetaProtocolProxy::Metadata& metadata,
+                     const MetaProtocolProxy::Mutation& mutation, Buffer::Instance& buffer);
   void encodeHeartbeat(const MetaProtocolProxy::Metadata& metadata, Buffer::Instance& buffer);
 
   ProtocolPtr protocol_;
-  DecoderStateMachinePtr state_machine_;
-  bool decode_started_{false};
+  // The state machine is reused by the messages of the connection.
+  DecoderStateMachine state_machine_;
 };
 
 } // namespace Dubbo
@@ -15,9 +15,35 @@ namespace NetworkFilters {
 namespace MetaProtocolProxy {
 namespace Dubbo {
 
+namespace {
+
+// Sets whether the result is an exception from its response type, returns whether the result
+// carries a value.
+bool setResultType(RpcResultImpl& result, int32_t type_value) {
+  switch (static_cast<RpcResponseType>(type_value)) {
+  case RpcResponseType::ResponseWithException:
+  case RpcResponseType::ResponseWithExceptionWithAttachments:
+    result.setException(true);
+    return true;
+  case RpcResponseType::ResponseWithNullValue:
+  case RpcResponseType::ResponseNullValueWithAttachments:
+    result.setException(false);
+    return false;
+  case RpcResponseType::ResponseWithValue:
+  case RpcResponseType::ResponseValueWithAttachments:
+    result.setException(false);
+    return true;
+  default:
+    throw EnvoyException(
+        fmt::format("not supported return type {}", static_cast<uint8_t>(type_value)));
+  }
+}
+
+} // namespace
+
 std::pair<RpcInvocationSharedPtr, bool>
 DubboHessian2SerializerImpl::deserializeRpcInvocation(Buffer::Instance& buffer,
-                                                      ContextSharedPtr context) {
+                                                      const Context& context) {
   Hessian2::Decoder decoder(std::make_unique<BufferReader>(buffer));
 
   // TODO(zyfjeff): Add format checker
@@ -26,9 +52,9 @@ DubboHessian2SerializerImpl::deserializeRpcInvocation(Buffer::Instance& buffer,
   auto service_version = decoder.decode<std::string>();
   auto method_name = decoder.decode<std::string>();
 
-  if (context->bodySize() < decoder.offset()) {
+  if (context.bodySize() < decoder.offset()) {
     throw EnvoyException(fmt::format("RpcInvocation size({}) larger than body size({})",
-                                     decoder.offset(), context->bodySize()));
+                                     decoder.offset(), context.bodySize()));
   }
 
   if (dubbo_version == nullptr || service_name == nullptr || service_version == nullptr ||
@@ -41,13 +67,16 @@ DubboHessian2SerializerImpl::deserializeRpcInvocation(Buffer::Instance& buffer,
   invo->setServiceVersion(*service_version);
   invo->setMethodName(*method_name);
 
-  size_t parsed_size = context->headerSize() + decoder.offset();
+  size_t parsed_size = context.headerSize() + decoder.offset();
 
-  auto delayed_decoder = std::make_shared<Hessian2::Decoder>(
-      std::make_unique<BufferReader>(context->originMessage(), parsed_size));
-
-  invo->setParametersLazyCallback([delayed_decoder]() -> RpcInvocationImpl::ParametersPtr {
+  // The callbacks read the original message kept by the invocation, which is filled in by the
+  // codec when the message is decoded. They only capture a pointer and an offset so they're
+  // stored without allocation.
+  RpcInvocationImpl* raw_invo = invo.get();
+  invo->setParametersLazyCallback([raw_invo, parsed_size]() -> RpcInvocationImpl::ParametersPtr {
     auto params = std::make_unique<RpcInvocationImpl::Parameters>();
+    auto delayed_decoder = std::make_unique<Hessian2::Decoder>(
+        std::make_unique<BufferReader>(raw_invo->message(), parsed_size));
 
     if (auto types = delayed_decoder->decode<std::string>(); types != nullptr && !types->empty()) {
       uint32_t number = HessianUtils::getParametersNumber(*types);
@@ -62,10 +91,26 @@ DubboHessian2SerializerImpl::deserializeRpcInvocation(Buffer::Instance& buffer,
     return params;
   });
 
-  invo->setAttachmentLazyCallback([delayed_decoder]() -> RpcInvocationImpl::AttachmentPtr {
-    size_t offset = delayed_decoder->offset();
+  invo->setAttachmentLazyCallback([raw_invo, parsed_size]() -> RpcInvocationImpl::AttachmentPtr {
+    Buffer::Instance& message = raw_invo->message();
+    // The parameters in front of the attachment are skipped without being decoded.
+    HessianSkipper skipper(message, parsed_size, message.length());
+    const std::string types = skipper.readString();
+    const uint32_t number = HessianUtils::getParametersNumber(types);
+    for (uint32_t i = 0; i < number; i++) {
+      skipper.skipValue();
+    }
+
+    size_t offset = skipper.offset();
+    if (offset == message.length()) {
+      // The request carries no attachment.
+      return std::make_unique<RpcInvocationImpl::Attachment>(
+          std::make_unique<RpcInvocationImpl::Attachment::Map>(), offset);
+    }
 
-    auto result = delayed_decoder->decode<Hessian2::Object>();
+    Hessian2::Decoder attachment_decoder(
+        std::make_unique<BufferReader>(message, offset));
+    auto result = attachment_decoder.decode<Hessian2::Object>();
     if (result != nullptr && result->type() == Hessian2::Object::Type::UntypedMap) {
       return std::make_unique<RpcInvocationImpl::Attachment>(
           RpcInvocationImpl::Attachment::MapPtr{
@@ -80,11 +125,50 @@ DubboHessian2SerializerImpl::deserializeRpcInvocation(Buffer::Instance& buffer,
   return std::pair<RpcInvocationSharedPtr, bool>(invo, true);
 }
 
+std::pair<RpcInvocationSharedPtr, bool>
+DubboHessian2SerializerImpl::deserializeRpcInvocationPrefix(Buffer::Instance& buffer,
+                                                            const Context& context) {
+  Hessian2::Decoder decoder(std::make_unique<BufferReader>(buffer));
+
+  auto dubbo_version = decoder.decode<std::string>();
+  auto service_name = decoder.decode<std::string>();
+  auto service_version = decoder.decode<std::string>();
+  auto method_name = decoder.decode<std::string>();
+
+  if (dubbo_version == nullptr || service_name == nullptr || service_version == nullptr ||
+      method_name == nullptr) {
+    if (buffer.length() < context.bodySize()) {
+      // The strings are cut short by the end of the buffered data.
+      return std::pair<RpcInvocationSharedPtr, bool>(nullptr, false);
+    }
+    throw EnvoyException(fmt::format("RpcInvocation has no request metadata"));
+  }
+
+  if (context.bodySize() < decoder.offset()) {
+    throw EnvoyException(fmt::format("RpcInvocation size({}) larger than body size({})",
+                                     decoder.offset(), context.bodySize()));
+  }
+
+  auto invo = std::make_shared<RpcInvocationImpl>();
+  invo->setServiceName(*service_name);
+  invo->setServiceVersion(*service_version);
+  invo->setMethodName(*method_name);
+
+  // The parameters and the attachment pass through the proxy without being kept.
+  invo->setParametersLazyCallback(
+      []() { return std::make_unique<RpcInvocationImpl::Parameters>(); });
+  invo->setAttachmentLazyCallback([]() {
+    return std::make_unique<RpcInvocationImpl::Attachment>(
+        std::make_unique<RpcInvocationImpl::Attachment::Map>(), 0);
+  });
+
+  return std::pair<RpcInvocationSharedPtr, bool>(invo, true);
+}
+
 std::pair<RpcResultSharedPtr, bool>
 DubboHessian2SerializerImpl::deserializeRpcResult(Buffer::Instance& buffer,
-                                                  ContextSharedPtr context) {
-  ASSERT(buffer.length() >= context->bodySize());
-  bool has_value = true;
+                                                  const Context& context) {
+  ASSERT(buffer.length() >= context.bodySize());
 
   auto result = std::make_shared<RpcResultImpl>();
 
@@ -94,38 +178,44 @@ DubboHessian2SerializerImpl::deserializeRpcResult(Buffer::Instance& buffer,
     throw EnvoyException(fmt::format("Cannot parse RpcResult type from buffer"));
   }
 
-  RpcResponseType type = static_cast<RpcResponseType>(*type_value);
-
-  switch (type) {
-  case RpcResponseType::ResponseWithException:
-  case RpcResponseType::ResponseWithExceptionWithAttachments:
-    result->setException(true);
-    break;
-  case RpcResponseType::ResponseWithNullValue:
-  case RpcResponseType::ResponseNullValueWithAttachments:
-    has_value = false;
-    FALLTHRU;
-  case RpcResponseType::ResponseWithValue:
-  case RpcResponseType::ResponseValueWithAttachments:
-    result->setException(false);
-    break;
-  default:
-    throw EnvoyException(fmt::format("not supported return type {}", static_cast<uint8_t>(type)));
-  }
+  const bool has_value = setResultType(*result, *type_value);
 
   size_t total_size = decoder.offset();
 
-  if (context->bodySize() < total_size) {
+  if (context.bodySize() < total_size) {
     throw EnvoyException(fmt::format("RpcResult size({}) large than body size({})", total_size,
-                                     context->bodySize()));
+                                     context.bodySize()));
   }
 
-  if (!has_value && context->bodySize() != total_size) {
+  if (!has_value && context.bodySize() != total_size) {
     throw EnvoyException(
         fmt::format("RpcResult is no value, but the rest of the body size({}) not equal 0",
-                    (context->bodySize() - total_size)));
+                    (context.bodySize() - total_size)));
+  }
+
+  return std::pair<RpcResultSharedPtr, bool>(result, true);
+}
+
+std::pair<RpcResultSharedPtr, bool>
+DubboHessian2SerializerImpl::deserializeRpcResultPrefix(Buffer::Instance& buffer,
+                                                        const Context& context) {
+  Hessian2::Decoder decoder(std::make_unique<BufferReader>(buffer));
+  auto type_value = decoder.decode<int32_t>();
+  if (type_value == nullptr) {
+    if (buffer.length() < context.bodySize()) {
+      // The type is cut short by the end of the buffered data.
+      return std::pair<RpcResultSharedPtr, bool>(nullptr, false);
+    }
+    throw EnvoyException(fmt::format("Cannot parse RpcResult type from buffer"));
+  }
+
+  if (context.bodySize() < decoder.offset()) {
+    throw EnvoyException(fmt::format("RpcResult size({}) large than body size({})",
+                                     decoder.offset(), context.bodySize()));
   }
 
+  auto result = std::make_shared<RpcResultImpl>();
+  setResultType(*result, *type_value);
   return std::pair<RpcResultSharedPtr, bool>(result, true);
 }
 
@@ -144,6 +234,18 @@ size_t DubboHessian2SerializerImpl::serializeRpcResult(Buffer::Instance& output_
   return output_buffer.length() - origin_length;
 }
 
+size_t DubboHessian2SerializerImpl::serializeRpcAttachment(
+    Buffer::Instance& output_buffer, const RpcInvocationImpl::Attachment& attachment) {
+  size_t origin_length = output_buffer.length();
+  Hessian2::Encoder encoder(std::make_unique<BufferWriter>(output_buffer));
+
+  if (!encoder.encode<Hessian2::Object>(attachment.attachment())) {
+    throw EnvoyException("Cannot serialize RpcInvocation attachment");
+  }
+
+  return output_buffer.length() - origin_length;
+}
+
 class DubboHessian2SerializerConfigFactory
     : public SerializerFactoryBase<DubboHessian2SerializerImpl> {
 public:
@@ -17,13 +17,22 @@ public:
   SerializationType type() const override { return SerializationType::Hessian2; }
 
   std::pair<RpcInvocationSharedPtr, bool>
-  deserializeRpcInvocation(Buffer::Instance& buffer, ContextSharedPtr context) override;
+  deserializeRpcInvocation(Buffer::Instance& buffer, const Context& context) override;
+
+  std::pair<RpcInvocationSharedPtr, bool>
+  deserializeRpcInvocationPrefix(Buffer::Instance& buffer, const Context& context) override;
 
   std::pair<RpcResultSharedPtr, bool> deserializeRpcResult(Buffer::Instance& buffer,
-                                                           ContextSharedPtr context) override;
+                                                           const Context& context) override;
+
+  std::pair<RpcResultSharedPtr, bool> deserializeRpcResultPrefix(Buffer::Instance& buffer,
+                                                                 const Context& context) override;
 
   size_t serializeRpcResult(Buffer::Instance& output_buffer, const std::string& content,
                             RpcResponseType type) override;
+
+  size_t serializeRpcAttachment(Buffer::Instance& output_buffer,
+                                const RpcInvocationImpl::Attachment& attachment) override;
 };
 
 } // namespace Dubbo
@@ -1,8 +1,12 @@
 #include "src/application_protocols/dubbo/dubbo_protocol_impl.h"
 
+#include <cstring>
+
+#include "envoy/common/exception.h"
 #include "envoy/registry/registry.h"
 
 #include "source/common/common/assert.h"
+#include "source/common/common/fmt.h"
 #include "src/application_protocols/dubbo/message_impl.h"
 
 namespace Envoy {
@@ -54,7 +58,7 @@ bool isValidResponseStatus(ResponseStatus status) {
   return true;
 }
 
-void parseRequestInfoFromBuffer(Buffer::Instance& data, MessageMetadataSharedPtr metadata) {
+void parseRequestInfoFromBuffer(Buffer::Instance& data, MessageMetadata& metadata) {
   ASSERT(data.length() >= DubboProtocolImpl::MessageSize);
   uint8_t flag = data.peekInt<uint8_t>(FlagOffset);
   bool is_two_way = (flag & TwoWayMask) == TwoWayMask ? true : false;
@@ -65,14 +69,14 @@ void parseRequestInfoFromBuffer(Buffer::Instance& data, MessageMetadataSharedPtr
                      static_cast<std::underlying_type<SerializationType>::type>(type)));
   }
 
-  if (!is_two_way && metadata->messageType() != MessageType::HeartbeatRequest) {
-    metadata->setMessageType(MessageType::Oneway);
+  if (!is_two_way && metadata.messageType() != MessageType::HeartbeatRequest) {
+    metadata.setMessageType(MessageType::Oneway);
   }
 
-  metadata->setSerializationType(type);
+  metadata.setSerializationType(type);
 }
 
-void parseResponseInfoFromBuffer(Buffer::Instance& buffer, MessageMetadataSharedPtr metadata) {
+void parseResponseInfoFromBuffer(Buffer::Instance& buffer, MessageMetadata& metadata) {
   ASSERT(buffer.length() >= DubboProtocolImpl::MessageSize);
   ResponseStatus status = static_cast<ResponseStatus>(buffer.peekInt<uint8_t>(StatusOffset));
   if (!isValidResponseStatus(status)) {
@@ -81,17 +85,13 @@ void parseResponseInfoFromBuffer(Buffer::Instance& buffer, MessageMetadataShared
                      static_cast<std::underlying_type<ResponseStatus>::type>(status)));
   }
 
-  metadata->setResponseStatus(status);
+  metadata.setResponseStatus(status);
 }
 
-std::pair<ContextSharedPtr, bool>
-DubboProtocolImpl::decodeHeader(Buffer::Instance& buffer, MessageMetadataSharedPtr metadata) {
-  if (!metadata) {
-    throw EnvoyException("invalid metadata parameter");
-  }
-
+bool DubboProtocolImpl::decodeHeader(Buffer::Instance& buffer, MessageMetadata& metadata,
+                                     ContextImpl& context) {
   if (buffer.length() < DubboProtocolImpl::MessageSize) {
-    return std::pair<ContextSharedPtr, bool>(nullptr, false);
+    return false;
   }
 
   uint16_t magic_number = buffer.peekBEInt<uint16_t>();
@@ -111,46 +111,45 @@ DubboProtocolImpl::decodeHeader(Buffer::Instance& buffer, MessageMetadataSharedP
     throw EnvoyException(absl::StrCat("invalid dubbo message size ", body_size));
   }
 
-  metadata->setRequestId(request_id);
+  metadata.setRequestId(request_id);
 
   if (type == MessageType::Request) {
     if (is_event) {
       type = MessageType::HeartbeatRequest;
     }
-    metadata->setMessageType(type);
+    metadata.setMessageType(type);
     parseRequestInfoFromBuffer(buffer, metadata);
   } else {
     if (is_event) {
       type = MessageType::HeartbeatResponse;
     }
-    metadata->setMessageType(type);
+    metadata.setMessageType(type);
     parseResponseInfoFromBuffer(buffer, metadata);
   }
 
-  auto context = std::make_shared<ContextImpl>();
-  context->setHeaderSize(DubboProtocolImpl::MessageSize);
-  context->setBodySize(body_size);
-  context->setHeartbeat(is_event);
+  context.setHeaderSize(DubboProtocolImpl::MessageSize);
+  context.setBodySize(body_size);
+  context.setHeartbeat(is_event);
 
-  return std::pair<ContextSharedPtr, bool>(context, true);
+  return true;
 }
 
-bool DubboProtocolImpl::decodeData(Buffer::Instance& buffer, ContextSharedPtr context,
-                                   MessageMetadataSharedPtr metadata) {
+bool DubboProtocolImpl::decodeData(Buffer::Instance& buffer, const Context& context,
+                                   MessageMetadata& metadata) {
   ASSERT(serializer_);
 
-  if ((buffer.length()) < context->bodySize()) {
+  if ((buffer.length()) < context.bodySize()) {
     return false;
   }
 
-  switch (metadata->messageType()) {
+  switch (metadata.messageType()) {
   case MessageType::Oneway:
   case MessageType::Request: {
     auto ret = serializer_->deserializeRpcInvocation(buffer, context);
     if (!ret.second) {
       return false;
     }
-    metadata->setInvocationInfo(ret.first);
+    metadata.setInvocationInfo(ret.first);
     break;
   }
   case MessageType::Response: {
@@ -159,7 +158,42 @@ bool DubboProtocolImpl::decodeData(Buffer::Instance& buffer, ContextSharedPtr co
       return false;
     }
     if (ret.first->hasException()) {
-      metadata->setMessageType(MessageType::Exception);
+      metadata.setMessageType(MessageType::Exception);
+    }
+    break;
+  }
+  default:
+    NOT_REACHED_GCOVR_EXCL_LINE;
+  }
+
+  return true;
+}
+
+bool DubboProtocolImpl::decodeDataPrefix(Buffer::Instance& buffer, const Context& context,
+                                         MessageMetadata& metadata) {
+  ASSERT(serializer_);
+
+  switch (metadata.messageType()) {
+  case MessageType::Request: {
+    // The invocation in front of the parameters is enough to route the request.
+    auto ret = serializer_->deserializeRpcInvocationPrefix(buffer, context);
+    if (!ret.second) {
+      return false;
+    }
+    metadata.setInvocationInfo(ret.first);
+    break;
+  }
+  case MessageType::Response: {
+    // The body of a failed response is an error message, there's no result type in front of it.
+    if (metadata.responseStatus() != ResponseStatus::Ok) {
+      break;
+    }
+    auto ret = serializer_->deserializeRpcResultPrefix(buffer, context);
+    if (!ret.second) {
+      return false;
+    }
+    if (ret.first->hasException()) {
+      metadata.setMessageType(MessageType::Exception);
     }
     break;
   }
@@ -170,6 +204,85 @@ bool DubboProtocolImpl::decodeData(Buffer::Instance& buffer, ContextSharedPtr co
   return true;
 }
 
+bool DubboProtocolImpl::respondHeartbeat(Buffer::Instance& buffer, Buffer::Instance& response) {
+  if (buffer.length() < DubboProtocolImpl::MessageSize ||
+      buffer.peekBEInt<uint16_t>() != MagicNumber) {
+    return false;
+  }
+
+  const uint8_t flag = buffer.peekInt<uint8_t>(FlagOffset);
+  if ((flag & (MessageTypeMask | EventMask)) != (MessageTypeMask | EventMask) ||
+      !isValidSerializationType(static_cast<SerializationType>(flag & SerializationTypeMask))) {
+    return false;
+  }
+
+  const int32_t body_size = buffer.peekBEInt<int32_t>(BodySizeOffset);
+  if (body_size < 0 || body_size > MaxBodySize ||
+      buffer.length() < DubboProtocolImpl::MessageSize + static_cast<uint64_t>(body_size)) {
+    return false;
+  }
+
+  // The response is the request header with the response flags, an OK status and an empty body,
+  // the request ID is copied as is.
+  uint8_t header[DubboProtocolImpl::MessageSize];
+  buffer.copyOut(0, DubboProtocolImpl::MessageSize, header);
+  header[FlagOffset] = (flag & SerializationTypeMask) | EventMask;
+  header[StatusOffset] = static_cast<uint8_t>(ResponseStatus::Ok);
+  std::memset(header + BodySizeOffset, 0, sizeof(uint32_t));
+
+  response.add(header, DubboProtocolImpl::MessageSize);
+  buffer.drain(DubboProtocolImpl::MessageSize + body_size);
+  return true;
+}
+
+bool DubboProtocolImpl::encodeRequest(Buffer::Instance& buffer, Buffer::Instance& message,
+                                      const RpcInvocationImpl& invocation) {
+  ASSERT(serializer_);
+
+  const size_t attachment_offset = invocation.attachment().attachmentOffset();
+  if (attachment_offset < DubboProtocolImpl::MessageSize || attachment_offset > message.length()) {
+    return false;
+  }
+
+  Buffer::OwnedImpl attachment_buffer;
+  const size_t attachment_size =
+      serializer_->serializeRpcAttachment(attachment_buffer, invocation.attachment());
+  const uint64_t body_size = attachment_offset - DubboProtocolImpl::MessageSize + attachment_size;
+  if (body_size > static_cast<uint64_t>(MaxBodySize)) {
+    throw EnvoyException(
+        fmt::format("dubbo request body size {} exceeds the limit {}", body_size, MaxBodySize));
+  }
+
+  // Only the header is copied to patch its body size, the slices of the parameters are moved.
+  uint8_t header[BodySizeOffset];
+  message.copyOut(0, BodySizeOffset, header);
+  message.drain(DubboProtocolImpl::MessageSize);
+
+  buffer.add(header, BodySizeOffset);
+  buffer.writeBEInt<uint32_t>(static_cast<uint32_t>(body_size));
+  buffer.move(message, attachment_offset - DubboProtocolImpl::MessageSize);
+  buffer.move(attachment_buffer);
+  message.drain(message.length());
+  return true;
+}
+
+bool DubboProtocolImpl::rewriteRequestId(Buffer::Instance& message, uint64_t request_id) {
+  if (message.length() < DubboProtocolImpl::MessageSize ||
+      message.peekBEInt<uint16_t>() != MagicNumber) {
+    return false;
+  }
+
+  // The header is rebuilt with the new ID, the body slices are left where they are.
+  uint8_t header[DubboProtocolImpl::MessageSize];
+  message.copyOut(0, DubboProtocolImpl::MessageSize, header);
+  for (uint64_t i = 0; i < sizeof(uint64_t); i++) {
+    header[RequestIDOffset + i] = static_cast<uint8_t>(request_id >> (56 - 8 * i));
+  }
+  message.drain(DubboProtocolImpl::MessageSize);
+  message.prepend(absl::string_view(reinterpret_cast<const char*>(header), sizeof(header)));
+  return true;
+}
+
 bool DubboProtocolImpl::encode(Buffer::Instance& buffer, const MessageMetadata& metadata,
                                const std::string& content, RpcResponseType type) {
   ASSERT(serializer_);
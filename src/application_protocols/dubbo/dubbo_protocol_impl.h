@@ -16,13 +16,19 @@ public:
   const std::string& name() const override { return ProtocolNames::get().fromType(type()); }
   ProtocolType type() const override { return ProtocolType::Dubbo; }
 
-  std::pair<ContextSharedPtr, bool> decodeHeader(Buffer::Instance& buffer,
-                                                 MessageMetadataSharedPtr metadata) override;
-  bool decodeData(Buffer::Instance& buffer, ContextSharedPtr context,
-                  MessageMetadataSharedPtr metadata) override;
+  bool decodeHeader(Buffer::Instance& buffer, MessageMetadata& metadata,
+                    ContextImpl& context) override;
+  bool decodeData(Buffer::Instance& buffer, const Context& context,
+                  MessageMetadata& metadata) override;
+  bool decodeDataPrefix(Buffer::Instance& buffer, const Context& context,
+                        MessageMetadata& metadata) override;
 
   bool encode(Buffer::Instance& buffer, const MessageMetadata& metadata, const std::string& content,
               RpcResponseType type) override;
+  bool respondHeartbeat(Buffer::Instance& buffer, Buffer::Instance& response) override;
+  bool encodeRequest(Buffer::Instance& buffer, Buffer::Instance& message,
+                     const RpcInvocationImpl& invocation) override;
+  bool rewriteRequestId(Buffer::Instance& message, uint64_t request_id) override;
 
   static constexpr uint8_t MessageSize = 16;
   static constexpr int32_t MaxBodySize = 16 * 1024 * 1024;
@@ -1,5 +1,12 @@
 #include "src/application_protocols/dubbo/hessian_utils.h"
 
+#include <algorithm>
+#include <cstring>
+
+#include "envoy/common/exception.h"
+
+#include "source/common/common/fmt.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace NetworkFilters {
@@ -60,9 +67,355 @@ void BufferWriter::rawWrite(const void* data, uint64_t size) { buffer_.add(data,
 
 void BufferWriter::rawWrite(absl::string_view data) { buffer_.add(data); }
 
+void BufferCursor::seek(uint64_t offset) {
+  if (!sliced_ || length_ != buffer_.length()) {
+    slices_ = buffer_.getRawSlices();
+    length_ = buffer_.length();
+    sliced_ = true;
+    slice_index_ = 0;
+    slice_start_ = 0;
+  }
+
+  if (offset < slice_start_) {
+    // Reads go backwards rarely, e.g. a decoder peeking behind its offset.
+    slice_index_ = 0;
+    slice_start_ = 0;
+  }
+  while (slice_index_ < slices_.size() && offset >= slice_start_ + slices_[slice_index_].len_) {
+    slice_start_ += slices_[slice_index_].len_;
+    slice_index_++;
+  }
+}
+
+absl::string_view BufferCursor::span(uint64_t offset) {
+  seek(offset);
+  if (slice_index_ == slices_.size()) {
+    return {};
+  }
+
+  const auto& slice = slices_[slice_index_];
+  const uint64_t start = offset - slice_start_;
+  return {static_cast<const char*>(slice.mem_) + start, slice.len_ - start};
+}
+
+void BufferCursor::copyOut(uint64_t offset, uint64_t size, void* data) {
+  ASSERT(offset + size <= buffer_.length());
+  uint8_t* dest = static_cast<uint8_t*>(data);
+  while (size > 0) {
+    const absl::string_view bytes = span(offset);
+    ASSERT(!bytes.empty());
+    const uint64_t copied = std::min<uint64_t>(size, bytes.size());
+    memcpy(dest, bytes.data(), copied);
+    dest += copied;
+    offset += copied;
+    size -= copied;
+  }
+}
+
 void BufferReader::rawReadNBytes(void* data, size_t len, size_t peek_offset) {
   ASSERT(byteAvailable() - peek_offset >= len);
-  buffer_.copyOut(offset() + peek_offset, len, data);
+  cursor_.copyOut(offset() + peek_offset, len, data);
+}
+
+namespace {
+
+// The nesting depth of the lists, maps and objects which may be skipped, the skipper recurses into
+// them.
+constexpr uint32_t MaxDepth = 128;
+
+} // namespace
+
+// See http://hessian.caucho.com/doc/hessian-serialization.html for the grammar of the values.
+HessianSkipper::HessianSkipper(Envoy::Buffer::Instance& buffer, uint64_t offset, uint64_t limit)
+    : cursor_(buffer), offset_(offset), limit_(std::min(limit, buffer.length())) {}
+
+void HessianSkipper::skipValue() { skipValue(0); }
+
+std::string HessianSkipper::readString() {
+  std::string value;
+  readString(readByte(), &value);
+  return value;
+}
+
+void HessianSkipper::skipValue(uint32_t depth) {
+  if (depth > MaxDepth) {
+    throw EnvoyException(fmt::format("hessian value is nested deeper than {}", MaxDepth));
+  }
+
+  const uint8_t tag = readByte();
+  if (tag <= 0x1f) {
+    // Compact string.
+    readStringChunk(tag, nullptr);
+  } else if (tag <= 0x2f) {
+    // Compact binary.
+    skipBytes(tag - 0x20);
+  } else if (tag <= 0x33) {
+    readStringChunk(readLength(tag, 0x30, 1), nullptr);
+  } else if (tag <= 0x37) {
+    skipBytes(readLength(tag, 0x34, 1));
+  } else if (tag <= 0x3f) {
+    // Three-octet compact long.
+    skipBytes(2);
+  } else if (tag >= 0x80) {
+    if (tag <= 0xbf || (tag >= 0xd8 && tag <= 0xef)) {
+      // One-octet compact int or long.
+    } else if (tag <= 0xcf || tag >= 0xf0) {
+      // Two-octet compact int or long.
+      skipBytes(1);
+    } else {
+      // Three-octet compact int.
+      skipBytes(2);
+    }
+  } else if (tag >= 0x60 && tag <= 0x6f) {
+    // Object with a compact class definition reference.
+    skipObjectFields(tag - 0x60, depth);
+  } else if (tag >= 0x70 && tag <= 0x77) {
+    // Typed fixed length list with a compact length.
+    skipValue(depth + 1);
+    for (uint32_t i = 0; i < static_cast<uint32_t>(tag - 0x70); i++) {
+      skipValue(depth + 1);
+    }
+  } else if (tag >= 0x78 && tag <= 0x7f) {
+    // Untyped fixed length list with a compact length.
+    for (uint32_t i = 0; i < static_cast<uint32_t>(tag - 0x78); i++) {
+      skipValue(depth + 1);
+    }
+  } else {
+    switch (tag) {
+    case 'A':
+    case 'B':
+      // Binary chunks, the non-final chunks are followed by the next chunk.
+      for (uint8_t chunk = tag;; chunk = readByte()) {
+        if (chunk != 'A' && chunk != 'B') {
+          throw EnvoyException(fmt::format("invalid hessian binary chunk tag {}", chunk));
+        }
+        skipBytes(readLength(chunk, chunk, 2));
+        if (chunk == 'B') {
+          break;
+        }
+      }
+      break;
+    case 'R':
+    case 'S':
+      readString(tag, nullptr);
+      break;
+    case 'C':
+      // A class definition is followed by the object which refers to it.
+      skipClassDefinition(depth);
+      skipValue(depth);
+      break;
+    case 'O':
+      skipObjectFields(readInt(), depth);
+      break;
+    case 'D':
+    case 'J':
+    case 'L':
+      skipBytes(8);
+      break;
+    case 'I':
+    case 'K':
+    case 'Y':
+    case 0x5f:
+      skipBytes(4);
+      break;
+    case 0x5e:
+      skipBytes(2);
+      break;
+    case 0x5d:
+      skipBytes(1);
+      break;
+    case 'F':
+    case 'N':
+    case 'T':
+    case 0x5b:
+    case 0x5c:
+      break;
+    case 'Q':
+      // Reference to a previous value.
+      readInt();
+      break;
+    case 'H':
+      // Untyped map, the keys and the values until the end.
+      skipValuesUntilEnd(depth);
+      break;
+    case 'M':
+    case 'U':
+      // Typed map or variable length list, the type then the entries until the end.
+      skipValue(depth + 1);
+      skipValuesUntilEnd(depth);
+      break;
+    case 'W':
+      skipValuesUntilEnd(depth);
+      break;
+    case 'V': {
+      skipValue(depth + 1);
+      const int32_t length = readInt();
+      for (int32_t i = 0; i < length; i++) {
+        skipValue(depth + 1);
+      }
+      break;
+    }
+    case 'X': {
+      const int32_t length = readInt();
+      for (int32_t i = 0; i < length; i++) {
+        skipValue(depth + 1);
+      }
+      break;
+    }
+    default:
+      throw EnvoyException(fmt::format("invalid hessian value tag {}", tag));
+    }
+  }
+}
+
+void HessianSkipper::skipValuesUntilEnd(uint32_t depth) {
+  while (peekByte() != 'Z') {
+    skipValue(depth + 1);
+  }
+  skipBytes(1);
+}
+
+void HessianSkipper::skipClassDefinition(uint32_t depth) {
+  skipValue(depth + 1);
+  const int32_t fields = readInt();
+  if (fields < 0) {
+    throw EnvoyException(fmt::format("invalid hessian class definition field number {}", fields));
+  }
+  for (int32_t i = 0; i < fields; i++) {
+    skipValue(depth + 1);
+  }
+  class_fields_.push_back(fields);
+}
+
+void HessianSkipper::skipObjectFields(int32_t definition, uint32_t depth) {
+  if (definition < 0 || static_cast<uint64_t>(definition) >= class_fields_.size()) {
+    throw EnvoyException(fmt::format("undefined hessian class definition {}", definition));
+  }
+  for (uint32_t i = 0; i < class_fields_[definition]; i++) {
+    skipValue(depth + 1);
+  }
+}
+
+int32_t HessianSkipper::readInt() {
+  const uint8_t tag = readByte();
+  if (tag >= 0x80 && tag <= 0xbf) {
+    return static_cast<int32_t>(tag) - 0x90;
+  }
+  if (tag >= 0xc0 && tag <= 0xcf) {
+    return (static_cast<int32_t>(tag) - 0xc8) * 0x100 + readByte();
+  }
+  if (tag >= 0xd0 && tag <= 0xd7) {
+    const int32_t high = (static_cast<int32_t>(tag) - 0xd4) * 0x10000;
+    const int32_t middle = readByte() << 8;
+    return high + middle + readByte();
+  }
+  if (tag == 'I') {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+      value = (value << 8) | readByte();
+    }
+    return static_cast<int32_t>(value);
+  }
+  throw EnvoyException(fmt::format("invalid hessian int tag {}", tag));
+}
+
+uint32_t HessianSkipper::readLength(uint8_t tag, uint8_t base, uint32_t size) {
+  uint32_t length = tag - base;
+  for (uint32_t i = 0; i < size; i++) {
+    length = (length << 8) | readByte();
+  }
+  return length;
+}
+
+void HessianSkipper::readString(uint8_t tag, std::string* value) {
+  if (tag == 'N') {
+    return;
+  }
+
+  if (tag <= 0x1f) {
+    readStringChunk(tag, value);
+  } else if (tag >= 0x30 && tag <= 0x33) {
+    readStringChunk(readLength(tag, 0x30, 1), value);
+  } else {
+    // String chunks, the non-final chunks are followed by the next chunk.
+    for (uint8_t chunk = tag;; chunk = readByte()) {
+      if (chunk != 'R' && chunk != 'S') {
+        throw EnvoyException(fmt::format("invalid hessian string tag {}", chunk));
+      }
+      readStringChunk(readLength(0, 0, 2), value);
+      if (chunk == 'S') {
+        break;
+      }
+    }
+  }
+}
+
+void HessianSkipper::readStringChunk(uint32_t chars, std::string* value) {
+  // The length of a string is in UTF-16 characters, a four-byte UTF-8 character is a surrogate
+  // pair of two characters.
+  uint32_t read = 0;
+  while (read < chars) {
+    if (value == nullptr) {
+      // Skip the single-byte characters of the current slice at once, most strings are ASCII.
+      const absl::string_view bytes = cursor_.span(offset_);
+      const uint64_t available = std::min<uint64_t>(bytes.size(), limit_ - offset_);
+      uint64_t ascii = 0;
+      while (ascii < available && read < chars && static_cast<uint8_t>(bytes[ascii]) < 0x80) {
+        ascii++;
+        read++;
+      }
+      offset_ += ascii;
+      if (read == chars) {
+        break;
+      }
+    }
+
+    const uint8_t lead = readByte();
+    uint32_t continuation = 0;
+    if (lead < 0x80) {
+      read++;
+    } else if ((lead & 0xe0) == 0xc0) {
+      continuation = 1;
+      read++;
+    } else if ((lead & 0xf0) == 0xe0) {
+      continuation = 2;
+      read++;
+    } else if ((lead & 0xf8) == 0xf0) {
+      continuation = 3;
+      read += 2;
+    } else {
+      throw EnvoyException(fmt::format("invalid utf-8 lead byte {} in hessian string", lead));
+    }
+
+    if (value == nullptr) {
+      skipBytes(continuation);
+      continue;
+    }
+    value->push_back(static_cast<char>(lead));
+    for (uint32_t i = 0; i < continuation; i++) {
+      value->push_back(static_cast<char>(readByte()));
+    }
+  }
+}
+
+uint8_t HessianSkipper::peekByte() {
+  if (offset_ >= limit_) {
+    throw EnvoyException("hessian value exceeds the end of the message");
+  }
+  return static_cast<uint8_t>(cursor_.span(offset_)[0]);
+}
+
+uint8_t HessianSkipper::readByte() {
+  const uint8_t value = peekByte();
+  offset_++;
+  return value;
+}
+
+void HessianSkipper::skipBytes(uint64_t size) {
+  if (size > limit_ - offset_) {
+    throw EnvoyException("hessian value exceeds the end of the message");
+  }
+  offset_ += size;
 }
 
 } // namespace Dubbo
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "envoy/buffer/buffer.h"
 
@@ -34,9 +35,48 @@ private:
   Envoy::Buffer::Instance& buffer_;
 };
 
+/**
+ * BufferCursor reads a buffer at mostly increasing offsets. It remembers the slice of the last
+ * read, so a multi-slice buffer read from front to back has its slice list walked once, whereas
+ * Buffer::Instance::copyOut() walks the slice list from the front for every read.
+ *
+ * The slices are looked up again if the length of the buffer changes.
+ */
+class BufferCursor {
+public:
+  BufferCursor(Envoy::Buffer::Instance& buffer) : buffer_(buffer) {}
+
+  /**
+   * Copies the bytes at the offset of the buffer out.
+   * @param offset the offset in the buffer.
+   * @param size the number of bytes, which must be in the buffer.
+   * @param data the destination of the bytes.
+   */
+  void copyOut(uint64_t offset, uint64_t size, void* data);
+
+  /**
+   * @return the contiguous bytes from the offset to the end of its slice, which are valid until the
+   * buffer is changed, or an empty view if the offset is at or past the end of the buffer.
+   */
+  absl::string_view span(uint64_t offset);
+
+private:
+  void seek(uint64_t offset);
+
+  Envoy::Buffer::Instance& buffer_;
+  Envoy::Buffer::RawSliceVector slices_;
+  // The length of the buffer the slices are for.
+  uint64_t length_{0};
+  bool sliced_{false};
+  // The slice of the last read and its offset in the buffer.
+  size_t slice_index_{0};
+  uint64_t slice_start_{0};
+};
+
 class BufferReader : public Hessian2::Reader {
 public:
-  BufferReader(Envoy::Buffer::Instance& buffer, uint64_t initial_offset = 0) : buffer_(buffer) {
+  BufferReader(Envoy::Buffer::Instance& buffer, uint64_t initial_offset = 0)
+      : buffer_(buffer), cursor_(buffer) {
     initial_offset_ = initial_offset;
   }
 
@@ -46,6 +86,64 @@ public:
 
 private:
   Envoy::Buffer::Instance& buffer_;
+  BufferCursor cursor_;
+};
+
+/**
+ * HessianSkipper computes the encoded length of Hessian2 values without decoding them into
+ * Hessian2::Object trees, so that the fields behind them, e.g. the attachments of a Dubbo request,
+ * are reached without allocating the values in front of them.
+ *
+ * The class definitions are kept as they're skipped so that the objects referring to them can be
+ * skipped, so the values of a message must be skipped in order by the same skipper.
+ */
+class HessianSkipper {
+public:
+  /**
+   * @param buffer the buffer holding the values.
+   * @param offset the offset of the first value in the buffer.
+   * @param limit the offset in the buffer where the values end, e.g. the end of the message.
+   */
+  HessianSkipper(Envoy::Buffer::Instance& buffer, uint64_t offset, uint64_t limit);
+
+  /**
+   * Skips the value at the current offset.
+   * @throws EnvoyException if the value is invalid or it exceeds the limit.
+   */
+  void skipValue();
+
+  /**
+   * Reads the string at the current offset, a null value is read as an empty string.
+   * @throws EnvoyException if the value isn't a string or it exceeds the limit.
+   */
+  std::string readString();
+
+  /**
+   * @return uint64_t the offset of the next value in the buffer.
+   */
+  uint64_t offset() const { return offset_; }
+
+private:
+  void skipValue(uint32_t depth);
+  void skipValuesUntilEnd(uint32_t depth);
+  void skipClassDefinition(uint32_t depth);
+  void skipObjectFields(int32_t definition, uint32_t depth);
+  int32_t readInt();
+  // Reads a length prefix of the given size, which follows the tag byte.
+  uint32_t readLength(uint8_t tag, uint8_t base, uint32_t size);
+  // Reads the string of the tag, appending it to value if any.
+  void readString(uint8_t tag, std::string* value);
+  // Reads a string chunk of the given number of UTF-16 characters, appending it to value if any.
+  void readStringChunk(uint32_t chars, std::string* value);
+  uint8_t peekByte();
+  uint8_t readByte();
+  void skipBytes(uint64_t size);
+
+  BufferCursor cursor_;
+  uint64_t offset_;
+  const uint64_t limit_;
+  // The field numbers of the class definitions.
+  std::vector<uint32_t> class_fields_;
 };
 
 } // namespace Dubbo
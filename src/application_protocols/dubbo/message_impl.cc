@@ -71,7 +71,7 @@ void RpcInvocationImpl::assignAttachmentIfNeed() const {
     return;
   }
 
-  assignParametersIfNeed();
+  // The attachment is decoded independently of the parameters, which are skipped.
   attachment_ = attachment_lazy_callback_();
 
   if (auto g = attachment_->lookup("group"); g != nullptr) {
@@ -84,6 +84,18 @@ const absl::optional<std::string>& RpcInvocationImpl::serviceGroup() const {
   return group_;
 }
 
+absl::optional<std::string> RpcInvocationImpl::decodeString(absl::string_view key) const {
+  if (attachment_lazy_callback_ == nullptr) {
+    return absl::nullopt;
+  }
+
+  const std::string* value = attachment().lookup(std::string(key));
+  if (value == nullptr) {
+    return absl::nullopt;
+  }
+  return *value;
+}
+
 const RpcInvocationImpl::Attachment& RpcInvocationImpl::attachment() const {
   assignAttachmentIfNeed();
   return *attachment_;
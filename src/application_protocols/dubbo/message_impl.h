@@ -4,6 +4,7 @@
 
 #include "src/application_protocols/dubbo/hessian_utils.h"
 #include "src/application_protocols/dubbo/message.h"
+#include "src/meta_protocol_proxy/codec/codec.h"
 
 namespace Envoy {
 namespace Extensions {
@@ -22,9 +23,23 @@ public:
   void setBodySize(size_t size) { body_size_ = size; }
   void setHeartbeat(bool heartbeat) { is_heartbeat_ = heartbeat; }
 
+  // The bytes of a streamed message which are left in the buffer when it's decoded.
+  uint64_t streamedBytes() const { return streamed_bytes_; }
+  void setStreamedBytes(uint64_t bytes) { streamed_bytes_ = bytes; }
+
+  // The context is reused by the messages of a connection, it's reset before a message is decoded.
+  void reset() {
+    origin_message_.drain(origin_message_.length());
+    header_size_ = 0;
+    body_size_ = 0;
+    streamed_bytes_ = 0;
+    is_heartbeat_ = false;
+  }
+
 private:
   size_t header_size_{0};
   size_t body_size_{0};
+  uint64_t streamed_bytes_{0};
 
   bool is_heartbeat_{false};
 };
@@ -52,7 +67,9 @@ protected:
   absl::optional<std::string> group_;
 };
 
-class RpcInvocationImpl : public RpcInvocationBase {
+// The attachments of the invocation are the strings decoded on demand of its metadata, they're
+// only decoded if a route or a filter looks up a key which isn't put by the codec.
+class RpcInvocationImpl : public RpcInvocationBase, public MetaProtocolProxy::LazyStrings {
 public:
   // Each parameter consists of a parameter binary size and Hessian2::Object.
   using Parameters = std::vector<Hessian2::ObjectPtr>;
@@ -118,6 +135,14 @@ public:
 
   const absl::optional<std::string>& serviceGroup() const override;
 
+  // The original message of the request, the parameters and the attachment are decoded from it
+  // on demand. It's filled in by the codec once the message is decoded and isn't changed after,
+  // as the origin message of the request metadata refers to its slices.
+  Buffer::Instance& message() { return message_; }
+
+  // MetaProtocolProxy::LazyStrings
+  absl::optional<std::string> decodeString(absl::string_view key) const override;
+
 private:
   void assignParametersIfNeed() const;
   void assignAttachmentIfNeed() const;
@@ -127,6 +152,7 @@ private:
 
   mutable ParametersPtr parameters_{};
   mutable AttachmentPtr attachment_{};
+  Buffer::OwnedImpl message_;
 };
 
 class RpcResultImpl : public RpcResult {
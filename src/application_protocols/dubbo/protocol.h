@@ -51,14 +51,14 @@ public:
    *
    * @param buffer the currently buffered dubbo data.
    * @param metadata the meta data of current messages
-   * @return ContextSharedPtr save the context data of current messages,
-   *                 nullptr if more data is required.
-   *         bool true if a complete message was successfully consumed, false if more data
+   * @param context save the context data of current messages, it's reused by the messages of a
+   *                 connection.
+   * @return bool true if a complete header was successfully consumed, false if more data
    *                 is required.
    * @throws EnvoyException if the data is not valid for this protocol.
    */
-  virtual std::pair<ContextSharedPtr, bool> decodeHeader(Buffer::Instance& buffer,
-                                                         MessageMetadataSharedPtr metadata) PURE;
+  virtual bool decodeHeader(Buffer::Instance& buffer, MessageMetadata& metadata,
+                            ContextImpl& context) PURE;
 
   /*
    * decodes the dubbo protocol message body, potentially invoking callbacks.
@@ -71,8 +71,23 @@ public:
    *                 is required.
    * @throws EnvoyException if the data is not valid for this protocol.
    */
-  virtual bool decodeData(Buffer::Instance& buffer, ContextSharedPtr context,
-                          MessageMetadataSharedPtr metadata) PURE;
+  virtual bool decodeData(Buffer::Instance& buffer, const Context& context,
+                          MessageMetadata& metadata) PURE;
+
+  /*
+   * decodes the front part of the dubbo protocol message body, i.e. the invocation of a request
+   * which is needed for routing, or the result type of a response. The rest of the body is
+   * streamed without being decoded. Nothing is removed from the buffer.
+   *
+   * @param buffer the currently buffered dubbo data, starting at the message body.
+   * @param context the context data of current messages.
+   * @param metadata the meta data of current messages
+   * @return bool true if the front part of the body was successfully decoded, false if more data
+   *                 is required.
+   * @throws EnvoyException if the data is not valid for this protocol.
+   */
+  virtual bool decodeDataPrefix(Buffer::Instance& buffer, const Context& context,
+                                MessageMetadata& metadata) PURE;
 
   /*
    * encodes the dubbo protocol message.
@@ -87,6 +102,40 @@ public:
                       const std::string& content,
                       RpcResponseType type = RpcResponseType::ResponseWithValue) PURE;
 
+  /*
+   * answers the heartbeat request at the front of the buffer from its fixed header, without
+   * decoding it. If successful, the heartbeat request is removed from the buffer.
+   *
+   * @param buffer the currently buffered dubbo data.
+   * @param response save the heartbeat response.
+   * @return bool true if a complete heartbeat request was answered, false if the buffer doesn't
+   *                 start with a complete and valid heartbeat request.
+   */
+  virtual bool respondHeartbeat(Buffer::Instance& buffer, Buffer::Instance& response) PURE;
+
+  /*
+   * encodes a request from its original message with the re-serialized attachment of the
+   * invocation. The header and the parameters of the original message are moved into the buffer
+   * without being re-serialized, and the body size of the header is patched.
+   *
+   * @param buffer save the encoded request.
+   * @param message the original message of the request, it's drained if successful.
+   * @param invocation the invocation of the request, its attachment has been decoded.
+   * @return bool true if the request is encoded, false if the attachment offset doesn't fall in
+   *                 the body of the original message.
+   */
+  virtual bool encodeRequest(Buffer::Instance& buffer, Buffer::Instance& message,
+                             const RpcInvocationImpl& invocation) PURE;
+
+  /*
+   * rewrites the request ID in the fixed header of a message.
+   *
+   * @param message the buffer which starts with the message.
+   * @param request_id the new request ID.
+   * @return bool true if the ID is rewritten, false if the buffer doesn't start with a header.
+   */
+  virtual bool rewriteRequestId(Buffer::Instance& message, uint64_t request_id) PURE;
+
 protected:
   SerializerPtr serializer_;
 };
@@ -9,6 +9,7 @@
 #include "source/common/config/utility.h"
 #include "source/common/singleton/const_singleton.h"
 #include "src/application_protocols/dubbo/message.h"
+#include "src/application_protocols/dubbo/message_impl.h"
 #include "src/application_protocols/dubbo/metadata.h"
 #include "src/application_protocols/dubbo/protocol_constants.h"
 
@@ -45,7 +46,21 @@ public:
    * @throws EnvoyException if the data is not valid for this serialization
    */
   virtual std::pair<RpcInvocationSharedPtr, bool>
-  deserializeRpcInvocation(Buffer::Instance& buffer, ContextSharedPtr context) PURE;
+  deserializeRpcInvocation(Buffer::Instance& buffer, const Context& context) PURE;
+
+  /**
+   * deserialize the service and method of an rpc call whose parameters and attachment are streamed
+   * without being decoded. Nothing is removed from the buffer.
+   *
+   * @param buffer the currently buffered dubbo data, which may hold a part of the body only
+   * @param context context information for RPC messages
+   * @return a pair containing the deserialized invocation information, whose parameters and
+   *         attachment are empty, and whether it's complete. It's incomplete if more data is
+   *         required.
+   * @throws EnvoyException if the data is not valid for this serialization
+   */
+  virtual std::pair<RpcInvocationSharedPtr, bool>
+  deserializeRpcInvocationPrefix(Buffer::Instance& buffer, const Context& context) PURE;
 
   /**
    * deserialize result of an rpc call
@@ -57,7 +72,20 @@ public:
    * @throws EnvoyException if the data is not valid for this serialization
    */
   virtual std::pair<RpcResultSharedPtr, bool> deserializeRpcResult(Buffer::Instance& buffer,
-                                                                   ContextSharedPtr context) PURE;
+                                                                   const Context& context) PURE;
+
+  /**
+   * deserialize the type of the result of an rpc call whose value is streamed without being
+   * decoded. Nothing is removed from the buffer.
+   *
+   * @param buffer the currently buffered dubbo data, which may hold a part of the body only
+   * @param context context information for RPC messages
+   * @return a pair containing the deserialized result, which tells whether it's an exception, and
+   *         whether it's complete. It's incomplete if more data is required.
+   * @throws EnvoyException if the data is not valid for this serialization
+   */
+  virtual std::pair<RpcResultSharedPtr, bool>
+  deserializeRpcResultPrefix(Buffer::Instance& buffer, const Context& context) PURE;
 
   /**
    * serialize result of an rpc call
@@ -70,6 +98,17 @@ public:
    */
   virtual size_t serializeRpcResult(Buffer::Instance& output_buffer, const std::string& content,
                                     RpcResponseType type) PURE;
+
+  /**
+   * serialize the attachment of an rpc call
+   * If successful, the output_buffer is written to the serialized attachment
+   *
+   * @param output_buffer store the serialized data
+   * @param attachment the attachment of the rpc call
+   * @return size_t the length of the serialized attachment
+   */
+  virtual size_t serializeRpcAttachment(Buffer::Instance& output_buffer,
+                                        const RpcInvocationImpl::Attachment& attachment) PURE;
 };
 
 using SerializerPtr = std::unique_ptr<Serializer>;
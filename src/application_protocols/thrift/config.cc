@@ -10,8 +10,9 @@ namespace NetworkFilters {
 namespace MetaProtocolProxy {
 namespace Thrift {
 
-MetaProtocolProxy::CodecPtr ThriftCodecConfig::createCodec(const Protobuf::Message&) {
-  return std::make_unique<Thrift::ThriftCodec>();
+MetaProtocolProxy::CodecPtr ThriftCodecConfig::createCodec(const Protobuf::Message& config) {
+  const auto& codec_config = dynamic_cast<const aeraki::meta_protocol::codec::ThriftCodec&>(config);
+  return std::make_unique<Thrift::ThriftCodec>(codec_config.payload_passthrough());
 };
 
 /**
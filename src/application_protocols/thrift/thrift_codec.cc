@@ -1,7 +1,10 @@
+#include <algorithm>
 #include <any>
+#include <limits>
 
 #include "envoy/buffer/buffer.h"
 
+#include "source/common/common/hex.h"
 #include "source/common/common/logger.h"
 #include "source/common/buffer/buffer_impl.h"
 
@@ -60,7 +63,10 @@ MetaProtocolProxy::DecodeStatus ThriftCodec::decode(Buffer::Instance& data,
     }
 
     frame_started_ = true;
-    state_machine_ = std::make_unique<DecoderStateMachine>(*protocol_, *metadata_);
+    // The body size is derived from the frame size, which is only known with the framed and
+    // header transports.
+    state_machine_ = std::make_unique<DecoderStateMachine>(
+        *protocol_, *metadata_, payload_passthrough_ && metadata_->hasFrameSize());
   }
 
   ASSERT(state_machine_ != nullptr);
@@ -82,7 +88,7 @@ MetaProtocolProxy::DecodeStatus ThriftCodec::decode(Buffer::Instance& data,
     return DecodeStatus::WaitForData;
   }
 
-  toMetadata(*metadata_, metadata);
+  toMetadata(metadata_, metadata);
   ENVOY_LOG(debug, "thrift: origin message length {}  ", metadata.getOriginMessage().length());
 
   frame_ended_ = true;
@@ -101,7 +107,7 @@ void ThriftCodec::complete() {
   frame_ended_ = false;
 }
 
-void ThriftCodec::encode(const MetaProtocolProxy::Metadata& metadata,
+void ThriftCodec::encode(MetaProtocolProxy::Metadata& metadata,
                          const MetaProtocolProxy::Mutation& mutation, Buffer::Instance& buffer) {
   (void)mutation;
   ASSERT(buffer.length() == 0);
@@ -109,7 +115,8 @@ void ThriftCodec::encode(const MetaProtocolProxy::Metadata& metadata,
   case MetaProtocolProxy::MessageType::Heartbeat: {
     break;
   }
-  case MetaProtocolProxy::MessageType::Request: {
+  case MetaProtocolProxy::MessageType::Request:
+  case MetaProtocolProxy::MessageType::Oneway: {
     // TODO
     break;
   }
@@ -122,6 +129,105 @@ void ThriftCodec::encode(const MetaProtocolProxy::Metadata& metadata,
   }
 }
 
+namespace {
+
+constexpr uint16_t BinaryProtocolVersion = 0x8001;
+constexpr uint8_t CompactProtocolId = 0x82;
+constexpr uint8_t CompactProtocolVersion = 1;
+constexpr uint16_t HeaderTransportMagic = 0x0FFF;
+// The frame size, the magic, the flags, the sequence ID and the size of the headers.
+constexpr uint64_t HeaderTransportPrefixSize = 14;
+constexpr uint64_t MaxVarintSize = 5;
+
+// Whether a message of the strict binary protocol or of the compact protocol starts at the offset.
+bool protocolStartsAt(const Buffer::Instance& buffer, uint64_t offset) {
+  if (buffer.length() < offset + 2) {
+    return false;
+  }
+  return buffer.peekBEInt<uint16_t>(offset) == BinaryProtocolVersion ||
+         (buffer.peekInt<uint8_t>(offset) == CompactProtocolId &&
+          (buffer.peekInt<uint8_t>(offset + 1) & 0x1f) == CompactProtocolVersion);
+}
+
+// Replaces the bytes at the offset with the given bytes, the slices after them are moved back as
+// they are.
+void replaceBytes(Buffer::Instance& buffer, uint64_t offset, uint64_t size,
+                  absl::string_view bytes) {
+  Buffer::OwnedImpl rewritten;
+  rewritten.move(buffer, offset);
+  rewritten.add(bytes);
+  buffer.drain(size);
+  rewritten.move(buffer);
+  buffer.move(rewritten);
+}
+
+} // namespace
+
+bool ThriftCodec::rewriteRequestId(Buffer::Instance& message, uint64_t request_id) {
+  // The message starts unframed, or after the size of a framed transport frame, or after the
+  // headers of a header transport frame. The payload of a header transport frame which has been
+  // transformed, e.g. compressed, doesn't start with a message and isn't rewritten.
+  uint64_t offset = 0;
+  bool framed = false;
+  if (message.length() >= HeaderTransportPrefixSize &&
+      message.peekBEInt<uint16_t>(4) == HeaderTransportMagic) {
+    offset = HeaderTransportPrefixSize + message.peekBEInt<uint16_t>(12) * 4;
+    framed = true;
+  } else if (!protocolStartsAt(message, 0)) {
+    offset = 4;
+    framed = true;
+  }
+  if (!protocolStartsAt(message, offset)) {
+    return false;
+  }
+
+  const uint32_t seq_id = static_cast<uint32_t>(request_id);
+  if (message.peekBEInt<uint16_t>(offset) == BinaryProtocolVersion) {
+    // The version and the type, the size of the name, the name and the sequence ID.
+    if (message.length() < offset + 8) {
+      return false;
+    }
+    const uint64_t seq_id_offset = offset + 8 + message.peekBEInt<uint32_t>(offset + 4);
+    if (message.length() < seq_id_offset + 4) {
+      return false;
+    }
+    Buffer::OwnedImpl bytes;
+    bytes.writeBEInt<uint32_t>(seq_id);
+    replaceBytes(message, seq_id_offset, sizeof(uint32_t), bytes.toString());
+    return true;
+  }
+
+  // The protocol ID, the version and the type, then the sequence ID as a varint.
+  const uint64_t seq_id_offset = offset + 2;
+  uint64_t old_size = 0;
+  while (true) {
+    if (old_size == MaxVarintSize || message.length() <= seq_id_offset + old_size) {
+      return false;
+    }
+    if ((message.peekInt<uint8_t>(seq_id_offset + old_size++) & 0x80) == 0) {
+      break;
+    }
+  }
+  uint8_t bytes[MaxVarintSize];
+  uint64_t new_size = 0;
+  uint32_t value = seq_id;
+  while (value >= 0x80) {
+    bytes[new_size++] = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  bytes[new_size++] = static_cast<uint8_t>(value);
+  replaceBytes(message, seq_id_offset, old_size,
+               absl::string_view(reinterpret_cast<const char*>(bytes), new_size));
+
+  // The size of the frame follows the size of the varint.
+  if (framed && new_size != old_size) {
+    Buffer::OwnedImpl frame_size;
+    frame_size.writeBEInt<uint32_t>(message.peekBEInt<uint32_t>() + new_size - old_size);
+    replaceBytes(message, 0, sizeof(uint32_t), frame_size.toString());
+  }
+  return true;
+}
+
 static const std::string TApplicationException = "TApplicationException";
 static const std::string MessageField = "message";
 static const std::string TypeField = "type";
@@ -162,13 +268,49 @@ void ThriftCodec::onError(const MetaProtocolProxy::Metadata& metadata,
   protocol_->writeMessageEnd(buffer);
 }
 
-void ThriftCodec::toMetadata(const ThriftProxy::MessageMetadata& msgMetadata, Metadata& metadata) {
+absl::optional<std::string> MessageStrings::decodeString(absl::string_view key) const {
+  // The trace context of the Twitter protocol.
+  if (metadata_->traceId().has_value() && metadata_->spanId().has_value()) {
+    if (key == "x-b3-traceid") {
+      std::string trace_id = Hex::uint64ToHex(metadata_->traceId().value());
+      if (metadata_->traceIdHigh().has_value()) {
+        trace_id = Hex::uint64ToHex(metadata_->traceIdHigh().value()) + trace_id;
+      }
+      return trace_id;
+    }
+    if (key == "x-b3-spanid") {
+      return Hex::uint64ToHex(metadata_->spanId().value());
+    }
+    if (key == "x-b3-parentspanid" && metadata_->parentSpanId().has_value()) {
+      return Hex::uint64ToHex(metadata_->parentSpanId().value());
+    }
+    if (key == "x-b3-sampled" && metadata_->sampled().has_value()) {
+      return std::string(metadata_->sampled().value() ? "1" : "0");
+    }
+  }
+
+  // The headers of the header transport.
+  const auto result = metadata_->headers().get(Http::LowerCaseString(key));
+  if (result.empty()) {
+    return absl::nullopt;
+  }
+  return std::string(result[0]->value().getStringView());
+}
+
+void ThriftCodec::toMetadata(const ThriftProxy::MessageMetadataSharedPtr& msgMetadataPtr,
+                             Metadata& metadata) {
+  const ThriftProxy::MessageMetadata& msgMetadata = *msgMetadataPtr;
   if (msgMetadata.hasMethodName()) {
     metadata.putString("method", msgMetadata.methodName());
   }
   if (msgMetadata.hasSequenceId()) {
     metadata.setRequestId(msgMetadata.sequenceId());
   }
+  // The headers and the trace context are only copied and formatted if they're looked up, the
+  // message metadata isn't reused once the message is decoded.
+  if (!msgMetadata.headers().empty() || msgMetadata.traceId().has_value()) {
+    metadata.setLazyStrings(std::make_shared<MessageStrings>(msgMetadataPtr));
+  }
 
   ASSERT(msgMetadata.hasMessageType());
   switch (msgMetadata.messageType()) {
@@ -198,10 +340,10 @@ void ThriftCodec::toMetadata(const ThriftProxy::MessageMetadata& msgMetadata, Me
 
 void ThriftCodec::toMsgMetadata(const Metadata& metadata,
                                 ThriftProxy::MessageMetadata& msgMetadata) {
-  auto method = metadata.getString("method");
+  absl::string_view method = metadata.getString("method");
   // TODO we should use a more appropriate method to tell if metadata contains a specific key
-  if (method != "") {
-    msgMetadata.setMethodName(method);
+  if (!method.empty()) {
+    msgMetadata.setMethodName(std::string(method));
   }
 }
 
@@ -216,7 +358,8 @@ ProtocolState DecoderStateMachine::passthroughData(Buffer::Instance& buffer) {
   return ProtocolState::MessageEnd;
 }
 
-// MessageBegin -> StructBegin
+// MessageBegin -> StructBegin, or
+// MessageBegin -> PassthroughData (passthrough enabled)
 ProtocolState DecoderStateMachine::messageBegin(Buffer::Instance& buffer) {
   const auto total = buffer.length();
   if (!proto_.readMessageBegin(buffer, metadata_)) {
@@ -226,12 +369,34 @@ ProtocolState DecoderStateMachine::messageBegin(Buffer::Instance& buffer) {
   stack_.clear();
   stack_.emplace_back(Frame(ProtocolState::MessageEnd));
 
+  // The protocol is known once the message begin has been read, even if it's auto detected.
+  switch (proto_.type()) {
+  case ThriftProxy::ProtocolType::Binary:
+  case ThriftProxy::ProtocolType::LaxBinary:
+  case ThriftProxy::ProtocolType::Twitter:
+    forward_values_ = true;
+    compact_ = false;
+    break;
+  case ThriftProxy::ProtocolType::Compact:
+    forward_values_ = true;
+    compact_ = true;
+    break;
+  default:
+    forward_values_ = false;
+    break;
+  }
+
+  proto_.writeMessageBegin(origin_message_, metadata_);
   if (passthrough_enabled_) {
-    body_bytes_ = metadata_.frameSize() - (total - buffer.length());
+    const uint64_t header_bytes = total - buffer.length();
+    if (header_bytes > metadata_.frameSize()) {
+      throw EnvoyException(fmt::format("thrift message header size {} exceeds frame size {}",
+                                       header_bytes, metadata_.frameSize()));
+    }
+    body_bytes_ = metadata_.frameSize() - header_bytes;
     return ProtocolState::PassthroughData;
   }
 
-  proto_.writeMessageBegin(origin_message_, metadata_);
   return ProtocolState::StructBegin;
 }
 
@@ -329,6 +494,10 @@ ProtocolState DecoderStateMachine::listValue(Buffer::Instance& buffer) {
   if (stack_[index].remaining_ == 0) {
     return popReturnState();
   }
+  const uint32_t elem_size = fixedElementSize(stack_[index].elem_type_);
+  if (elem_size != 0) {
+    return forwardElements(buffer, stack_[index], elem_size, ProtocolState::ListValue);
+  }
   ProtocolState nextState = handleValue(buffer, stack_[index].elem_type_, ProtocolState::ListValue);
   if (nextState != ProtocolState::WaitForData) {
     stack_[index].remaining_--;
@@ -369,6 +538,11 @@ ProtocolState DecoderStateMachine::mapKey(Buffer::Instance& buffer) {
   if (frame.remaining_ == 0) {
     return popReturnState();
   }
+  const uint32_t key_size = fixedElementSize(frame.elem_type_);
+  const uint32_t value_size = fixedElementSize(frame.value_type_);
+  if (key_size != 0 && value_size != 0) {
+    return forwardElements(buffer, frame, key_size + value_size, ProtocolState::MapKey);
+  }
 
   return handleValue(buffer, frame.elem_type_, ProtocolState::MapValue);
 }
@@ -419,6 +593,10 @@ ProtocolState DecoderStateMachine::setValue(Buffer::Instance& buffer) {
   if (stack_[index].remaining_ == 0) {
     return popReturnState();
   }
+  const uint32_t elem_size = fixedElementSize(stack_[index].elem_type_);
+  if (elem_size != 0) {
+    return forwardElements(buffer, stack_[index], elem_size, ProtocolState::SetValue);
+  }
   ProtocolState nextState = handleValue(buffer, stack_[index].elem_type_, ProtocolState::SetValue);
   if (nextState != ProtocolState::WaitForData) {
     stack_[index].remaining_--;
@@ -490,6 +668,14 @@ ProtocolState DecoderStateMachine::handleValue(Buffer::Instance& buffer,
     break;
   }
   case ThriftProxy::FieldType::String: {
+    if (forward_values_) {
+      uint64_t size;
+      if (stringSize(buffer, size) && buffer.length() >= size) {
+        origin_message_.move(buffer, size);
+        return return_state;
+      }
+      break;
+    }
     std::string value;
     if (proto_.readString(buffer, value)) {
       proto_.writeString(origin_message_, value);
@@ -516,6 +702,75 @@ ProtocolState DecoderStateMachine::handleValue(Buffer::Instance& buffer,
   return ProtocolState::WaitForData;
 }
 
+uint32_t DecoderStateMachine::fixedElementSize(ThriftProxy::FieldType elem_type) const {
+  if (!forward_values_) {
+    return 0;
+  }
+
+  switch (elem_type) {
+  case ThriftProxy::FieldType::Bool:
+  case ThriftProxy::FieldType::Byte:
+    return 1;
+  case ThriftProxy::FieldType::Double:
+    return 8;
+  case ThriftProxy::FieldType::I16:
+    // The compact protocol encodes the integers as varints.
+    return compact_ ? 0 : 2;
+  case ThriftProxy::FieldType::I32:
+    return compact_ ? 0 : 4;
+  case ThriftProxy::FieldType::I64:
+    return compact_ ? 0 : 8;
+  default:
+    return 0;
+  }
+}
+
+ProtocolState DecoderStateMachine::forwardElements(Buffer::Instance& buffer, Frame& frame,
+                                                   uint32_t elem_size, ProtocolState next_state) {
+  const uint64_t count = std::min<uint64_t>(frame.remaining_, buffer.length() / elem_size);
+  if (count == 0) {
+    return ProtocolState::WaitForData;
+  }
+
+  origin_message_.move(buffer, count * elem_size);
+  frame.remaining_ -= static_cast<uint32_t>(count);
+  return next_state;
+}
+
+bool DecoderStateMachine::stringSize(Buffer::Instance& buffer, uint64_t& size) const {
+  if (!compact_) {
+    // Binary protocol: a 4 byte length followed by the bytes.
+    if (buffer.length() < 4) {
+      return false;
+    }
+    const int32_t length = buffer.peekBEInt<int32_t>();
+    if (length < 0) {
+      throw EnvoyException(fmt::format("negative binary protocol string/binary length {}", length));
+    }
+    size = 4 + static_cast<uint64_t>(length);
+    return true;
+  }
+
+  // Compact protocol: a varint length of up to 5 bytes followed by the bytes.
+  uint64_t length = 0;
+  for (uint64_t i = 0; i < 5; i++) {
+    if (buffer.length() <= i) {
+      return false;
+    }
+    const uint8_t byte = buffer.peekInt<uint8_t>(i);
+    length |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      if (length > std::numeric_limits<int32_t>::max()) {
+        throw EnvoyException(fmt::format("negative compact protocol string/binary length {}",
+                                         static_cast<int32_t>(length)));
+      }
+      size = i + 1 + length;
+      return true;
+    }
+  }
+  throw EnvoyException("invalid compact protocol string/binary length");
+}
+
 ProtocolState DecoderStateMachine::handleState(Buffer::Instance& buffer) {
   switch (state_) {
   case ProtocolState::PassthroughData:
@@ -70,8 +70,10 @@ private:
  */
 class DecoderStateMachine : public Logger::Loggable<Logger::Id::thrift> {
 public:
-  DecoderStateMachine(ThriftProxy::Protocol& proto, ThriftProxy::MessageMetadata& metadata)
-      : proto_(proto), metadata_(metadata), state_(ProtocolState::MessageBegin) {}
+  DecoderStateMachine(ThriftProxy::Protocol& proto, ThriftProxy::MessageMetadata& metadata,
+                      bool passthrough_enabled)
+      : proto_(proto), metadata_(metadata), state_(ProtocolState::MessageBegin),
+        passthrough_enabled_(passthrough_enabled) {}
 
   /**
    * Consumes as much data from the configured Buffer as possible and executes the decoding state
@@ -162,6 +164,20 @@ private:
   // handleState delegates to the appropriate method based on state_.
   ProtocolState handleState(Buffer::Instance& buffer);
 
+  // Returns the encoded size of the elements of a container of the given type if the protocol
+  // encodes them with a fixed size, or 0 if they must be decoded one by one.
+  uint32_t fixedElementSize(ThriftProxy::FieldType elem_type) const;
+
+  // Moves as many whole elements of the container in the frame as available to the original
+  // message without decoding them. Returns next_state, or ProtocolState::WaitForData if not a
+  // single element is available.
+  ProtocolState forwardElements(Buffer::Instance& buffer, Frame& frame, uint32_t elem_size,
+                                ProtocolState next_state);
+
+  // Computes the encoded size of the string at the front of the buffer, including its length
+  // prefix. Returns false if more data is required.
+  bool stringSize(Buffer::Instance& buffer, uint64_t& size) const;
+
   // Helper method to retrieve the current frame's return state and remove the frame from the
   // stack.
   ProtocolState popReturnState();
@@ -171,18 +187,38 @@ private:
   ProtocolState state_;
   std::vector<Frame> stack_;
   uint32_t body_bytes_{};
-  bool passthrough_enabled_{false}; // TODO enable passthrough in the codec config
+  // Whether the message body is moved to the original message without being decoded.
+  const bool passthrough_enabled_;
+  // Whether the values are encoded by a protocol whose encoding is known well enough for the
+  // strings and the fixed size container elements to be forwarded as is, without being decoded
+  // and re-encoded.
+  bool forward_values_{false};
+  bool compact_{false};
   Buffer::OwnedImpl origin_message_;
 };
 
 using DecoderStateMachinePtr = std::unique_ptr<DecoderStateMachine>;
 
+// The headers of the header transport and the trace context of the Twitter protocol are the
+// strings decoded on demand of the message metadata, e.g. when a sampled request is traced. The
+// trace context is looked up with the B3 keys.
+class MessageStrings : public MetaProtocolProxy::LazyStrings {
+public:
+  MessageStrings(ThriftProxy::MessageMetadataSharedPtr metadata) : metadata_(std::move(metadata)) {}
+
+  // MetaProtocolProxy::LazyStrings
+  absl::optional<std::string> decodeString(absl::string_view key) const override;
+
+private:
+  const ThriftProxy::MessageMetadataSharedPtr metadata_;
+};
+
 /**
  * Codec for Thrift protocol.
  */
 class ThriftCodec : public MetaProtocolProxy::Codec, public Logger::Loggable<Logger::Id::filter> {
 public:
-  ThriftCodec() {
+  ThriftCodec(bool payload_passthrough) : payload_passthrough_(payload_passthrough) {
     transport_ =
         ThriftProxy::NamedTransportConfigFactory::getFactory(ThriftProxy::TransportType::Auto)
             .createTransport();
@@ -193,18 +229,20 @@ public:
 
   MetaProtocolProxy::DecodeStatus decode(Buffer::Instance& buffer,
                                          MetaProtocolProxy::Metadata& metadata) override;
-  void encode(const MetaProtocolProxy::Metadata& metadata,
+  void encode(MetaProtocolProxy::Metadata& metadata,
               const MetaProtocolProxy::Mutation& mutation, Buffer::Instance& buffer) override;
   void onError(const MetaProtocolProxy::Metadata& metadata, const MetaProtocolProxy::Error& error,
                Buffer::Instance& buffer) override;
+  bool rewriteRequestId(Buffer::Instance& message, uint64_t request_id) override;
 
 private:
-  void toMetadata(const ThriftProxy::MessageMetadata& msgMetadata, Metadata& metadata);
+  void toMetadata(const ThriftProxy::MessageMetadataSharedPtr& msgMetadata, Metadata& metadata);
 
   void toMsgMetadata(const Metadata& metadata, ThriftProxy::MessageMetadata& msgMetadata);
 
   void complete();
 
+  const bool payload_passthrough_;
   ThriftProxy::TransportPtr transport_;
   ThriftProxy::ProtocolPtr protocol_;
   ThriftProxy::MessageMetadataSharedPtr metadata_;
@@ -0,0 +1,207 @@
+#include "src/meta_protocol_proxy/access_log_formatter.h"
+
+#include <functional>
+
+#include "envoy/common/exception.h"
+#include "envoy/registry/registry.h"
+
+#include "source/common/protobuf/utility.h"
+
+#include "absl/strings/match.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+
+namespace {
+
+absl::string_view messageTypeName(MessageType type) {
+  switch (type) {
+  case MessageType::Request:
+    return "Request";
+  case MessageType::Response:
+    return "Response";
+  case MessageType::Oneway:
+    return "Oneway";
+  case MessageType::Heartbeat:
+    return "Heartbeat";
+  case MessageType::Error:
+    return "Error";
+  }
+  return "Unknown";
+}
+
+/**
+ * MessageFormatterProvider formats a value of the MessageStreamInfo of a request. The value is
+ * extracted as a string or as a number, the numbers are logged as such in the JSON formats.
+ */
+class MessageFormatterProvider : public Formatter::FormatterProvider {
+public:
+  using StringExtractor = std::function<absl::optional<std::string>(const MessageStreamInfo&)>;
+  using NumberExtractor = std::function<absl::optional<uint64_t>(const MessageStreamInfo&)>;
+
+  MessageFormatterProvider(StringExtractor extractor) : string_extractor_(std::move(extractor)) {}
+  MessageFormatterProvider(NumberExtractor extractor) : number_extractor_(std::move(extractor)) {}
+
+  // Formatter::FormatterProvider
+  absl::optional<std::string> format(const Http::RequestHeaderMap&, const Http::ResponseHeaderMap&,
+                                     const Http::ResponseTrailerMap&,
+                                     const StreamInfo::StreamInfo& stream_info,
+                                     absl::string_view) const override {
+    const MessageStreamInfo* info = dynamic_cast<const MessageStreamInfo*>(&stream_info);
+    if (info == nullptr) {
+      return absl::nullopt;
+    }
+    if (string_extractor_ != nullptr) {
+      return string_extractor_(*info);
+    }
+    const absl::optional<uint64_t> number = number_extractor_(*info);
+    return number.has_value() ? absl::make_optional(std::to_string(number.value()))
+                              : absl::nullopt;
+  }
+
+  ProtobufWkt::Value formatValue(const Http::RequestHeaderMap&, const Http::ResponseHeaderMap&,
+                                 const Http::ResponseTrailerMap&,
+                                 const StreamInfo::StreamInfo& stream_info,
+                                 absl::string_view) const override {
+    const MessageStreamInfo* info = dynamic_cast<const MessageStreamInfo*>(&stream_info);
+    if (info == nullptr) {
+      return ValueUtil::nullValue();
+    }
+    if (string_extractor_ != nullptr) {
+      const absl::optional<std::string> value = string_extractor_(*info);
+      return value.has_value() ? ValueUtil::stringValue(value.value()) : ValueUtil::nullValue();
+    }
+    const absl::optional<uint64_t> number = number_extractor_(*info);
+    return number.has_value() ? ValueUtil::numberValue(number.value()) : ValueUtil::nullValue();
+  }
+
+private:
+  const StringExtractor string_extractor_;
+  const NumberExtractor number_extractor_;
+};
+
+// Returns the parameter of a command like NAME(parameter), or absl::nullopt if the token isn't
+// the command.
+absl::optional<std::string> commandParameter(const std::string& token, absl::string_view name) {
+  if (!absl::StartsWith(token, name) || token.size() < name.size() + 2 ||
+      token[name.size()] != '(' || token.back() != ')') {
+    return absl::nullopt;
+  }
+  std::string parameter = token.substr(name.size() + 1, token.size() - name.size() - 2);
+  if (parameter.empty()) {
+    throw EnvoyException(fmt::format("meta protocol access log: {} requires a parameter", name));
+  }
+  return parameter;
+}
+
+absl::optional<MessageStreamInfo::Stage> stageByName(absl::string_view name) {
+  if (name == "decode") {
+    return MessageStreamInfo::Stage::Decode;
+  } else if (name == "filter") {
+    return MessageStreamInfo::Stage::Filter;
+  } else if (name == "upstream") {
+    return MessageStreamInfo::Stage::Upstream;
+  } else if (name == "response") {
+    return MessageStreamInfo::Stage::Response;
+  }
+  return absl::nullopt;
+}
+
+} // namespace
+
+Formatter::FormatterProviderPtr MessageCommandParser::parse(const std::string& token, size_t,
+                                                            int) const {
+  using StringExtractor = MessageFormatterProvider::StringExtractor;
+  using NumberExtractor = MessageFormatterProvider::NumberExtractor;
+
+  if (token == "META_REQUEST_ID") {
+    return std::make_unique<MessageFormatterProvider>(
+        NumberExtractor([](const MessageStreamInfo& info) -> absl::optional<uint64_t> {
+          if (info.requestMetadata() == nullptr) {
+            return absl::nullopt;
+          }
+          return info.requestMetadata()->getRequestId();
+        }));
+  }
+
+  if (token == "META_MESSAGE_TYPE") {
+    return std::make_unique<MessageFormatterProvider>(
+        StringExtractor([](const MessageStreamInfo& info) -> absl::optional<std::string> {
+          if (info.requestMetadata() == nullptr) {
+            return absl::nullopt;
+          }
+          return std::string(messageTypeName(info.requestMetadata()->getMessageType()));
+        }));
+  }
+
+  if (token == "META_RESPONSE_STATUS") {
+    return std::make_unique<MessageFormatterProvider>(
+        StringExtractor([](const MessageStreamInfo& info) -> absl::optional<std::string> {
+          if (info.localReply()) {
+            return std::string("LocalReply");
+          }
+          if (info.responseMetadata() == nullptr) {
+            return absl::nullopt;
+          }
+          return std::string(info.responseMetadata()->getResponseStatus() == ResponseStatus::Ok
+                                 ? "Ok"
+                                 : "Error");
+        }));
+  }
+
+  absl::optional<std::string> key = commandParameter(token, "META_METADATA");
+  if (key.has_value()) {
+    return std::make_unique<MessageFormatterProvider>(StringExtractor(
+        [key = key.value()](const MessageStreamInfo& info) -> absl::optional<std::string> {
+          if (info.requestMetadata() == nullptr) {
+            return absl::nullopt;
+          }
+          const absl::string_view value = info.requestMetadata()->getString(key);
+          if (value.empty()) {
+            return absl::nullopt;
+          }
+          return std::string(value);
+        }));
+  }
+
+  absl::optional<std::string> stage_name = commandParameter(token, "META_STAGE_DURATION");
+  if (stage_name.has_value()) {
+    const absl::optional<MessageStreamInfo::Stage> parsed = stageByName(stage_name.value());
+    if (!parsed.has_value()) {
+      throw EnvoyException(
+          fmt::format("meta protocol access log: unknown stage '{}'", stage_name.value()));
+    }
+    return std::make_unique<MessageFormatterProvider>(NumberExtractor(
+        [stage = parsed.value()](const MessageStreamInfo& info) -> absl::optional<uint64_t> {
+          const absl::optional<std::chrono::microseconds> duration = info.stageDuration(stage);
+          if (!duration.has_value()) {
+            return absl::nullopt;
+          }
+          return duration.value().count();
+        }));
+  }
+
+  return nullptr;
+}
+
+Formatter::CommandParserPtr
+MessageCommandParserFactory::createCommandParserFromProto(const Protobuf::Message&) {
+  return std::make_unique<MessageCommandParser>();
+}
+
+ProtobufTypes::MessagePtr MessageCommandParserFactory::createEmptyConfigProto() {
+  return std::make_unique<
+      envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::AccessLogFormatter>();
+}
+
+/**
+ * Static registration for the meta protocol access log commands. @see RegisterFactory.
+ */
+REGISTER_FACTORY(MessageCommandParserFactory, Formatter::CommandParserFactory);
+
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
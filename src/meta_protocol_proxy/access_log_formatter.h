@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+
+#include "envoy/formatter/substitution_formatter.h"
+
+#include "api/v1alpha/meta_protocol_proxy.pb.h"
+
+#include "src/meta_protocol_proxy/stream_info.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+
+/**
+ * MessageCommandParser parses the meta protocol commands of the access log formats:
+ * - %META_METADATA(key)%: the string value of the key in the request metadata, e.g.
+ *   %META_METADATA(interface)% and %META_METADATA(method)% of a Dubbo request. It's named apart
+ *   from the generic %METADATA(TYPE:NAMESPACE:KEY)% command, which stays available.
+ * - %META_REQUEST_ID%: the request ID decoded by the codec.
+ * - %META_MESSAGE_TYPE%: the message type of the request, e.g. Request or Oneway.
+ * - %META_RESPONSE_STATUS%: the status of the upstream response, Ok or Error, or LocalReply if the
+ *   request is answered by the proxy.
+ * - %META_STAGE_DURATION(stage)%: the microseconds the request spent in the stage, which is one of
+ *   decode, filter, upstream and response. @see MessageStreamInfo::Stage
+ *
+ * The commands read the MessageStreamInfo of the request, they log "-" for the other streams or if
+ * the value is unknown, e.g. the response status of a request without a response.
+ */
+class MessageCommandParser : public Formatter::CommandParser {
+public:
+  // Formatter::CommandParser
+  Formatter::FormatterProviderPtr parse(const std::string& token, size_t pos,
+                                        int command_end_position) const override;
+};
+
+/**
+ * Config registration for the meta protocol access log commands, the extension is added to the
+ * formatters of an access log format. @see CommandParserFactory.
+ */
+class MessageCommandParserFactory : public Formatter::CommandParserFactory {
+public:
+  // Formatter::CommandParserFactory
+  Formatter::CommandParserPtr createCommandParserFromProto(const Protobuf::Message&) override;
+  ProtobufTypes::MessagePtr createEmptyConfigProto() override;
+  std::string name() const override { return "aeraki.meta_protocol.formatter"; }
+};
+
+} // namespace MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -1,7 +1,6 @@
 #include "src/meta_protocol_proxy/active_message.h"
 #include "src/meta_protocol_proxy/codec/codec.h"
 
-#include "source/common/stats/timespan_impl.h"
 #include "src/meta_protocol_proxy/app_exception.h"
 #include "src/meta_protocol_proxy/conn_manager.h"
 #include "src/meta_protocol_proxy/codec_impl.h"
@@ -11,100 +10,6 @@ namespace Extensions {
 namespace NetworkFilters {
 namespace MetaProtocolProxy {
 
-// class ActiveResponseDecoder
-ActiveResponseDecoder::ActiveResponseDecoder(ActiveMessage& parent, MetaProtocolProxyStats& stats,
-                                             Network::Connection& connection,
-                                             std::string applicationProtocol,
-                                             CodecPtr&& codec)
-    : parent_(parent), stats_(stats), response_connection_(connection),
-      application_protocol_(applicationProtocol), codec_(std::move(codec)),
-      decoder_(std::make_unique<ResponseDecoder>(*codec_, *this)), complete_(false),
-      response_status_(UpstreamResponseStatus::MoreData) {}
-
-UpstreamResponseStatus ActiveResponseDecoder::onData(Buffer::Instance& data) {
-  ENVOY_LOG(debug, "meta protocol {} response: the received reply data length is {}",
-            application_protocol_, data.length());
-
-  bool underflow = false;
-  decoder_->onData(data, underflow);
-  ASSERT(complete_ || underflow);
-
-  return response_status_;
-}
-
-void ActiveResponseDecoder::onStreamDecoded(MetadataSharedPtr metadata,
-                                            MutationSharedPtr mutation) {
-  ASSERT(metadata->getMessageType() == MessageType::Response ||
-         metadata->getMessageType() == MessageType::Error);
-  // ASSERT(metadata->hasResponseStatus());
-
-  metadata_ = metadata;
-  if (applyMessageEncodedFilters(metadata, mutation) != FilterStatus::Continue) {
-    response_status_ = UpstreamResponseStatus::Complete;
-    return;
-  }
-
-  if (response_connection_.state() != Network::Connection::State::Open) {
-    throw DownstreamConnectionCloseException("Downstream has closed or closing");
-  }
-
-  response_connection_.write(metadata->getOriginMessage(), false);
-  ENVOY_LOG(debug,
-            "meta protocol {} response: the upstream response message has been forwarded to the "
-            "downstream",
-            application_protocol_);
-
-  stats_.response_.inc();
-  stats_.response_decoding_success_.inc();
-  if (metadata->getMessageType() == MessageType::Error) {
-    stats_.response_business_exception_.inc();
-  }
-
-  switch (metadata->getResponseStatus()) {
-  case ResponseStatus::Ok:
-    stats_.response_success_.inc();
-    break;
-  default:
-    stats_.response_error_.inc();
-    ENVOY_LOG(error, "meta protocol {} response status: {}", application_protocol_,
-              metadata->getResponseStatus());
-    break;
-  }
-
-  complete_ = true;
-  response_status_ = UpstreamResponseStatus::Complete;
-
-  ENVOY_LOG(
-      debug,
-      "meta protocol {} response: complete processing of upstream response messages, id is {}",
-      application_protocol_, metadata->getRequestId());
-}
-
-FilterStatus
-ActiveResponseDecoder::applyMessageEncodedFilters(MetadataSharedPtr metadata,
-                                                  MutationSharedPtr mutation) {
-  parent_.encoder_filter_action_ =
-      [metadata, mutation](EncoderFilter* filter) -> FilterStatus {
-    return filter->onMessageEncoded(metadata, mutation);
-  };
-
-  auto status = parent_.applyEncoderFilters(
-      nullptr, ActiveMessage::FilterIterationStartState::CanStartFromCurrent);
-  switch (status) {
-  case FilterStatus::StopIteration:
-    break;
-  case FilterStatus::Retry:
-    response_status_ = UpstreamResponseStatus::Retry;
-    decoder_->reset();
-    break;
-  default:
-    ASSERT(FilterStatus::Continue == status);
-    break;
-  }
-
-  return status;
-}
-
 // class ActiveMessageFilterBase
 uint64_t ActiveMessageFilterBase::requestId() const { return parent_.requestId(); }
 
@@ -122,11 +27,19 @@ void ActiveMessageFilterBase::resetStream() { parent_.resetStream(); }
 
 StreamInfo::StreamInfo& ActiveMessageFilterBase::streamInfo() { return parent_.streamInfo(); }
 
+Tracing::Span* ActiveMessageFilterBase::activeSpan() { return parent_.activeSpan(); }
+
 // class ActiveMessageDecoderFilter
-ActiveMessageDecoderFilter::ActiveMessageDecoderFilter(
-    ActiveMessage& parent, DecoderFilterSharedPtr filter, bool dual_filter)
+ActiveMessageDecoderFilter::ActiveMessageDecoderFilter(ActiveMessage& parent,
+                                                       DecoderFilterSharedPtr filter,
+                                                       bool dual_filter)
     : ActiveMessageFilterBase(parent, dual_filter), handle_(filter) {}
 
+void ActiveMessageDecoderFilter::reset(DecoderFilterSharedPtr filter, bool dual_filter) {
+  handle_ = std::move(filter);
+  dual_filter_ = dual_filter;
+}
+
 void ActiveMessageDecoderFilter::continueDecoding() {
   ASSERT(parent_.metadata());
   auto state = ActiveMessage::FilterIterationStartState::AlwaysStartFromNext;
@@ -152,11 +65,35 @@ void ActiveMessageDecoderFilter::sendLocalReply(const DirectResponse& response,
   parent_.sendLocalReply(response, end_stream);
 }
 
-void ActiveMessageDecoderFilter::startUpstreamResponse() { parent_.startUpstreamResponse(); }
+UpstreamResponseStatus ActiveMessageDecoderFilter::upstreamResponse(MetadataSharedPtr metadata,
+                                                                   MutationSharedPtr mutation) {
+  return parent_.upstreamResponse(metadata, mutation);
+}
 
-UpstreamResponseStatus
-ActiveMessageDecoderFilter::upstreamData(Buffer::Instance& buffer) {
-  return parent_.upstreamData(buffer);
+void ActiveMessageDecoderFilter::upstreamResponseError(const std::string& what) {
+  parent_.upstreamResponseError(what);
+}
+
+void ActiveMessageDecoderFilter::forwardResponseBody(Buffer::Instance& data, bool end_stream) {
+  parent_.forwardResponseBody(data, end_stream);
+}
+
+void ActiveMessageDecoderFilter::setDownstreamWatermarkCallbacks(
+    DownstreamWatermarkCallbacks* callbacks) {
+  parent_.setDownstreamWatermarkCallbacks(callbacks);
+}
+
+CodecPtr ActiveMessageDecoderFilter::createCodec() { return parent_.createCodec(); }
+
+uint64_t ActiveMessageDecoderFilter::codecHash() { return parent_.codecHash(); }
+
+void ActiveMessageDecoderFilter::encodeRequest(Metadata& metadata, const Mutation& mutation,
+                                               Buffer::Instance& buffer) {
+  parent_.encodeRequest(metadata, mutation, buffer);
+}
+
+void ActiveMessageDecoderFilter::setStreamedBodyHandler(StreamedBodyHandler* handler) {
+  parent_.setStreamedBodyHandler(handler);
 }
 
 void ActiveMessageDecoderFilter::resetDownstreamConnection() {
@@ -164,10 +101,16 @@ void ActiveMessageDecoderFilter::resetDownstreamConnection() {
 }
 
 // class ActiveMessageEncoderFilter
-ActiveMessageEncoderFilter::ActiveMessageEncoderFilter(
-    ActiveMessage& parent, EncoderFilterSharedPtr filter, bool dual_filter)
+ActiveMessageEncoderFilter::ActiveMessageEncoderFilter(ActiveMessage& parent,
+                                                       EncoderFilterSharedPtr filter,
+                                                       bool dual_filter)
     : ActiveMessageFilterBase(parent, dual_filter), handle_(filter) {}
 
+void ActiveMessageEncoderFilter::reset(EncoderFilterSharedPtr filter, bool dual_filter) {
+  handle_ = std::move(filter);
+  dual_filter_ = dual_filter;
+}
+
 void ActiveMessageEncoderFilter::continueEncoding() {
   ASSERT(parent_.metadata());
   auto state = ActiveMessage::FilterIterationStartState::AlwaysStartFromNext;
@@ -184,17 +127,35 @@ void ActiveMessageEncoderFilter::continueEncoding() {
 
 // class ActiveMessage
 ActiveMessage::ActiveMessage(ConnectionManager& parent)
-    : parent_(parent), request_timer_(std::make_unique<Stats::HistogramCompletableTimespanImpl>(
-                           parent_.stats().request_time_ms_, parent.timeSystem())),
-      stream_id_(parent.randomGenerator().random()),
-      stream_info_(parent.timeSystem(), parent_.connection().addressProviderSharedPtr()),
-      pending_stream_decoded_(false), local_response_sent_(false) {
+    : parent_(parent), next_decoder_filter_(decoder_filters_.end()),
+      next_encoder_filter_(encoder_filters_.end()), pending_stream_decoded_(false),
+      local_response_sent_(false), in_use_(false), released_(false) {}
+
+ActiveMessage::~ActiveMessage() {
+  if (in_use_) {
+    recycle();
+  }
+}
+
+void ActiveMessage::start() {
+  ASSERT(!in_use_);
+  in_use_ = true;
+  released_ = false;
   parent_.stats().request_active_.inc();
+  request_timer_.emplace(parent_.stats().request_time_ms_, parent_.timeSystem());
+  stream_id_ = parent_.randomGenerator().random();
+  stream_info_.emplace(parent_.timeSystem(), parent_.connection().addressProviderSharedPtr());
+  next_decoder_filter_ = decoder_filters_.begin();
+  next_encoder_filter_ = encoder_filters_.begin();
 }
 
-ActiveMessage::~ActiveMessage() {
+void ActiveMessage::recycle() {
+  ASSERT(in_use_);
+  in_use_ = false;
+  logRequest();
   parent_.stats().request_active_.dec();
   request_timer_->complete();
+  request_timer_.reset();
   for (auto& filter : decoder_filters_) {
     ENVOY_LOG(debug, "destroy decoder filter");
     filter->handler()->onDestroy();
@@ -207,6 +168,29 @@ ActiveMessage::~ActiveMessage() {
       filter->handler()->onDestroy();
     }
   }
+  // After the filters, which finish their child spans when they're destroyed.
+  finishSpan();
+
+  // The wrappers are kept for the next request, only the filters are released.
+  for (auto& filter : decoder_filters_) {
+    filter->reset(nullptr, false, false);
+  }
+  for (auto& filter : encoder_filters_) {
+    filter->reset(nullptr, false, false);
+  }
+
+  metadata_.reset();
+  mutation_.reset();
+  streamed_body_handler_ = nullptr;
+  downstream_watermark_callbacks_ = nullptr;
+  response_metadata_.reset();
+  response_mutation_.reset();
+  cached_route_.reset();
+  stream_info_.reset();
+  request_bytes_ = 0;
+  response_buffer_.drain(response_buffer_.length());
+  pending_stream_decoded_ = false;
+  local_response_sent_ = false;
 }
 
 std::list<ActiveMessageEncoderFilterPtr>::iterator
@@ -247,12 +231,31 @@ void ActiveMessage::onStreamDecoded(MetadataSharedPtr metadata,
   parent_.stats().request_decoding_success_.inc();
 
   metadata_ = metadata;
-  filter_action_ = [metadata,
-                    mutation](DecoderFilter* filter) -> FilterStatus {
-    return filter->onMessageDecoded(metadata, mutation);
-  };
+  mutation_ = mutation;
+  stream_info_->setRequestMetadata(metadata);
+  // The sampling is decided by a random value of its own, as the stream ID also picks the weighted
+  // cluster. The requests which aren't sampled cost nothing more.
+  const TracingConfigImpl* tracing_config = parent_.config().tracingConfig();
+  if (tracing_config != nullptr &&
+      tracing_config->sampled(parent_.randomGenerator().random())) {
+    active_span_ = tracing_config->startSpan(*metadata, *stream_info_);
+  }
+  request_bytes_ = metadata->getOriginMessage().length();
+  parent_.onRequestBuffered(request_bytes_);
+  if (metadata->getStreamedBytes() > 0) {
+    // The rest of the request follows it on the connection, it's passed on before the next request
+    // is decoded.
+    parent_.onStreamedRequest(*this, metadata->getStreamedBytes());
+  }
 
+  const MonotonicTime filter_start_time = parent_.timeSystem().monotonicTime();
+  // The response may arrive before the filter chain returns.
+  upstream_start_time_ = filter_start_time;
   auto status = applyDecoderFilters(nullptr, FilterIterationStartState::CanStartFromCurrent);
+  const std::chrono::microseconds filter_time =
+      recordElapsed(parent_.stats().request_filter_time_us_, filter_start_time);
+  stream_info_->setStageDuration(MessageStreamInfo::Stage::Filter, filter_time);
+  upstream_start_time_ = filter_start_time + filter_time;
   if (status == FilterStatus::StopIteration) {
     ENVOY_LOG(debug, "meta protocol {} request: stop calling decoder filter, id is {}",
               parent_.config().applicationProtocol(), metadata->getRequestId());
@@ -291,6 +294,10 @@ void ActiveMessage::finalizeRequest() {
 
 void ActiveMessage::createFilterChain() {
   parent_.config().filterFactory().createFilterChain(*this);
+
+  // The wrappers left over by a longer filter chain of a previous request.
+  decoder_filters_.erase(next_decoder_filter_, decoder_filters_.end());
+  encoder_filters_.erase(next_encoder_filter_, encoder_filters_.end());
 }
 
 MetaProtocolProxy::Router::RouteConstSharedPtr ActiveMessage::route() {
@@ -310,10 +317,10 @@ MetaProtocolProxy::Router::RouteConstSharedPtr ActiveMessage::route() {
 
 FilterStatus ActiveMessage::applyDecoderFilters(ActiveMessageDecoderFilter* filter,
                                                 FilterIterationStartState state) {
-  ASSERT(filter_action_ != nullptr);
+  ASSERT(metadata_ != nullptr);
   if (!local_response_sent_) {
     for (auto entry = commonDecodePrefix(filter, state); entry != decoder_filters_.end(); entry++) {
-      const FilterStatus status = filter_action_((*entry)->handler().get());
+      const FilterStatus status = (*entry)->handler()->onMessageDecoded(metadata_, mutation_);
       if (local_response_sent_) {
         break;
       }
@@ -324,18 +331,17 @@ FilterStatus ActiveMessage::applyDecoderFilters(ActiveMessageDecoderFilter* filt
     }
   }
 
-  filter_action_ = nullptr;
-
   return FilterStatus::Continue;
 }
 
 FilterStatus ActiveMessage::applyEncoderFilters(ActiveMessageEncoderFilter* filter,
                                                 FilterIterationStartState state) {
-  ASSERT(encoder_filter_action_ != nullptr);
+  ASSERT(response_metadata_ != nullptr);
 
   if (!local_response_sent_) {
     for (auto entry = commonEncodePrefix(filter, state); entry != encoder_filters_.end(); entry++) {
-      const FilterStatus status = encoder_filter_action_((*entry)->handler().get());
+      const FilterStatus status =
+          (*entry)->handler()->onMessageEncoded(response_metadata_, response_mutation_);
       if (local_response_sent_) {
         break;
       }
@@ -346,7 +352,8 @@ FilterStatus ActiveMessage::applyEncoderFilters(ActiveMessageEncoderFilter* filt
     }
   }
 
-  encoder_filter_action_ = nullptr;
+  response_metadata_ = nullptr;
+  response_mutation_ = nullptr;
 
   return FilterStatus::Continue;
 }
@@ -356,6 +363,7 @@ void ActiveMessage::sendLocalReply(const DirectResponse& response,
   ASSERT(metadata_);
   // metadata_->setRequestId(request_id_);
   parent_.sendLocalReply(*metadata_, response, end_stream);
+  stream_info_->onLocalReply();
 
   if (end_stream) {
     return;
@@ -364,37 +372,25 @@ void ActiveMessage::sendLocalReply(const DirectResponse& response,
   local_response_sent_ = true;
 }
 
-void ActiveMessage::startUpstreamResponse() {
-  ENVOY_LOG(debug, "meta protocol response: start upstream");
-
-  ASSERT(response_decoder_ == nullptr);
-
-  auto codec = parent_.config().createCodec();
-
-  // Create a response message decoder.
-  response_decoder_ = std::make_unique<ActiveResponseDecoder>(
-      *this, parent_.stats(), parent_.connection(), parent_.config().applicationProtocol(),
-      std::move(codec));
-}
-
-UpstreamResponseStatus ActiveMessage::upstreamData(Buffer::Instance& buffer) {
-  ASSERT(response_decoder_ != nullptr);
-
+UpstreamResponseStatus ActiveMessage::upstreamResponse(MetadataSharedPtr metadata,
+                                                      MutationSharedPtr mutation) {
   try {
-    auto status = response_decoder_->onData(buffer);
+    const MonotonicTime start_time = parent_.timeSystem().monotonicTime();
+    stream_info_->setStageDuration(
+        MessageStreamInfo::Stage::Upstream,
+        std::chrono::duration_cast<std::chrono::microseconds>(start_time - upstream_start_time_));
+    stream_info_->setResponseMetadata(metadata);
+    auto status = forwardResponse(metadata, mutation);
     if (status == UpstreamResponseStatus::Complete) {
-      if (requestId() != response_decoder_->requestId()) {
-        throw EnvoyException(fmt::format(
-            "meta protocol {} response: request ID is not equal, {}:{}",
-            parent_.config().applicationProtocol(), requestId(), response_decoder_->requestId()));
-      }
-
       // Completed upstream response.
+      stream_info_->setStageDuration(
+          MessageStreamInfo::Stage::Response,
+          recordElapsed(parent_.stats().response_time_us_, start_time));
       parent_.deferredMessage(*this);
-    } else if (status == UpstreamResponseStatus::Retry) {
-      response_decoder_.reset();
+    } else if (status == UpstreamResponseStatus::MoreData) {
+      // The response is timed until the end of its body.
+      response_start_time_ = start_time;
     }
-
     return status;
   } catch (const DownstreamConnectionCloseException& ex) {
     ENVOY_CONN_LOG(error, "meta protocol {} response: exception ({})", parent_.connection(),
@@ -412,6 +408,151 @@ UpstreamResponseStatus ActiveMessage::upstreamData(Buffer::Instance& buffer) {
   }
 }
 
+void ActiveMessage::upstreamResponseError(const std::string& what) {
+  ENVOY_CONN_LOG(error, "meta protocol {} response: exception ({})", parent_.connection(),
+                 parent_.config().applicationProtocol(), what);
+  parent_.stats().response_decoding_error_.inc();
+  onError(what);
+}
+
+UpstreamResponseStatus ActiveMessage::forwardResponse(MetadataSharedPtr metadata,
+                                                     MutationSharedPtr mutation) {
+  ASSERT(metadata->getMessageType() == MessageType::Response ||
+         metadata->getMessageType() == MessageType::Error);
+
+  const std::string application_protocol = parent_.config().applicationProtocol();
+  switch (applyMessageEncodedFilters(metadata, mutation)) {
+  case FilterStatus::StopIteration:
+    return UpstreamResponseStatus::Complete;
+  case FilterStatus::Retry:
+    return UpstreamResponseStatus::Retry;
+  default:
+    break;
+  }
+
+  if (parent_.connection().state() != Network::Connection::State::Open) {
+    throw DownstreamConnectionCloseException("Downstream has closed or closing");
+  }
+
+  // The body of a streamed response follows its head, see forwardResponseBody().
+  const bool streamed = metadata->getStreamedBytes() > 0;
+  parent_.writeResponse(this, metadata->getOriginMessage(), !streamed);
+  ENVOY_LOG(debug,
+            "meta protocol {} response: the upstream response message has been forwarded to the "
+            "downstream",
+            application_protocol);
+
+  MetaProtocolProxyStats& stats = parent_.stats();
+  stats.response_.inc();
+  stats.response_decoding_success_.inc();
+  if (metadata->getMessageType() == MessageType::Error) {
+    stats.response_business_exception_.inc();
+  }
+
+  switch (metadata->getResponseStatus()) {
+  case ResponseStatus::Ok:
+    stats.response_success_.inc();
+    break;
+  default:
+    stats.response_error_.inc();
+    ENVOY_LOG(error, "meta protocol {} response status: {}", application_protocol,
+              metadata->getResponseStatus());
+    break;
+  }
+
+  ENVOY_LOG(
+      debug,
+      "meta protocol {} response: complete processing of upstream response messages, id is {}",
+      application_protocol, metadata->getRequestId());
+  return streamed ? UpstreamResponseStatus::MoreData : UpstreamResponseStatus::Complete;
+}
+
+void ActiveMessage::forwardResponseBody(Buffer::Instance& data, bool end_stream) {
+  if (parent_.connection().state() != Network::Connection::State::Open) {
+    data.drain(data.length());
+  } else {
+    parent_.writeResponse(this, data, end_stream);
+  }
+  if (end_stream) {
+    stream_info_->setStageDuration(
+        MessageStreamInfo::Stage::Response,
+        recordElapsed(parent_.stats().response_time_us_, response_start_time_));
+    parent_.deferredMessage(*this);
+  }
+}
+
+void ActiveMessage::setDownstreamWatermarkCallbacks(DownstreamWatermarkCallbacks* callbacks) {
+  downstream_watermark_callbacks_ = callbacks;
+  if (callbacks != nullptr && !parent_.responseWritable(*this)) {
+    callbacks->onDownstreamAboveWriteBufferHighWatermark();
+  }
+}
+
+void ActiveMessage::onDownstreamWatermark(bool above) {
+  if (downstream_watermark_callbacks_ == nullptr) {
+    return;
+  }
+  if (above) {
+    downstream_watermark_callbacks_->onDownstreamAboveWriteBufferHighWatermark();
+  } else {
+    downstream_watermark_callbacks_->onDownstreamBelowWriteBufferLowWatermark();
+  }
+}
+
+FilterStatus ActiveMessage::applyMessageEncodedFilters(MetadataSharedPtr metadata,
+                                                       MutationSharedPtr mutation) {
+  response_metadata_ = metadata;
+  response_mutation_ = mutation;
+
+  return applyEncoderFilters(nullptr, FilterIterationStartState::CanStartFromCurrent);
+}
+
+std::chrono::microseconds ActiveMessage::recordElapsed(Stats::Histogram& histogram,
+                                                        MonotonicTime start) {
+  const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      parent_.timeSystem().monotonicTime() - start);
+  histogram.recordValue(elapsed.count());
+  return elapsed;
+}
+
+void ActiveMessage::logRequest() {
+  const auto& access_logs = parent_.config().accessLogs();
+  if (access_logs.empty()) {
+    return;
+  }
+
+  // The formatter commands read the meta protocol values from the stream info, no header map is
+  // built for the access logs.
+  stream_info_->onRequestComplete();
+  for (const auto& access_log : access_logs) {
+    access_log->log(nullptr, nullptr, nullptr, *stream_info_);
+  }
+}
+
+void ActiveMessage::finishSpan() {
+  if (active_span_ == nullptr) {
+    return;
+  }
+  parent_.config().tracingConfig()->finishSpan(*active_span_, *stream_info_);
+  active_span_.reset();
+}
+
+CodecPtr ActiveMessage::createCodec() { return parent_.config().createCodec(); }
+
+uint64_t ActiveMessage::codecHash() { return parent_.config().codecHash(); }
+
+void ActiveMessage::encodeRequest(Metadata& metadata, const Mutation& mutation,
+                                  Buffer::Instance& buffer) {
+  parent_.codec().encode(metadata, mutation, buffer);
+}
+
+void ActiveMessage::setStreamedBodyHandler(StreamedBodyHandler* handler) {
+  streamed_body_handler_ = handler;
+  if (handler != nullptr) {
+    parent_.onStreamedBodyHandler();
+  }
+}
+
 void ActiveMessage::resetDownstreamConnection() {
   parent_.connection().close(Network::ConnectionCloseType::NoFlush);
 }
@@ -426,7 +567,7 @@ uint64_t ActiveMessage::streamId() const { return stream_id_; }
 
 void ActiveMessage::continueDecoding() { parent_.continueDecoding(); }
 
-StreamInfo::StreamInfo& ActiveMessage::streamInfo() { return stream_info_; }
+StreamInfo::StreamInfo& ActiveMessage::streamInfo() { return *stream_info_; }
 
 Event::Dispatcher& ActiveMessage::dispatcher() { return parent_.connection().dispatcher(); }
 
@@ -445,19 +586,35 @@ void ActiveMessage::addFilter(CodecFilterSharedPtr filter) {
   addEncoderFilterWorker(filter, true);
 }
 
-void ActiveMessage::addDecoderFilterWorker(DecoderFilterSharedPtr filter,
-                                           bool dual_filter) {
-  ActiveMessageDecoderFilterPtr wrapper =
-      std::make_unique<ActiveMessageDecoderFilter>(*this, filter, dual_filter);
+void ActiveMessage::addDecoderFilterWorker(DecoderFilterSharedPtr filter, bool dual_filter) {
+  ActiveMessageDecoderFilter* wrapper;
+  if (next_decoder_filter_ != decoder_filters_.end()) {
+    // Reuse the wrapper of a previous request.
+    wrapper = (next_decoder_filter_++)->get();
+    wrapper->reset(filter, dual_filter);
+  } else {
+    ActiveMessageDecoderFilterPtr new_wrapper =
+        std::make_unique<ActiveMessageDecoderFilter>(*this, filter, dual_filter);
+    wrapper = new_wrapper.get();
+    LinkedList::moveIntoListBack(std::move(new_wrapper), decoder_filters_);
+  }
+
   filter->setDecoderFilterCallbacks(*wrapper);
-  LinkedList::moveIntoListBack(std::move(wrapper), decoder_filters_);
 }
-void ActiveMessage::addEncoderFilterWorker(EncoderFilterSharedPtr filter,
-                                           bool dual_filter) {
-  ActiveMessageEncoderFilterPtr wrapper =
-      std::make_unique<ActiveMessageEncoderFilter>(*this, filter, dual_filter);
+void ActiveMessage::addEncoderFilterWorker(EncoderFilterSharedPtr filter, bool dual_filter) {
+  ActiveMessageEncoderFilter* wrapper;
+  if (next_encoder_filter_ != encoder_filters_.end()) {
+    // Reuse the wrapper of a previous request.
+    wrapper = (next_encoder_filter_++)->get();
+    wrapper->reset(filter, dual_filter);
+  } else {
+    ActiveMessageEncoderFilterPtr new_wrapper =
+        std::make_unique<ActiveMessageEncoderFilter>(*this, filter, dual_filter);
+    wrapper = new_wrapper.get();
+    LinkedList::moveIntoListBack(std::move(new_wrapper), encoder_filters_);
+  }
+
   filter->setEncoderFilterCallbacks(*wrapper);
-  LinkedList::moveIntoListBack(std::move(wrapper), encoder_filters_);
 }
 
 void ActiveMessage::onReset() { parent_.deferredMessage(*this); }
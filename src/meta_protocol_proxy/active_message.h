@@ -1,6 +1,6 @@
 #pragma once
 
-#include "envoy/event/deferred_deletable.h"
+#include "envoy/common/time.h"
 #include "envoy/network/connection.h"
 #include "envoy/network/filter.h"
 #include "envoy/stats/timespan.h"
@@ -8,13 +8,14 @@
 #include "source/common/buffer/buffer_impl.h"
 #include "source/common/common/linked_object.h"
 #include "source/common/common/logger.h"
-#include "source/common/stream_info/stream_info_impl.h"
+#include "source/common/stats/timespan_impl.h"
 #include "src/meta_protocol_proxy/codec/codec.h"
 #include "src/meta_protocol_proxy/decoder.h"
 #include "src/meta_protocol_proxy/decoder_event_handler.h"
 #include "src/meta_protocol_proxy/filters/filter.h"
 #include "src/meta_protocol_proxy/filters/router/router.h"
 #include "src/meta_protocol_proxy/stats.h"
+#include "src/meta_protocol_proxy/stream_info.h"
 
 #include "absl/types/optional.h"
 
@@ -26,46 +27,6 @@ namespace MetaProtocolProxy {
 class ConnectionManager;
 class ActiveMessage;
 
-class ActiveResponseDecoder : public ResponseDecoderCallbacks,
-                              public StreamHandler,
-                              Logger::Loggable<Logger::Id::filter> {
-public:
-  ActiveResponseDecoder(ActiveMessage& parent, MetaProtocolProxyStats& stats,
-                        Network::Connection& connection, std::string applicationProtocol,
-                        CodecPtr&& codec);
-  ~ActiveResponseDecoder() override = default;
-
-  UpstreamResponseStatus onData(Buffer::Instance& data);
-
-  // StreamHandler
-  void onStreamDecoded(MetadataSharedPtr metadata,
-                       MutationSharedPtr mutation) override;
-
-  // ResponseDecoderCallbacks
-  StreamHandler& newStream() override { return *this; }
-  void onHeartbeat(MetadataSharedPtr) override {
-    NOT_IMPLEMENTED_GCOVR_EXCL_LINE;
-  }
-
-  uint64_t requestId() const { return metadata_ ? metadata_->getRequestId() : 0; }
-
-private:
-  FilterStatus applyMessageEncodedFilters(MetadataSharedPtr metadata,
-                                          MutationSharedPtr mutation);
-
-  ActiveMessage& parent_;
-  MetaProtocolProxyStats& stats_;
-  Network::Connection& response_connection_;
-  std::string application_protocol_;
-  CodecPtr codec_;
-  ResponseDecoderPtr decoder_;
-  MetadataSharedPtr metadata_;
-  bool complete_ : 1;
-  UpstreamResponseStatus response_status_;
-};
-
-using ActiveResponseDecoderPtr = std::unique_ptr<ActiveResponseDecoder>;
-
 class ActiveMessageFilterBase : public virtual FilterCallbacksBase {
 public:
   ActiveMessageFilterBase(ActiveMessage& parent, bool dual_filter)
@@ -80,12 +41,13 @@ public:
   // SerializationType serializationType() const override;
   // ProtocolType protocolType() const override;
   StreamInfo::StreamInfo& streamInfo() override;
+  Tracing::Span* activeSpan() override;
   Event::Dispatcher& dispatcher() override;
   void resetStream() override;
 
 protected:
   ActiveMessage& parent_;
-  const bool dual_filter_ : 1;
+  bool dual_filter_ : 1;
 };
 
 // Wraps a DecoderFilter and acts as the DecoderFilterCallbacks for the filter, enabling filter
@@ -95,18 +57,28 @@ class ActiveMessageDecoderFilter : public DecoderFilterCallbacks,
                                    public LinkedObject<ActiveMessageDecoderFilter>,
                                    Logger::Loggable<Logger::Id::filter> {
 public:
-  ActiveMessageDecoderFilter(ActiveMessage& parent,
-                             DecoderFilterSharedPtr filter, bool dual_filter);
+  ActiveMessageDecoderFilter(ActiveMessage& parent, DecoderFilterSharedPtr filter,
+                             bool dual_filter);
   ~ActiveMessageDecoderFilter() override = default;
 
   void continueDecoding() override;
   void sendLocalReply(const DirectResponse& response,
                       bool end_stream) override;
-  void startUpstreamResponse() override;
-  UpstreamResponseStatus upstreamData(Buffer::Instance& buffer) override;
+  UpstreamResponseStatus upstreamResponse(MetadataSharedPtr metadata,
+                                          MutationSharedPtr mutation) override;
+  void upstreamResponseError(const std::string& what) override;
+  void forwardResponseBody(Buffer::Instance& data, bool end_stream) override;
+  void setDownstreamWatermarkCallbacks(DownstreamWatermarkCallbacks* callbacks) override;
+  CodecPtr createCodec() override;
+  uint64_t codecHash() override;
+  void encodeRequest(Metadata& metadata, const Mutation& mutation,
+                     Buffer::Instance& buffer) override;
+  void setStreamedBodyHandler(StreamedBodyHandler* handler) override;
   void resetDownstreamConnection() override;
 
-  DecoderFilterSharedPtr handler() { return handle_; }
+  const DecoderFilterSharedPtr& handler() { return handle_; }
+  // Wraps another filter, the wrapper is reused by the next request of its message.
+  void reset(DecoderFilterSharedPtr filter, bool dual_filter);
 
 private:
   DecoderFilterSharedPtr handle_;
@@ -121,12 +93,14 @@ class ActiveMessageEncoderFilter : public ActiveMessageFilterBase,
                                    public LinkedObject<ActiveMessageEncoderFilter>,
                                    Logger::Loggable<Logger::Id::filter> {
 public:
-  ActiveMessageEncoderFilter(ActiveMessage& parent,
-                             EncoderFilterSharedPtr filter, bool dual_filter);
+  ActiveMessageEncoderFilter(ActiveMessage& parent, EncoderFilterSharedPtr filter,
+                             bool dual_filter);
   ~ActiveMessageEncoderFilter() override = default;
 
   void continueEncoding() override;
-  EncoderFilterSharedPtr handler() { return handle_; }
+  const EncoderFilterSharedPtr& handler() { return handle_; }
+  // Wraps another filter, the wrapper is reused by the next request of its message.
+  void reset(EncoderFilterSharedPtr filter, bool dual_filter);
 
 private:
   EncoderFilterSharedPtr handle_;
@@ -137,8 +111,11 @@ private:
 using ActiveMessageEncoderFilterPtr = std::unique_ptr<ActiveMessageEncoderFilter>;
 
 // ActiveMessage tracks downstream requests for which no response has been received.
+//
+// The messages are recycled by their connection manager: a released message is reset and kept in
+// the pool of the connection, and its stream info, buffers and filter wrappers are reused by a
+// later request instead of being allocated for each request.
 class ActiveMessage : public LinkedObject<ActiveMessage>,
-                      public Event::DeferredDeletable,
                       public StreamHandler,
                       public DecoderFilterCallbacks,
                       public FilterChainFactoryCallbacks,
@@ -147,6 +124,14 @@ public:
   ActiveMessage(ConnectionManager& parent);
   ~ActiveMessage() override;
 
+  // Prepares a new or a recycled message for a new request.
+  void start();
+  // Destroys the filters of the request and resets the message, so that it can be reused.
+  void recycle();
+  // Marks the message as released by its request, it's recycled later.
+  void release() { released_ = true; }
+  bool released() const { return released_; }
+
   // Indicates which filter to start the iteration with.
   enum class FilterIterationStartState { AlwaysStartFromNext, CanStartFromCurrent };
 
@@ -174,11 +159,20 @@ public:
   // SerializationType serializationType() const override;
   // ProtocolType protocolType() const override;
   StreamInfo::StreamInfo& streamInfo() override;
+  Tracing::Span* activeSpan() override { return active_span_.get(); }
   Router::RouteConstSharedPtr route() override;
   void sendLocalReply(const DirectResponse& response,
                       bool end_stream) override;
-  void startUpstreamResponse() override;
-  UpstreamResponseStatus upstreamData(Buffer::Instance& buffer) override;
+  UpstreamResponseStatus upstreamResponse(MetadataSharedPtr metadata,
+                                          MutationSharedPtr mutation) override;
+  void upstreamResponseError(const std::string& what) override;
+  void forwardResponseBody(Buffer::Instance& data, bool end_stream) override;
+  void setDownstreamWatermarkCallbacks(DownstreamWatermarkCallbacks* callbacks) override;
+  CodecPtr createCodec() override;
+  uint64_t codecHash() override;
+  void encodeRequest(Metadata& metadata, const Mutation& mutation,
+                     Buffer::Instance& buffer) override;
+  void setStreamedBodyHandler(StreamedBodyHandler* handler) override;
   void resetDownstreamConnection() override;
   Event::Dispatcher& dispatcher() override;
   void resetStream() override;
@@ -191,38 +185,72 @@ public:
   void finalizeRequest();
   void onReset();
   void onError(const std::string& what);
+  // Notifies the write buffer watermarks of the downstream connection to the streamed response.
+  void onDownstreamWatermark(bool above);
+
   MetadataSharedPtr metadata() const { return metadata_; }
+  MessageStreamInfo& messageStreamInfo() { return *stream_info_; }
   // ContextSharedPtr context() const { return context_; }
   bool pendingStreamDecoded() const { return pending_stream_decoded_; }
+  uint64_t requestBytes() const { return request_bytes_; }
+  // The handler of the rest of a streamed request, or nullptr if it can't be passed on yet.
+  StreamedBodyHandler* streamedBodyHandler() const { return streamed_body_handler_; }
 
 private:
+  // Runs the encoder filters on a decoded upstream response and forwards it to the downstream.
+  UpstreamResponseStatus forwardResponse(MetadataSharedPtr metadata, MutationSharedPtr mutation);
+  FilterStatus applyMessageEncodedFilters(MetadataSharedPtr metadata, MutationSharedPtr mutation);
   void addDecoderFilterWorker(DecoderFilterSharedPtr filter, bool dual_filter);
   void addEncoderFilterWorker(EncoderFilterSharedPtr, bool dual_filter);
+  // Records the time elapsed since the start in a microsecond histogram and returns it.
+  std::chrono::microseconds recordElapsed(Stats::Histogram& histogram, MonotonicTime start);
+  // Logs the request to the access logs of the connection manager.
+  void logRequest();
+  // Finishes the server span of the request, if it's traced.
+  void finishSpan();
 
   ConnectionManager& parent_;
 
   MetadataSharedPtr metadata_;
-  Stats::TimespanPtr request_timer_;
-  ActiveResponseDecoderPtr response_decoder_;
+  MutationSharedPtr mutation_;
+  // The upstream response being encoded by the encoder filters.
+  MetadataSharedPtr response_metadata_;
+  MutationSharedPtr response_mutation_;
+  // Constructed in place for each request.
+  absl::optional<Stats::HistogramCompletableTimespanImpl> request_timer_;
 
   absl::optional<Router::RouteConstSharedPtr> cached_route_;
 
+  // The filter wrappers are kept when the message is recycled, the next wrapper to be reused while
+  // the filter chain is created.
   std::list<ActiveMessageDecoderFilterPtr> decoder_filters_;
-  std::function<FilterStatus(DecoderFilter*)> filter_action_;
+  std::list<ActiveMessageDecoderFilterPtr>::iterator next_decoder_filter_;
 
   std::list<ActiveMessageEncoderFilterPtr> encoder_filters_;
-  std::function<FilterStatus(EncoderFilter*)> encoder_filter_action_;
+  std::list<ActiveMessageEncoderFilterPtr>::iterator next_encoder_filter_;
 
   // This value is used in the calculation of the weighted cluster.
-  uint64_t stream_id_;
-  StreamInfo::StreamInfoImpl stream_info_;
+  uint64_t stream_id_{0};
+  // Constructed in place for each request.
+  absl::optional<MessageStreamInfo> stream_info_;
+  // The server span of a sampled request.
+  Tracing::SpanPtr active_span_;
+  // The size of the request, which is accounted to the buffer limit of the connection.
+  uint64_t request_bytes_{0};
+  StreamedBodyHandler* streamed_body_handler_{};
+  DownstreamWatermarkCallbacks* downstream_watermark_callbacks_{};
+  // When the upstream response being streamed to the downstream was decoded.
+  MonotonicTime response_start_time_;
+  // When the decoder filter chain has run on the decoded request, the upstream stage starts.
+  MonotonicTime upstream_start_time_;
 
   Buffer::OwnedImpl response_buffer_;
 
   bool pending_stream_decoded_ : 1;
   bool local_response_sent_ : 1;
-
-  friend class ActiveResponseDecoder;
+  // Whether the message is used by a request, from start() to recycle().
+  bool in_use_ : 1;
+  bool released_ : 1;
 };
 
 using ActiveMessagePtr = std::unique_ptr<ActiveMessage>;
@@ -1,12 +1,18 @@
 #pragma once
 
 #include <any>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <string>
 
 #include "envoy/buffer/buffer.h"
 #include "envoy/common/optref.h"
 #include "envoy/common/pure.h"
 
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace NetworkFilters {
@@ -31,47 +37,70 @@ public:
   virtual ~Properties() = default;
 
   /**
-   * Put a any type key:value pair in the metadata.
+   * Put a any type key:value pair in the metadata, an existing value with the same key is replaced.
    * Please note that the key:value pair put by this function will not be used for routing.
    * Use putString function instead if the decoded key:value pair is intended for routing.
    * @param key
    * @param value
    */
-  virtual void put(std::string key, std::any value) PURE;
+  virtual void put(absl::string_view key, std::any value) PURE;
 
   /**
-   * Get the value by key from the metadata.
+   * Get the value by key from the metadata. The string values put by putString can't be got by
+   * this function, use getString instead.
    * @param key
    * @return
    */
-  virtual AnyOptConstRef get(std::string key) const PURE;
+  virtual AnyOptConstRef get(absl::string_view key) const PURE;
 
   /**
    * Put a string key:value pair in the metadata, the stored value will be used for routing.
+   * An existing value with the same key is replaced.
    * @param key
    * @param value
    */
-  virtual void putString(std::string key, std::string value) PURE;
+  virtual void putString(absl::string_view key, absl::string_view value) PURE;
 
   /**
    * Get a string value from the metadata.
    * @param key
-   * @return
+   * @return the value, or an empty string if there's none. The returned view is valid until the
+   * value is replaced or the metadata is destroyed.
    */
-  virtual std::string getString(std::string key) const PURE;
+  virtual absl::string_view getString(absl::string_view key) const PURE;
 
   /**
    * Get a bool value from the metadata.
    * @param key
    * @return
    */
-  virtual bool getBool(std::string key) const PURE;
+  virtual bool getBool(absl::string_view key) const PURE;
+};
+
+/**
+ * LazyStrings decodes the string values of a message which are only needed by some configurations,
+ * e.g. the attachments of a Dubbo request, when they are looked up.
+ */
+class LazyStrings {
+public:
+  virtual ~LazyStrings() = default;
+
+  /**
+   * Decode the string value of a key.
+   * @param key
+   * @return the value, or absl::nullopt if the message doesn't carry the key.
+   */
+  virtual absl::optional<std::string> decodeString(absl::string_view key) const PURE;
 };
+using LazyStringsSharedPtr = std::shared_ptr<const LazyStrings>;
 
 class Metadata : public Properties {
 public:
   virtual ~Metadata() = default;
 
+  /**
+   * Set the original message, the bytes are moved out of the given buffer.
+   */
   virtual void setOriginMessage(Buffer::Instance&) PURE;
   virtual Buffer::Instance& getOriginMessage() PURE;
   virtual void setMessageType(MessageType messageType) PURE;
@@ -85,12 +114,49 @@ public:
   virtual size_t getHeaderSize() const PURE;
   virtual void setBodySize(size_t bodySize) PURE;
   virtual size_t getBodySize() const PURE;
+
+  /**
+   * Set the timeout carried by the request, e.g. the timeout of the caller.
+   */
+  virtual void setTimeout(std::chrono::milliseconds timeout) PURE;
+  virtual absl::optional<std::chrono::milliseconds> getTimeout() const PURE;
+
+  /**
+   * Set the number of the bytes of a streamed message which follow its original message. A message
+   * larger than the streaming threshold of the codec is decoded once the part needed to route or
+   * account it has arrived, the rest of it is passed on as it arrives rather than being buffered.
+   * @see Codec::setStreamingThreshold()
+   */
+  virtual void setStreamedBytes(uint64_t bytes) PURE;
+  virtual uint64_t getStreamedBytes() const PURE;
+
+  /**
+   * Set the string values which are decoded on demand. getString() decodes a key which hasn't been
+   * put from them, the decoded value is then kept in the metadata and used for routing like a
+   * value put by putString.
+   * @param lazy_strings
+   */
+  virtual void setLazyStrings(LazyStringsSharedPtr lazy_strings) PURE;
 };
 using MetadataSharedPtr = std::shared_ptr<Metadata>;
 
 class Mutation : public Properties {
 public:
   virtual ~Mutation() = default;
+
+  using StringCallback = std::function<void(absl::string_view key, absl::string_view value)>;
+
+  /**
+   * @return whether any string key:value pair has been put in the mutation.
+   */
+  virtual bool hasStrings() const PURE;
+
+  /**
+   * Iterate the string key:value pairs of the mutation in insertion order, they're the values the
+   * codec encodes into the message.
+   * @param callback
+   */
+  virtual void iterateStrings(const StringCallback& callback) const PURE;
 };
 using MutationSharedPtr = std::shared_ptr<Mutation>;
 
@@ -105,6 +171,7 @@ enum class ErrorType {
   NoHealthyUpstream = 2,
   BadResponse = 3,
   Unspecified = 4,
+  Timeout = 5,
 };
 
 struct Error {
@@ -133,14 +200,28 @@ public:
   /*
    * encodes the protocol message.
    *
+   * A request is encoded from its original message with the string values of the mutation, the
+   * unchanged parts of the original message may be moved into the buffer. The buffer is left empty
+   * if the codec doesn't support the encoding of the message type, in which case the original
+   * message is forwarded as is.
+   *
    * @param metadata the meta data produced in the decoding phase.
    * @param mutation the mutation that needs to be encoded to the message.
    * @param buffer save the encoded message.
    * @throws EnvoyException if the metadata or mutation is not valid for this protocol.
    */
-  virtual void encode(const Metadata& metadata, const Mutation& mutation,
+  virtual void encode(Metadata& metadata, const Mutation& mutation,
                       Buffer::Instance& buffer) PURE;
 
+  /*
+   * tells whether encode() encodes the requests with the string values of the mutation. The
+   * features which add strings to the upstream requests, e.g. the injection of the trace context,
+   * are rejected by the configuration of a codec which forwards the original requests instead.
+   *
+   * @return bool true if the requests are encoded with the mutation, false by default.
+   */
+  virtual bool encodesRequests() const { return false; }
+
   /*
    * encodes an error message. The encoded error message is used for local reply, for example, envoy
    * can't find the specified cluster, or there is no healthy endpoint.
@@ -151,6 +232,53 @@ public:
    * @throws EnvoyException if the metadata is not valid for this protocol.
    */
   virtual void onError(const Metadata& metadata, const Error& error, Buffer::Instance& buffer) PURE;
+
+  /*
+   * answers the heartbeat request at the front of the buffer without decoding it into metadata.
+   * A codec which recognizes heartbeats from their fixed header writes the response from a
+   * template, so that the heartbeats of idle connections cost no allocation of metadata. Otherwise
+   * the heartbeats are decoded and answered with encode().
+   *
+   * @param buffer the currently buffered data, the heartbeat request is drained from it if it's
+   * answered.
+   * @param response save the heartbeat response.
+   * @return bool true if a complete heartbeat request was answered, false if the buffer doesn't
+   * start with a complete heartbeat request, in which case it's decoded with decode().
+   */
+  virtual bool respondHeartbeat(Buffer::Instance& buffer, Buffer::Instance& response) {
+    (void)buffer;
+    (void)response;
+    return false;
+  }
+
+  /*
+   * enables the streaming of large messages. A message larger than the threshold is decoded as
+   * soon as the part of it needed for routing and accounting has arrived, e.g. the header and the
+   * invocation of a request or the status and the result type of a response, and the rest of the
+   * message is left in the buffer and reported by Metadata::getStreamedBytes(). The caller passes
+   * these bytes on before decoding the next message. A codec which can't stream a message type
+   * decodes it as a whole.
+   *
+   * @param threshold the message size in bytes above which the messages are streamed, zero
+   * disables streaming.
+   */
+  virtual void setStreamingThreshold(uint64_t threshold) { (void)threshold; }
+
+  /*
+   * rewrites the request ID of an encoded message in place. The requests of the downstream
+   * connections are given unique IDs on a multiplexed upstream connection, and their responses are
+   * given back the IDs of the requests before they're forwarded.
+   *
+   * @param message the buffer which starts with the complete encoded message.
+   * @param request_id the new request ID, it's below 2^31 for a request sent upstream.
+   * @return bool true if the ID is rewritten, false if the codec can't rewrite the ID of the
+   * message, in which case the message is left as is.
+   */
+  virtual bool rewriteRequestId(Buffer::Instance& message, uint64_t request_id) {
+    (void)message;
+    (void)request_id;
+    return false;
+  }
 };
 
 using CodecPtr = std::unique_ptr<Codec>;
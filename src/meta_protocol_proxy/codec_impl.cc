@@ -1,37 +1,107 @@
+#include <algorithm>
 #include <any>
 #include <memory>
 
 #include "envoy/buffer/buffer.h"
 #include "envoy/common/optref.h"
 
+#include "source/common/common/macros.h"
+
 #include "src/meta_protocol_proxy/codec/codec.h"
 #include "src/meta_protocol_proxy/codec_impl.h"
 
+#include "absl/container/flat_hash_set.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace NetworkFilters {
 namespace MetaProtocolProxy {
 
-void PropertiesImpl::put(std::string key, std::any value) { map_->insert({key, value}); }
+namespace {
+
+// The keys put by the meta protocol and the built-in codecs.
+const absl::flat_hash_set<absl::string_view>& wellKnownKeys() {
+  CONSTRUCT_ON_FIRST_USE(absl::flat_hash_set<absl::string_view>,
+                         {"interface", "method", "InvocationInfo", "ProtocolType",
+                          "ProtocolVersion", "MessageType", "Timeout", "TwoWay",
+                          "SerializationType", "ResponseStatus"});
+}
+
+template <class Entries> auto findEntry(Entries& entries, absl::string_view key) {
+  return std::find_if(entries.begin(), entries.end(),
+                      [key](const auto& entry) { return entry.first == key; });
+}
+
+} // namespace
+
+absl::string_view StringArena::copy(absl::string_view value) {
+  if (value.size() > available_) {
+    const size_t size = std::max(BlockSize, value.size());
+    blocks_.emplace_back(new char[size]);
+    next_ = blocks_.back().get();
+    available_ = size;
+  }
+
+  char* const copied = next_;
+  std::copy(value.begin(), value.end(), copied);
+  next_ += value.size();
+  available_ -= value.size();
+  return {copied, value.size()};
+}
+
+absl::string_view PropertiesImpl::internKey(absl::string_view key) {
+  const auto& keys = wellKnownKeys();
+  auto it = keys.find(key);
+  if (it != keys.end()) {
+    return *it;
+  }
+  return keys_.emplace_front(key);
+}
+
+void PropertiesImpl::put(absl::string_view key, std::any value) {
+  auto it = findEntry(values_, key);
+  if (it != values_.end()) {
+    it->second = std::move(value);
+    return;
+  }
+  values_.emplace_back(internKey(key), std::move(value));
+}
 
-AnyOptConstRef PropertiesImpl::get(std::string key) const {
-  auto it = map_->find(key);
-  if (it != map_->end()) {
+AnyOptConstRef PropertiesImpl::get(absl::string_view key) const {
+  auto it = findEntry(values_, key);
+  if (it != values_.end()) {
     return OptRef<const std::any>(it->second);
   }
   return OptRef<const std::any>();
 }
 
-void PropertiesImpl::putString(std::string key, std::string value) { this->put(key, value); }
+void PropertiesImpl::putString(absl::string_view key, absl::string_view value) {
+  auto it = findEntry(strings_, key);
+  if (it != strings_.end()) {
+    it->second = string_arena_.copy(value);
+    return;
+  }
+  strings_.emplace_back(internKey(key), string_arena_.copy(value));
+}
 
-std::string PropertiesImpl::getString(std::string key) const {
-  auto value = this->get(key);
+absl::string_view PropertiesImpl::getString(absl::string_view key) const {
+  auto it = findEntry(strings_, key);
+  if (it != strings_.end()) {
+    return it->second;
+  }
+
+  // A string may also have been put as an any value.
+  auto value = get(key);
   if (value.has_value()) {
-    return std::any_cast<std::string>(value.ref());
+    const auto* str = std::any_cast<std::string>(&value.ref());
+    if (str != nullptr) {
+      return *str;
+    }
   }
   return "";
 }
-bool PropertiesImpl::getBool(std::string key) const {
+
+bool PropertiesImpl::getBool(absl::string_view key) const {
   auto value = this->get(key);
   if (value.has_value()) {
     return std::any_cast<bool>(value.ref());
@@ -39,6 +109,44 @@ bool PropertiesImpl::getBool(std::string key) const {
   return false;
 }
 
+void MetadataImpl::putString(absl::string_view key, absl::string_view value) {
+  properties_.putString(key, value);
+  if (headers_ != nullptr) {
+    headers_->setCopy(Http::LowerCaseString(std::string(key)), value);
+  }
+}
+
+absl::string_view MetadataImpl::getString(absl::string_view key) const {
+  const absl::string_view value = properties_.getString(key);
+  if (!value.empty() || lazy_strings_ == nullptr) {
+    return value;
+  }
+
+  auto it = decoded_strings_.find(key);
+  if (it == decoded_strings_.end()) {
+    it = decoded_strings_.emplace(std::string(key), lazy_strings_->decodeString(key)).first;
+    if (headers_ != nullptr && it->second.has_value()) {
+      headers_->addCopy(Http::LowerCaseString(it->first), it->second.value());
+    }
+  }
+  return it->second.has_value() ? absl::string_view(it->second.value()) : value;
+}
+
+const Http::HeaderMap& MetadataImpl::getHeaders() const {
+  if (headers_ == nullptr) {
+    headers_ = Http::RequestHeaderMapImpl::create();
+    for (const auto& entry : properties_.strings()) {
+      headers_->addCopy(Http::LowerCaseString(std::string(entry.first)), entry.second);
+    }
+    for (const auto& entry : decoded_strings_) {
+      if (entry.second.has_value() && properties_.getString(entry.first).empty()) {
+        headers_->addCopy(Http::LowerCaseString(entry.first), entry.second.value());
+      }
+    }
+  }
+  return *headers_;
+}
+
 } // namespace MetaProtocolProxy
 } // namespace NetworkFilters
 } // namespace Extensions
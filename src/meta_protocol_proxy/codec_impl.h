@@ -1,6 +1,7 @@
 #pragma once
 
 #include <any>
+#include <forward_list>
 #include <memory>
 #include <string>
 
@@ -13,46 +14,108 @@
 
 #include "src/meta_protocol_proxy/codec/codec.h"
 
+#include "absl/container/inlined_vector.h"
+#include "absl/container/node_hash_map.h"
+#include "absl/strings/string_view.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace NetworkFilters {
 namespace MetaProtocolProxy {
 
+/**
+ * StringArena copies the strings of a message into blocks which are never moved or freed before
+ * the arena, so each copy stays valid for as long as the arena. The first block is inline, a
+ * message with a few short strings allocates none.
+ */
+class StringArena {
+public:
+  StringArena() = default;
+  StringArena(const StringArena&) = delete;
+  StringArena& operator=(const StringArena&) = delete;
+
+  /**
+   * @return the copy of the string, which is valid until the arena is destroyed.
+   */
+  absl::string_view copy(absl::string_view value);
+
+private:
+  static constexpr size_t InlineBlockSize = 256;
+  static constexpr size_t BlockSize = 1024;
+
+  char inline_block_[InlineBlockSize];
+  absl::InlinedVector<std::unique_ptr<char[]>, 2> blocks_;
+  char* next_{inline_block_};
+  size_t available_{InlineBlockSize};
+};
+
+/**
+ * PropertiesImpl stores the key:value pairs of a message in flat inline storage. A message carries
+ * a handful of properties, a linear search is cheaper than a node based map and the entries aren't
+ * allocated until the inline capacity is exceeded.
+ *
+ * The well-known keys put by the codecs are interned, so they are neither copied nor allocated.
+ * Other keys are copied once into the properties.
+ *
+ * The string values are copied into the arena of the properties rather than allocated one by one,
+ * so the view returned by getString() stays valid as other strings are put and the entries are
+ * moved. A replaced value is only freed with the properties. The view is invalidated when the
+ * string of the same key is put again, or the properties are destroyed.
+ */
 class PropertiesImpl : public Properties {
 public:
-  PropertiesImpl() : map_(std::make_unique<std::map<std::string, std::any>>()){};
+  using StringEntry = std::pair<absl::string_view, absl::string_view>;
+  using StringEntries = absl::InlinedVector<StringEntry, 4>;
+
+  PropertiesImpl() = default;
+  PropertiesImpl(const PropertiesImpl&) = delete;
+  PropertiesImpl& operator=(const PropertiesImpl&) = delete;
   ~PropertiesImpl() override = default;
 
-  void put(std::string key, std::any value) override;
-  AnyOptConstRef get(std::string key) const override;
-  void putString(std::string key, std::string value) override;
-  std::string getString(std::string key) const override;
-  bool getBool(std::string key) const override;
+  void put(absl::string_view key, std::any value) override;
+  AnyOptConstRef get(absl::string_view key) const override;
+  void putString(absl::string_view key, absl::string_view value) override;
+  absl::string_view getString(absl::string_view key) const override;
+  bool getBool(absl::string_view key) const override;
+
+  /**
+   * @return the string key:value pairs in insertion order.
+   */
+  const StringEntries& strings() const { return strings_; }
 
 private:
-  std::unique_ptr<std::map<std::string, std::any>> map_;
+  using AnyEntry = std::pair<absl::string_view, std::any>;
+
+  absl::string_view internKey(absl::string_view key);
+
+  absl::InlinedVector<AnyEntry, 8> values_;
+  StringEntries strings_;
+  StringArena string_arena_;
+  // The keys which are not well-known. The entries refer to them, their addresses must be stable.
+  std::forward_list<std::string> keys_;
 };
 
 class MetadataImpl : public Metadata {
 public:
-  MetadataImpl() { headers_ = Http::RequestHeaderMapImpl::create(); };
+  MetadataImpl() = default;
   ~MetadataImpl() = default;
 
-  void put(std::string key, std::any value) override { properties_.put(key, value); };
-  AnyOptConstRef get(std::string key) const override {
-    return properties_.get(key);
-  };
-  void putString(std::string key, std::string value) override {
-    this->put(key, value);
-    auto lowcase_key = Http::LowerCaseString(key);
-    headers_->remove(lowcase_key);
-    headers_->addCopy(lowcase_key, value);
+  void put(absl::string_view key, std::any value) override {
+    properties_.put(key, std::move(value));
   };
-  std::string getString(std::string key) const override { return properties_.getString(key); };
-  bool getBool(std::string key) const override { return properties_.getBool(key); };
+  AnyOptConstRef get(absl::string_view key) const override { return properties_.get(key); };
+  void putString(absl::string_view key, absl::string_view value) override;
+  /**
+   * Returns the string of the key, it's decoded by the lazy strings if the key hasn't been put.
+   * The decoded strings, and the keys the message doesn't carry, are cached so that each key is
+   * decoded at most once. The view stays valid until the string of the same key is put, or the
+   * metadata is destroyed.
+   */
+  absl::string_view getString(absl::string_view key) const override;
+  bool getBool(absl::string_view key) const override { return properties_.getBool(key); };
 
   void setOriginMessage(Buffer::Instance& originMessage) override {
-    origin_message_ = originMessage;
+    origin_message_.move(originMessage);
   };
   Buffer::Instance& getOriginMessage() override { return origin_message_; };
   void setMessageType(MessageType messageType) override {
@@ -70,18 +133,38 @@ public:
   size_t getHeaderSize() const override { return header_size_; };
   void setBodySize(size_t bodySize) override { body_size_ = bodySize; };
   size_t getBodySize() const override { return body_size_; };
-  const Http::HeaderMap& getHeaders() const { return *headers_; }
+  void setTimeout(std::chrono::milliseconds timeout) override { timeout_ = timeout; };
+  absl::optional<std::chrono::milliseconds> getTimeout() const override { return timeout_; };
+  void setStreamedBytes(uint64_t bytes) override { streamed_bytes_ = bytes; }
+  uint64_t getStreamedBytes() const override { return streamed_bytes_; }
+  void setLazyStrings(LazyStringsSharedPtr lazy_strings) override {
+    lazy_strings_ = std::move(lazy_strings);
+  };
+
+  /**
+   * @return the string key:value pairs as a header map, which is built on the first call since
+   * only the route matchers need it. It includes the decoded strings which have been looked up,
+   * and it's kept up to date as strings are put or decoded.
+   */
+  const Http::HeaderMap& getHeaders() const;
 
 private:
   PropertiesImpl properties_;
+  LazyStringsSharedPtr lazy_strings_;
+  // The strings decoded by lazy_strings_ keyed by the key looked up, a key the message doesn't
+  // carry maps to absl::nullopt. The values are nodes, so their views stay valid as other keys are
+  // decoded.
+  mutable absl::node_hash_map<std::string, absl::optional<std::string>> decoded_strings_;
   Buffer::OwnedImpl origin_message_;
   MessageType message_type_{MessageType::Request};
   ResponseStatus response_status_{ResponseStatus::Ok};
   uint64_t request_id_{0};
   size_t header_size_{0};
   size_t body_size_{0};
+  absl::optional<std::chrono::milliseconds> timeout_;
+  uint64_t streamed_bytes_{0};
   // Reuse the HeaderMatcher API and related tools provided by Envoy to match the route
-  Http::HeaderMapPtr headers_;
+  mutable Http::HeaderMapPtr headers_;
 };
 
 class MutationImpl : public Mutation { //@TODO
@@ -89,13 +172,23 @@ public:
   MutationImpl() = default;
   ~MutationImpl() = default;
 
-  void put(std::string key, std::any value) override { properties_.put(key, value); };
-  AnyOptConstRef get(std::string key) const override {
-    return properties_.get(key);
+  void put(absl::string_view key, std::any value) override {
+    properties_.put(key, std::move(value));
+  };
+  AnyOptConstRef get(absl::string_view key) const override { return properties_.get(key); };
+  void putString(absl::string_view key, absl::string_view value) override {
+    properties_.putString(key, value);
+  };
+  absl::string_view getString(absl::string_view key) const override {
+    return properties_.getString(key);
   };
-  void putString(std::string key, std::string value) override { this->put(key, value); };
-  std::string getString(std::string key) const override { return properties_.getString(key); };
-  bool getBool(std::string key) const override { return properties_.getBool(key); };
+  bool getBool(absl::string_view key) const override { return properties_.getBool(key); };
+  bool hasStrings() const override { return !properties_.strings().empty(); }
+  void iterateStrings(const StringCallback& callback) const override {
+    for (const auto& entry : properties_.strings()) {
+      callback(entry.first, entry.second);
+    }
+  }
 
 private:
   PropertiesImpl properties_;
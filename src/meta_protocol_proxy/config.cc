@@ -3,7 +3,9 @@
 #include "absl/container/flat_hash_map.h"
 
 #include "envoy/registry/registry.h"
+#include "source/common/access_log/access_log_impl.h"
 #include "source/common/config/utility.h"
+#include "source/common/protobuf/utility.h"
 
 #include "src/meta_protocol_proxy/codec/factory.h"
 #include "src/meta_protocol_proxy/conn_manager.h"
@@ -41,8 +43,39 @@ ConfigImpl::ConfigImpl(const MetaProtocolProxyConfig& config,
       stats_prefix_(
           fmt::format("meta_protocol.{}.{}.", config.application_protocol(), config.stat_prefix())),
       stats_(MetaProtocolProxyStats::generateStats(stats_prefix_, context_.scope())),
-      application_protocol_(config.application_protocol()), codecConfig_(config.codec()) {
+      application_protocol_(config.application_protocol()),
+      max_concurrent_requests_(config.has_max_concurrent_requests() &&
+                                       config.max_concurrent_requests().value() > 0
+                                   ? config.max_concurrent_requests().value()
+                                   : UINT32_MAX),
+      buffer_limit_(
+          PROTOBUF_GET_WRAPPED_OR_DEFAULT(config, per_connection_buffer_limit_bytes, UINT32_MAX)),
+      request_streaming_threshold_(
+          PROTOBUF_GET_WRAPPED_OR_DEFAULT(config, request_streaming_threshold_bytes, 0)),
+      codec_factory_(Envoy::Config::Utility::getAndCheckFactoryByName<NamedCodecConfigFactory>(
+          config.codec().name())),
+      codec_config_(codec_factory_.createEmptyConfigProto()),
+      codec_hash_(MessageUtil::hash(config.codec())) {
+  // The codec config is translated once here rather than each time a codec is created, it's then
+  // shared by all the codecs of this filter.
+  Envoy::Config::Utility::translateOpaqueConfig(
+      config.codec().config(), ProtobufWkt::Struct::default_instance(),
+      context_.messageValidationVisitor(), *codec_config_);
   route_matcher_ = std::make_unique<Router::RouteMatcherImpl>(config.route_config(), context);
+  for (const auto& access_log : config.access_log()) {
+    access_logs_.push_back(AccessLog::AccessLogFactory::fromProto(access_log, context_));
+  }
+  if (config.has_tracing()) {
+    // The trace context of the client spans is injected into the upstream requests, which the
+    // codec has to encode.
+    if (!createCodec()->encodesRequests()) {
+      throw EnvoyException(fmt::format(
+          "meta protocol proxy: the codec '{}' doesn't support tracing, it doesn't encode requests",
+          config.codec().name()));
+    }
+    tracing_config_ = std::make_unique<TracingConfigImpl>(config.tracing(), application_protocol_,
+                                                          context_);
+  }
   if (config.meta_protocol_filters().empty()) {
     ENVOY_LOG(debug, "using default router filter");
 
@@ -68,16 +101,7 @@ Router::RouteConstSharedPtr ConfigImpl::route(const Metadata& metadata,
   return route_matcher_->route(metadata, random_value);
 }
 
-CodecPtr ConfigImpl::createCodec() {
-  auto& factory =
-      Envoy::Config::Utility::getAndCheckFactoryByName<NamedCodecConfigFactory>(
-          codecConfig_.name());
-  ProtobufTypes::MessagePtr message = factory.createEmptyConfigProto();
-  Envoy::Config::Utility::translateOpaqueConfig(codecConfig_.config(),
-                                                ProtobufWkt::Struct::default_instance(),
-                                                context_.messageValidationVisitor(), *message);
-  return factory.createCodec(*message);
-}
+CodecPtr ConfigImpl::createCodec() { return codec_factory_.createCodec(*codec_config_); }
 
 void ConfigImpl::registerFilter(const MetaProtocolFilterConfig& proto_config) {
   const auto& string_name = proto_config.name();
@@ -1,11 +1,13 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "api/v1alpha/meta_protocol_proxy.pb.h"
 #include "api/v1alpha/meta_protocol_proxy.pb.validate.h"
 
 #include "source/extensions/filters/network/common/factory_base.h"
+#include "src/meta_protocol_proxy/codec/factory.h"
 #include "src/meta_protocol_proxy/conn_manager.h"
 #include "src/meta_protocol_proxy/filters/filter.h"
 #include "src/meta_protocol_proxy/filters/router/route_matcher.h"
@@ -61,7 +63,13 @@ public:
   FilterChainFactory& filterFactory() override { return *this; }
   Router::Config& routerConfig() override { return *this; }
   CodecPtr createCodec() override;
+  uint64_t codecHash() override { return codec_hash_; }
   std::string applicationProtocol() override { return application_protocol_; };
+  uint32_t maxConcurrentRequests() override { return max_concurrent_requests_; }
+  uint32_t bufferLimit() override { return buffer_limit_; }
+  uint32_t requestStreamingThreshold() override { return request_streaming_threshold_; }
+  const std::vector<AccessLog::InstanceSharedPtr>& accessLogs() override { return access_logs_; }
+  const TracingConfigImpl* tracingConfig() override { return tracing_config_.get(); }
 
 private:
   void registerFilter(const MetaProtocolFilterConfig& proto_config);
@@ -71,8 +79,15 @@ private:
   MetaProtocolProxyStats stats_;
   Router::RouteMatcherPtr route_matcher_;
   std::string application_protocol_;
-  CodecConfig codecConfig_;
-  std::list<FilterFactoryCb> filter_factories_;
+  const uint32_t max_concurrent_requests_;
+  const uint32_t buffer_limit_;
+  const uint32_t request_streaming_threshold_;
+  NamedCodecConfigFactory& codec_factory_;
+  const ProtobufTypes::MessagePtr codec_config_;
+  const uint64_t codec_hash_;
+  std::vector<FilterFactoryCb> filter_factories_;
+  std::vector<AccessLog::InstanceSharedPtr> access_logs_;
+  TracingConfigImplPtr tracing_config_;
 };
 
 } // namespace MetaProtocolProxy
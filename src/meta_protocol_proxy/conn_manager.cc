@@ -1,6 +1,8 @@
 #include "src/meta_protocol_proxy/conn_manager.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <iterator>
 
 #include "envoy/common/exception.h"
 
@@ -14,16 +16,28 @@ namespace Extensions {
 namespace NetworkFilters {
 namespace MetaProtocolProxy {
 
-constexpr uint32_t BufferLimit = UINT32_MAX;
+namespace {
+
+// The maximum number of the recycled messages kept by a connection. A worker may have many
+// connections each holding its pool while idle, so a pool only covers a few pipelined requests.
+constexpr uint64_t MaxPooledMessages = 8;
+
+} // namespace
 
 ConnectionManager::ConnectionManager(Config& config, Random::RandomGenerator& random_generator,
                                      TimeSource& time_system)
     : config_(config), time_system_(time_system), stats_(config_.stats()),
-      random_generator_(random_generator), codec_(config.createCodec()),
-      decoder_(std::make_unique<RequestDecoder>(*codec_, *this)) {}
+      random_generator_(random_generator), max_concurrent_requests_(config.maxConcurrentRequests()),
+      buffer_limit_(config.bufferLimit()), codec_(config.createCodec()),
+      decoder_(std::make_unique<RequestDecoder>(*codec_, *this)) {
+  codec_->setStreamingThreshold(config.requestStreamingThreshold());
+}
 
 Network::FilterStatus ConnectionManager::onData(Buffer::Instance& data, bool end_stream) {
   ENVOY_LOG(trace, "meta protocol: read {} bytes", data.length());
+  if (!request_start_time_.has_value()) {
+    request_start_time_ = time_system_.monotonicTime();
+  }
   request_buffer_.move(data);
   dispatch();
 
@@ -59,7 +73,7 @@ void ConnectionManager::initializeReadFilterCallbacks(Network::ReadFilterCallbac
   read_callbacks_ = &callbacks;
   read_callbacks_->connection().addConnectionCallbacks(*this);
   read_callbacks_->connection().enableHalfClose(true);
-  read_callbacks_->connection().setBufferLimits(BufferLimit);
+  read_callbacks_->connection().setBufferLimits(buffer_limit_);
 }
 
 void ConnectionManager::onEvent(Network::ConnectionEvent event) {
@@ -69,24 +83,43 @@ void ConnectionManager::onEvent(Network::ConnectionEvent event) {
 void ConnectionManager::onAboveWriteBufferHighWatermark() {
   ENVOY_CONN_LOG(debug, "onAboveWriteBufferHighWatermark", read_callbacks_->connection());
   read_callbacks_->connection().readDisable(true);
+  if (response_streaming_message_ != nullptr) {
+    response_streaming_message_->onDownstreamWatermark(true);
+  }
 }
 
 void ConnectionManager::onBelowWriteBufferLowWatermark() {
   ENVOY_CONN_LOG(debug, "onBelowWriteBufferLowWatermark", read_callbacks_->connection());
   read_callbacks_->connection().readDisable(false);
+  if (response_streaming_message_ != nullptr) {
+    response_streaming_message_->onDownstreamWatermark(false);
+  }
 }
 
 StreamHandler& ConnectionManager::newStream() {
   ENVOY_LOG(debug, "meta protocol: create the new decoder event handler");
 
-  ActiveMessagePtr new_message(std::make_unique<ActiveMessage>(*this));
-  new_message->createFilterChain();
-  LinkedList::moveIntoList(std::move(new_message), active_message_list_);
-  return **active_message_list_.begin();
+  if (!message_pool_.empty()) {
+    // The list nodes are moved between the lists, so a recycled message is reused without any
+    // allocation of its own.
+    message_pool_.front()->moveBetweenLists(message_pool_, active_message_list_);
+  } else {
+    LinkedList::moveIntoList(std::make_unique<ActiveMessage>(*this), active_message_list_);
+  }
+
+  const std::chrono::microseconds decode_time = onMessageDecoded();
+  stats_.request_decode_time_us_.recordValue(decode_time.count());
+
+  ActiveMessage& message = **active_message_list_.begin();
+  message.start();
+  message.messageStreamInfo().setStageDuration(MessageStreamInfo::Stage::Decode, decode_time);
+  message.createFilterChain();
+  return message;
 }
 
 void ConnectionManager::onHeartbeat(MetadataSharedPtr metadata) {
   stats_.request_event_.inc();
+  onMessageDecoded();
 
   if (read_callbacks_->connection().state() != Network::Connection::State::Open) {
     ENVOY_LOG(warn, "meta protocol: downstream connection is closed or closing");
@@ -97,12 +130,26 @@ void ConnectionManager::onHeartbeat(MetadataSharedPtr metadata) {
   Buffer::OwnedImpl response_buffer;
 
   heartbeat.encode(*metadata, *codec_, response_buffer);
-  read_callbacks_->connection().write(response_buffer, false);
+  writeResponse(nullptr, response_buffer, true);
+}
+
+void ConnectionManager::onHeartbeatResponse() {
+  stats_.request_event_.inc();
+  onMessageDecoded();
+
+  if (read_callbacks_->connection().state() != Network::Connection::State::Open) {
+    ENVOY_LOG(warn, "meta protocol: downstream connection is closed or closing");
+    heartbeat_response_.drain(heartbeat_response_.length());
+    return;
+  }
+
+  writeResponse(nullptr, heartbeat_response_, true);
 }
 
 void ConnectionManager::dispatch() {
   if (0 == request_buffer_.length()) {
     ENVOY_LOG(debug, "meta protocol: it's empty data");
+    updateReadState();
     return;
   }
 
@@ -113,10 +160,29 @@ void ConnectionManager::dispatch() {
   }
 
   try {
+    // The remaining requests are decoded once the connection is no longer overloaded.
     bool underflow = false;
-    while (!underflow) {
+    while (!underflow && !overloaded()) {
+      // The rest of a streamed request precedes the next request on the connection.
+      if (streamed_bytes_ > 0) {
+        if (!forwardStreamedBody()) {
+          break;
+        }
+        // The next request is timed from the end of the streamed one.
+        onMessageDecoded();
+      }
+      if (request_buffer_.length() == 0) {
+        break;
+      }
+      // The heartbeats recognized by the codec are answered without being decoded.
+      if (codec_->respondHeartbeat(request_buffer_, heartbeat_response_)) {
+        onHeartbeatResponse();
+        underflow = request_buffer_.length() == 0;
+        continue;
+      }
       decoder_->onData(request_buffer_, underflow);
     }
+    updateReadState();
     return;
   } catch (const EnvoyException& ex) {
     ENVOY_CONN_LOG(error, "meta protocol error: {}", read_callbacks_->connection(), ex.what());
@@ -126,6 +192,67 @@ void ConnectionManager::dispatch() {
   resetAllMessages(true);
 }
 
+std::chrono::microseconds ConnectionManager::onMessageDecoded() {
+  const MonotonicTime now = time_system_.monotonicTime();
+  std::chrono::microseconds elapsed(0);
+  if (request_start_time_.has_value()) {
+    elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - *request_start_time_);
+  }
+  if (request_buffer_.length() > 0) {
+    request_start_time_ = now;
+  } else {
+    request_start_time_.reset();
+  }
+  return elapsed;
+}
+
+bool ConnectionManager::forwardStreamedBody() {
+  const uint64_t bytes = std::min(streamed_bytes_, request_buffer_.length());
+  if (streaming_message_ == nullptr) {
+    request_buffer_.drain(bytes);
+    streamed_bytes_ -= bytes;
+    return streamed_bytes_ == 0;
+  }
+
+  StreamedBodyHandler* handler = streaming_message_->streamedBodyHandler();
+  if (handler == nullptr) {
+    // The bytes are held until the request has a handler, they're accounted to the buffer limit
+    // so that reading stops if the handler is paused for long.
+    return false;
+  }
+
+  Buffer::OwnedImpl chunk;
+  chunk.move(request_buffer_, bytes);
+  streamed_bytes_ -= bytes;
+  const bool end_stream = streamed_bytes_ == 0;
+  if (end_stream) {
+    streaming_message_ = nullptr;
+  }
+  handler->onStreamedBody(chunk, end_stream);
+  return end_stream;
+}
+
+void ConnectionManager::onStreamedRequest(ActiveMessage& message, uint64_t streamed_bytes) {
+  ASSERT(streamed_bytes_ == 0);
+  streaming_message_ = &message;
+  streamed_bytes_ = streamed_bytes;
+}
+
+void ConnectionManager::onStreamedBodyHandler() {
+  if (streamed_bytes_ > 0 && request_buffer_.length() > 0) {
+    // The handler may be set in the middle of an upstream callback.
+    scheduleDispatch();
+  }
+}
+
+void ConnectionManager::scheduleDispatch() {
+  if (resume_timer_ == nullptr) {
+    resume_timer_ =
+        read_callbacks_->connection().dispatcher().createTimer([this]() { dispatch(); });
+  }
+  resume_timer_->enableTimer(std::chrono::milliseconds(0));
+}
+
 void ConnectionManager::sendLocalReply(Metadata& metadata,
                                        const DirectResponse& response,
                                        bool end_stream) {
@@ -140,7 +267,12 @@ void ConnectionManager::sendLocalReply(Metadata& metadata,
     Buffer::OwnedImpl buffer;
     result = response.encode(metadata, *codec_, buffer);
 
-    read_callbacks_->connection().write(buffer, end_stream);
+    if (end_stream) {
+      // The connection is closed after the reply, a streamed response is cut short anyway.
+      read_callbacks_->connection().write(buffer, true);
+    } else {
+      writeResponse(nullptr, buffer, true);
+    }
   } catch (const EnvoyException& ex) {
     ENVOY_CONN_LOG(error, "meta protocol error: {}", read_callbacks_->connection(), ex.what());
   }
@@ -164,6 +296,59 @@ void ConnectionManager::sendLocalReply(Metadata& metadata,
   }
 }
 
+void ConnectionManager::writeResponse(ActiveMessage* message, Buffer::Instance& data,
+                                      bool end_response) {
+  ASSERT(message != nullptr || end_response);
+  if (response_streaming_message_ == nullptr || response_streaming_message_ == message) {
+    read_callbacks_->connection().write(data, false);
+    if (!end_response) {
+      response_streaming_message_ = message;
+    } else if (response_streaming_message_ != nullptr) {
+      response_streaming_message_ = nullptr;
+      flushHeldResponses();
+    }
+    return;
+  }
+
+  // Another response is being streamed, this one is written once that one ends.
+  auto it = held_responses_.end();
+  if (message != nullptr) {
+    it = std::find_if(held_responses_.begin(), held_responses_.end(),
+                      [message](const HeldResponse& held) { return held.message_ == message; });
+  }
+  if (it == held_responses_.end()) {
+    if (held_responses_.empty() || held_responses_.back().message_ != nullptr || !end_response) {
+      held_responses_.emplace_back();
+      held_responses_.back().message_ = message;
+    }
+    it = std::prev(held_responses_.end());
+  }
+  it->data_.move(data);
+  if (end_response) {
+    it->message_ = nullptr;
+  }
+}
+
+bool ConnectionManager::responseWritable(const ActiveMessage& message) const {
+  return response_streaming_message_ == &message &&
+         !read_callbacks_->connection().aboveHighWatermark();
+}
+
+void ConnectionManager::flushHeldResponses() {
+  while (response_streaming_message_ == nullptr && !held_responses_.empty()) {
+    HeldResponse& held = held_responses_.front();
+    read_callbacks_->connection().write(held.data_, false);
+    response_streaming_message_ = held.message_;
+    held_responses_.pop_front();
+  }
+
+  // The streamed response has been paused while it was held.
+  if (response_streaming_message_ != nullptr &&
+      !read_callbacks_->connection().aboveHighWatermark()) {
+    response_streaming_message_->onDownstreamWatermark(false);
+  }
+}
+
 void ConnectionManager::continueDecoding() {
   ENVOY_CONN_LOG(debug, "meta protocol filter continued", read_callbacks_->connection());
   stopped_ = false;
@@ -178,11 +363,88 @@ void ConnectionManager::continueDecoding() {
 }
 
 void ConnectionManager::deferredMessage(ActiveMessage& message) {
-  if (!message.inserted()) {
+  if (!message.inserted() || message.released()) {
     return;
   }
-  read_callbacks_->connection().dispatcher().deferredDelete(
-      message.removeFromList(active_message_list_));
+  ASSERT(buffered_request_bytes_ >= message.requestBytes());
+  buffered_request_bytes_ -= message.requestBytes();
+  message.release();
+  bool close_connection = false;
+  if (response_streaming_message_ == &message) {
+    // The streamed response is cut short, the downstream can't tell where the next response
+    // starts.
+    response_streaming_message_ = nullptr;
+    close_connection = true;
+  } else {
+    // A held response which is cut short has never been written.
+    held_responses_.remove_if(
+        [&message](const HeldResponse& held) { return held.message_ == &message; });
+  }
+  bool dispatch_pending = false;
+  if (streaming_message_ == &message) {
+    // The rest of the request is discarded, the held bytes may be followed by the next request.
+    streaming_message_ = nullptr;
+    dispatch_pending = request_buffer_.length() > 0;
+  }
+  message.moveBetweenLists(active_message_list_, released_message_list_);
+  if (recycle_timer_ == nullptr) {
+    recycle_timer_ =
+        read_callbacks_->connection().dispatcher().createTimer([this]() { recycleMessages(); });
+  }
+  if (!recycle_timer_->enabled()) {
+    recycle_timer_->enableTimer(std::chrono::milliseconds(0));
+  }
+
+  if ((read_disabled_ || dispatch_pending) && !overloaded()) {
+    // The message may be deleted in the middle of decoding or of an upstream callback, so the
+    // buffered requests are decoded in the next event loop iteration.
+    scheduleDispatch();
+  }
+
+  if (close_connection) {
+    ENVOY_CONN_LOG(debug, "meta protocol: streamed response reset", read_callbacks_->connection());
+    read_callbacks_->connection().close(Network::ConnectionCloseType::NoFlush);
+  }
+}
+
+void ConnectionManager::recycleMessages() {
+  // The filters destroyed by a message may release other messages.
+  while (!released_message_list_.empty()) {
+    ActiveMessage& message = *released_message_list_.front();
+    if (message_pool_.size() >= MaxPooledMessages) {
+      released_message_list_.pop_front();
+      continue;
+    }
+    message.recycle();
+    message.moveBetweenLists(released_message_list_, message_pool_);
+  }
+}
+
+bool ConnectionManager::overloaded() const {
+  if (active_message_list_.size() >= max_concurrent_requests_) {
+    return true;
+  }
+  // A request larger than the limit is still read if no request is in flight, so that the
+  // connection always makes progress.
+  return buffered_request_bytes_ > 0 &&
+         buffered_request_bytes_ + request_buffer_.length() >= buffer_limit_;
+}
+
+void ConnectionManager::updateReadState() {
+  const bool disable = overloaded();
+  if (disable == read_disabled_) {
+    return;
+  }
+
+  ENVOY_CONN_LOG(debug, "meta protocol: {} reading, {} requests and {} bytes buffered",
+                 read_callbacks_->connection(), disable ? "disable" : "enable",
+                 active_message_list_.size(), buffered_request_bytes_ + request_buffer_.length());
+  if (disable) {
+    stats_.cx_read_disabled_.inc();
+  }
+  read_disabled_ = disable;
+  // readDisable() is reference counted, so it's balanced with the write watermark callbacks.
+  read_callbacks_->connection().readDisable(disable);
 }
 
 void ConnectionManager::resetAllMessages(bool local_reset) {
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <chrono>
+#include <vector>
+
+#include "envoy/access_log/access_log.h"
 #include "envoy/common/time.h"
+#include "envoy/event/timer.h"
 #include "api/v1alpha/meta_protocol_proxy.pb.h"
 #include "envoy/network/connection.h"
 #include "envoy/network/filter.h"
@@ -16,6 +21,9 @@
 #include "src/meta_protocol_proxy/decoder_event_handler.h"
 #include "src/meta_protocol_proxy/filters/filter.h"
 #include "src/meta_protocol_proxy/stats.h"
+#include "src/meta_protocol_proxy/tracing.h"
+
+#include "absl/types/optional.h"
 
 namespace Envoy {
 namespace Extensions {
@@ -32,8 +40,41 @@ public:
   virtual FilterChainFactory& filterFactory() PURE;
   virtual MetaProtocolProxyStats& stats() PURE;
   virtual CodecPtr createCodec() PURE;
+
+  /**
+   * @return uint64_t the hash of the codec configuration, the codecs of the configurations with
+   * the same hash decode the messages alike.
+   */
+  virtual uint64_t codecHash() PURE;
+
   virtual Router::Config& routerConfig() PURE;
   virtual std::string applicationProtocol() PURE;
+
+  /**
+   * @return uint32_t the maximum number of requests in flight on a downstream connection.
+   */
+  virtual uint32_t maxConcurrentRequests() PURE;
+
+  /**
+   * @return uint32_t the soft limit on the bytes buffered for a downstream connection.
+   */
+  virtual uint32_t bufferLimit() PURE;
+
+  /**
+   * @return uint32_t the size of the requests above which they're streamed, zero if the requests
+   * aren't streamed.
+   */
+  virtual uint32_t requestStreamingThreshold() PURE;
+
+  /**
+   * @return the access logs the requests are logged to once they're complete.
+   */
+  virtual const std::vector<AccessLog::InstanceSharedPtr>& accessLogs() PURE;
+
+  /**
+   * @return the tracing configuration of the requests, nullptr if they aren't traced.
+   */
+  virtual const TracingConfigImpl* tracingConfig() PURE;
 };
 
 // class ActiveMessagePtr;
@@ -65,29 +106,95 @@ public:
   TimeSource& timeSystem() const { return time_system_; }
   Random::RandomGenerator& randomGenerator() const { return random_generator_; }
   Config& config() const { return config_; }
+  // The codec decoding the connection, the requests are encoded with it as well.
+  Codec& codec() const { return *codec_; }
 
   void continueDecoding();
   void deferredMessage(ActiveMessage& message);
+  // Accounts the bytes of a decoded request to the buffer limit until its message is deleted.
+  void onRequestBuffered(uint64_t bytes) { buffered_request_bytes_ += bytes; }
+  // Called when a decoded request is followed by the given number of its bytes, which are passed
+  // on to the streamed body handler of the message.
+  void onStreamedRequest(ActiveMessage& message, uint64_t streamed_bytes);
+  // Called when the streamed request is given a handler, the bytes held for it are passed on.
+  void onStreamedBodyHandler();
   void sendLocalReply(Metadata& metadata,
                       const DirectResponse& response, bool end_stream);
+  // Writes a response to the downstream. While a streamed response is written, the other
+  // responses are held and written in order once it ends.
+  // @param message the message of the response, nullptr for a local or a heartbeat response
+  // @param data the bytes of the response, which are drained
+  // @param end_response whether the response ends with these bytes, otherwise it's streamed
+  void writeResponse(ActiveMessage* message, Buffer::Instance& data, bool end_response);
+  // Returns whether the response of the message is written to the downstream as it arrives.
+  bool responseWritable(const ActiveMessage& message) const;
 
   // This function is for testing only.
   std::list<ActiveMessagePtr>& getActiveMessagesForTest() { return active_message_list_; }
 
 private:
   void dispatch();
+  // Returns the time the message which has just been decoded took to be received and decoded. The
+  // next message is timed from now if its bytes are already buffered.
+  std::chrono::microseconds onMessageDecoded();
+  // Passes the buffered bytes of the streamed request on, returns whether all of them are passed.
+  bool forwardStreamedBody();
+  // Dispatches the buffered data in the next event loop iteration.
+  void scheduleDispatch();
+  // Writes the held responses up to the first streamed response which hasn't ended.
+  void flushHeldResponses();
+  void onHeartbeatResponse();
+  // Recycles the released messages into the message pool.
+  void recycleMessages();
   void resetAllMessages(bool local_reset);
+  // Returns whether the connection has reached its concurrency or buffer limit, in which case the
+  // requests are neither decoded nor read.
+  bool overloaded() const;
+  void updateReadState();
 
   Buffer::OwnedImpl request_buffer_;
+  // When the first byte of the message being decoded was received, unset if none is buffered.
+  absl::optional<MonotonicTime> request_start_time_;
+  // The response of a heartbeat answered by the codec, it's reused for all the heartbeats.
+  Buffer::OwnedImpl heartbeat_response_;
   std::list<ActiveMessagePtr> active_message_list_;
+  // The messages released by their requests, they're recycled in the next event loop iteration as
+  // they may be released in the middle of their own callbacks.
+  std::list<ActiveMessagePtr> released_message_list_;
+  // The recycled messages to be reused by the next requests of the connection.
+  std::list<ActiveMessagePtr> message_pool_;
+  Event::TimerPtr recycle_timer_;
+  // The bytes of the requests in flight.
+  uint64_t buffered_request_bytes_{0};
+  // Resumes decoding the buffered requests out of the callbacks of a completed message.
+  Event::TimerPtr resume_timer_;
+  // The message of the request being streamed, or nullptr if the message has been released and
+  // the rest of the request is discarded.
+  ActiveMessage* streaming_message_{};
+  // The bytes of the streamed request which haven't been read yet.
+  uint64_t streamed_bytes_{0};
+
+  // A response held while another response is streamed to the downstream.
+  struct HeldResponse {
+    // The message of a streamed response which hasn't ended, nullptr once the response is complete.
+    ActiveMessage* message_;
+    Buffer::OwnedImpl data_;
+  };
+  // The message whose response is being streamed to the downstream.
+  ActiveMessage* response_streaming_message_{};
+  std::list<HeldResponse> held_responses_;
 
   bool stopped_{false};
   bool half_closed_{false};
+  // Whether reading has been disabled by this filter because the connection is overloaded.
+  bool read_disabled_{false};
 
   Config& config_;
   TimeSource& time_system_;
   MetaProtocolProxyStats& stats_;
   Random::RandomGenerator& random_generator_;
+  const uint32_t max_concurrent_requests_;
+  const uint32_t buffer_limit_;
 
   CodecPtr codec_;
   RequestDecoderPtr decoder_;
@@ -7,12 +7,16 @@ namespace NetworkFilters {
 namespace MetaProtocolProxy {
 
 ProtocolState DecoderStateMachine::onDecodeStream(Buffer::Instance& buffer) {
-  auto metadata = std::make_shared<MetadataImpl>();
-  auto decodeStatus = codec_.decode(buffer, *metadata);
+  if (metadata_ == nullptr) {
+    metadata_ = std::make_shared<MetadataImpl>();
+  }
+  auto decodeStatus = codec_.decode(buffer, *metadata_);
   if (decodeStatus == DecodeStatus::WaitForData) {
     return ProtocolState::WaitForData;
   }
 
+  MetadataSharedPtr metadata = std::move(metadata_);
+
   if (metadata->getMessageType() == MessageType::Heartbeat) {
     ENVOY_LOG(debug, "meta protocol decoder: this is a heartbeat message");
     delegate_.onHeartbeat(metadata);
@@ -34,9 +38,12 @@ ProtocolState DecoderStateMachine::run(Buffer::Instance& buffer) {
   return state_;
 }
 
-using DecoderStateMachinePtr = std::unique_ptr<DecoderStateMachine>;
+void DecoderStateMachine::reset() {
+  state_ = ProtocolState::OnDecodeStreamData;
+  metadata_.reset();
+}
 
-DecoderBase::DecoderBase(Codec& codec) : codec_(codec) {}
+DecoderBase::DecoderBase(Codec& codec) : codec_(codec), state_machine_(codec, *this) {}
 
 DecoderBase::~DecoderBase() { complete(); }
 
@@ -44,16 +51,10 @@ FilterStatus DecoderBase::onData(Buffer::Instance& data, bool& buffer_underflow)
   ENVOY_LOG(debug, "MetaProtocol decoder: {} bytes available", data.length());
   buffer_underflow = false;
 
-  // Start to decode a message
-  if (!decode_started_) {
-    start();
-  }
-  ASSERT(state_machine_ != nullptr);
-
   ENVOY_LOG(debug, "MetaProtocol decoder: state {}, {} bytes available",
-            ProtocolStateNameValues::name(state_machine_->currentState()), data.length());
+            ProtocolStateNameValues::name(state_machine_.currentState()), data.length());
 
-  ProtocolState state = state_machine_->run(data);
+  ProtocolState state = state_machine_.run(data);
   switch (state) {
   case ProtocolState::WaitForData:
     ENVOY_LOG(debug, "MetaProtocol decoder: wait for data");
@@ -72,21 +73,12 @@ FilterStatus DecoderBase::onData(Buffer::Instance& data, bool& buffer_underflow)
   return FilterStatus::Continue;
 }
 
-/**
- * Start to decode a message
- */
-void DecoderBase::start() {
-  state_machine_ = std::make_unique<DecoderStateMachine>(codec_, *this);
-  decode_started_ = true;
-}
-
 /**
  * Finishing decoding a message
  */
 void DecoderBase::complete() {
   state_machine_.reset();
   stream_.reset();
-  decode_started_ = false;
 }
 
 void DecoderBase::reset() { complete(); }
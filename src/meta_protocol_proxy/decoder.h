@@ -7,6 +7,8 @@
 #include "src/meta_protocol_proxy/codec/codec.h"
 #include "src/meta_protocol_proxy/decoder_event_handler.h"
 
+#include "absl/types/optional.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace NetworkFilters {
@@ -88,16 +90,22 @@ public:
    */
   ProtocolState currentState() const { return state_; }
 
+  /**
+   * Reset the state machine to decode the next message.
+   */
+  void reset();
+
 private:
   ProtocolState onDecodeStream(Buffer::Instance& buffer);
 
   Codec& codec_;
   Delegate& delegate_;
   ProtocolState state_;
+  // The metadata of the message being decoded, it's allocated once per message and kept while the
+  // codec waits for more data.
+  MetadataSharedPtr metadata_;
 };
 
-using DecoderStateMachinePtr = std::unique_ptr<DecoderStateMachine>;
-
 class DecoderBase : public DecoderStateMachine::Delegate,
                     public Logger::Loggable<Logger::Id::filter> {
 public:
@@ -117,14 +125,12 @@ public:
   void reset();
 
 protected:
-  void start();
   void complete();
 
   Codec& codec_;
-  ActiveStreamPtr stream_;
-  DecoderStateMachinePtr state_machine_;
-
-  bool decode_started_{false};
+  // The stream and the state machine are reused by the messages of the connection.
+  absl::optional<ActiveStream> stream_;
+  DecoderStateMachine state_machine_;
 };
 
 /**
@@ -137,9 +143,9 @@ public:
 
   ActiveStream* newStream(MetadataSharedPtr metadata,
                           MutationSharedPtr mutation) override {
-    ASSERT(!stream_);
-    stream_ = std::make_unique<ActiveStream>(callbacks_.newStream(), metadata, mutation);
-    return stream_.get();
+    ASSERT(!stream_.has_value());
+    stream_.emplace(callbacks_.newStream(), metadata, mutation);
+    return &stream_.value();
   }
 
   void onHeartbeat(MetadataSharedPtr metadata) override {
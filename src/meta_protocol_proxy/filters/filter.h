@@ -7,6 +7,7 @@
 #include "envoy/common/pure.h"
 #include "envoy/network/connection.h"
 #include "envoy/stream_info/stream_info.h"
+#include "envoy/tracing/http_tracer.h"
 #include "src/meta_protocol_proxy/codec/codec.h"
 
 #include "src/meta_protocol_proxy/decoder_event_handler.h"
@@ -18,7 +19,7 @@ namespace NetworkFilters {
 namespace MetaProtocolProxy {
 
 enum class UpstreamResponseStatus : uint8_t {
-  MoreData = 0, // The upstream response requires more data.
+  MoreData = 0, // The upstream response requires more data, e.g. the body of a streamed response.
   Complete = 1, // The upstream response is complete.
   Reset = 2,    // The upstream response is invalid and its connection must be reset.
   Retry = 3,    // The upstream response is failure need to retry.
@@ -53,6 +54,41 @@ public:
 
 using DirectResponsePtr = std::unique_ptr<DirectResponse>;
 
+/**
+ * StreamedBodyHandler receives the rest of a streamed request as it arrives, see
+ * Metadata::getStreamedBytes().
+ */
+class StreamedBodyHandler {
+public:
+  virtual ~StreamedBodyHandler() = default;
+
+  /**
+   * Called with the next bytes of the request.
+   * @param data the bytes, which are drained by the handler.
+   * @param end_stream whether these are the last bytes of the request.
+   */
+  virtual void onStreamedBody(Buffer::Instance& data, bool end_stream) PURE;
+};
+
+/**
+ * DownstreamWatermarkCallbacks are notified when the downstream connection of a streamed response
+ * can't take more data, and when it can take data again.
+ */
+class DownstreamWatermarkCallbacks {
+public:
+  virtual ~DownstreamWatermarkCallbacks() = default;
+
+  /**
+   * Called when the response should stop being read from the upstream.
+   */
+  virtual void onDownstreamAboveWriteBufferHighWatermark() PURE;
+
+  /**
+   * Called when the response can be read from the upstream again.
+   */
+  virtual void onDownstreamBelowWriteBufferLowWatermark() PURE;
+};
+
 /**
  * Decoder filter callbacks add additional callbacks.
  */
@@ -85,6 +121,11 @@ public:
    */
   virtual StreamInfo::StreamInfo& streamInfo() PURE;
 
+  /**
+   * @return Tracing::Span* the server span of the request, or nullptr if it isn't traced.
+   */
+  virtual Tracing::Span* activeSpan() PURE;
+
   /**
    * @return Event::Dispatcher& the thread local dispatcher for allocating timers, etc.
    */
@@ -119,19 +160,69 @@ public:
   virtual void sendLocalReply(const DirectResponse& response, bool end_stream) PURE;
 
   /**
-   * Indicates the start of an upstream response. May only be called once.
-   * @param transport_type TransportType the upstream is using
-   * @param protocol_type ProtocolType the upstream is using
+   * Called with a decoded upstream response. The upstream responses are decoded by the
+   * demultiplexer attached to the upstream connection, which matches them with their requests.
+   * @param metadata the metadata of the decoded response
+   * @param mutation the mutation of the decoded response
+   * @return UpstreamResponseStatus indicating if the upstream response is complete, or if an error
+   * occurred requiring the upstream response to be discarded.
+   */
+  virtual UpstreamResponseStatus upstreamResponse(MetadataSharedPtr metadata,
+                                                  MutationSharedPtr mutation) PURE;
+
+  /**
+   * Called when the upstream response can't be decoded. A local reply is sent to the downstream
+   * and the current stream is released.
+   * @param what the decoding error
+   */
+  virtual void upstreamResponseError(const std::string& what) PURE;
+
+  /**
+   * Called with the next bytes of a streamed upstream response, whose head has been forwarded by
+   * upstreamResponse() returning UpstreamResponseStatus::MoreData. The current stream is released
+   * once the last bytes are forwarded.
+   * @param data the bytes, which are drained
+   * @param end_stream whether these are the last bytes of the response
+   */
+  virtual void forwardResponseBody(Buffer::Instance& data, bool end_stream) PURE;
+
+  /**
+   * Set the callbacks notified of the write buffer watermarks of the downstream connection while a
+   * response is streamed. The high watermark is notified at once if the response can't be written
+   * yet, e.g. while the response of another request is streamed to the downstream.
+   * @param callbacks the callbacks, or nullptr once the response has ended
+   */
+  virtual void setDownstreamWatermarkCallbacks(DownstreamWatermarkCallbacks* callbacks) PURE;
+
+  /**
+   * @return CodecPtr a new codec of the application protocol of the downstream connection.
+   */
+  virtual CodecPtr createCodec() PURE;
+
+  /**
+   * @return uint64_t the hash of the codec configuration of the downstream connection, the codecs
+   * created by createCodec() for the same hash decode the messages alike.
+   */
+  virtual uint64_t codecHash() PURE;
+
+  /**
+   * Encodes the request with the mutation via the codec of the downstream connection.
+   * @param metadata the metadata of the request, its original message may be moved into the buffer
+   * @param mutation the mutation to be encoded into the request
+   * @param buffer the buffer into which the request is encoded, it's left empty if the codec
+   * doesn't encode the request
    */
-  virtual void startUpstreamResponse() PURE;
+  virtual void encodeRequest(Metadata& metadata, const Mutation& mutation,
+                             Buffer::Instance& buffer) PURE;
 
   /**
-   * Called with upstream response data.
-   * @param data supplies the upstream's data
-   * @return UpstreamResponseStatus indicating if the upstream response requires more data, is
-   * complete, or if an error occurred requiring the upstream connection to be reset.
+   * Set the handler of the rest of a streamed request. The bytes are held by the downstream
+   * connection while there's no handler, and the connection stops reading once they reach its
+   * buffer limit. The bytes which arrive after the stream is released are discarded.
+   * @param handler the handler, or nullptr to pause the streaming, e.g. while the upstream
+   * connection is above its write buffer high watermark.
    */
-  virtual UpstreamResponseStatus upstreamData(Buffer::Instance& data) PURE;
+  virtual void setStreamedBodyHandler(StreamedBodyHandler* handler) PURE;
 
   /**
    * Reset the downstream connection.
@@ -1,6 +1,9 @@
 #include "src/meta_protocol_proxy/filters/router/config.h"
 
 #include "envoy/registry/registry.h"
+#include "envoy/thread_local/thread_local.h"
+
+#include "source/common/protobuf/utility.h"
 
 #include "src/meta_protocol_proxy/filters/router/router_impl.h"
 
@@ -11,10 +14,49 @@ namespace MetaProtocolProxy {
 namespace Router {
 
 FilterFactoryCb RouterFilterConfig::createFilterFactoryFromProtoTyped(
-    const envoy::extensions::filters::meta_protocol_proxy::router::v1alpha::Router&,
-    const std::string&, Server::Configuration::FactoryContext& context) {
-  return [&context](FilterChainFactoryCallbacks& callbacks) -> void {
-    callbacks.addFilter(std::make_shared<Router>(context.clusterManager()));
+    const envoy::extensions::filters::meta_protocol_proxy::router::v1alpha::Router& proto_config,
+    const std::string& stat_prefix, Server::Configuration::FactoryContext& context) {
+  auto stats =
+      std::make_shared<RouterStats>(RouterStats::generateStats(stat_prefix, context.scope()));
+
+  // The upstream request timeouts of a worker share one timer.
+  std::shared_ptr<ThreadLocal::Slot> timeouts = context.threadLocal().allocateSlot();
+  timeouts->set([](Event::Dispatcher& dispatcher) -> ThreadLocal::ThreadLocalObjectSharedPtr {
+    return std::make_shared<RequestTimeoutManager>(dispatcher);
+  });
+
+  const uint32_t response_streaming_threshold =
+      PROTOBUF_GET_WRAPPED_OR_DEFAULT(proto_config, response_streaming_threshold_bytes, 0);
+
+  ScopedStatsSharedPtr scoped_stats;
+  if (ScopedStats::enabled(proto_config.scoped_stats())) {
+    scoped_stats = std::make_shared<ScopedStats>(proto_config.scoped_stats(), stat_prefix,
+                                                 context.scope(), context.threadLocal());
+  }
+
+  if (!proto_config.has_multiplexing()) {
+    return [stats, timeouts, response_streaming_threshold, scoped_stats,
+            &context](FilterChainFactoryCallbacks& callbacks) -> void {
+      callbacks.addFilter(std::make_shared<Router>(
+          context.clusterManager(), *stats, timeouts->getTyped<RequestTimeoutManager>(), nullptr,
+          response_streaming_threshold, scoped_stats.get()));
+    };
+  }
+
+  // The multiplexed connections are shared by all the downstream connections of a worker.
+  std::shared_ptr<ThreadLocal::Slot> tls = context.threadLocal().allocateSlot();
+  const auto multiplexing = proto_config.multiplexing();
+  tls->set(
+      [multiplexing](Event::Dispatcher& dispatcher) -> ThreadLocal::ThreadLocalObjectSharedPtr {
+        return std::make_shared<MultiplexedConnectionManager>(multiplexing, dispatcher);
+      });
+
+  return [stats, timeouts, tls, response_streaming_threshold, scoped_stats,
+          &context](FilterChainFactoryCallbacks& callbacks) -> void {
+    callbacks.addFilter(std::make_shared<Router>(
+        context.clusterManager(), *stats, timeouts->getTyped<RequestTimeoutManager>(),
+        &tls->getTyped<MultiplexedConnectionManager>(), response_streaming_threshold,
+        scoped_stats.get()));
   };
 }
 
@@ -0,0 +1,345 @@
+#include "src/meta_protocol_proxy/filters/router/multiplexed_connection.h"
+
+#include <algorithm>
+
+#include "envoy/common/exception.h"
+
+#include "source/common/protobuf/utility.h"
+
+#include "absl/container/inlined_vector.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace Router {
+
+constexpr uint32_t DefaultMaxConnectionsPerHost = 1;
+constexpr uint32_t DefaultMaxRequestsPerConnection = 1024;
+constexpr uint64_t MaxUpstreamId = 0x7fffffff;
+
+// class MultiplexedConnection
+MultiplexedConnection::MultiplexedConnection(MultiplexedConnectionManager& parent,
+                                             Upstream::TcpPoolData& pool_data,
+                                             Upstream::HostDescriptionConstSharedPtr host,
+                                             CodecPtr&& codec, uint64_t codec_hash,
+                                             uint32_t max_requests)
+    : parent_(parent), conn_pool_data_(pool_data), host_(host), codec_(std::move(codec)),
+      codec_hash_(codec_hash), max_requests_(max_requests) {}
+
+MultiplexedConnection::~MultiplexedConnection() {
+  closed_ = true;
+  pending_requests_.clear();
+
+  if (conn_pool_handle_ != nullptr) {
+    conn_pool_handle_->cancel(Tcp::ConnectionPool::CancelPolicy::Default);
+    conn_pool_handle_ = nullptr;
+  }
+
+  // The connection still has requests in flight, it can't be returned to the pool.
+  if (conn_data_ != nullptr &&
+      conn_data_->connection().state() == Network::Connection::State::Open) {
+    demux_->takeHandlers();
+    conn_data_->connection().close(Network::ConnectionCloseType::NoFlush);
+  }
+}
+
+uint64_t MultiplexedConnection::nextUpstreamId() {
+  // There are fewer requests on the connection than IDs, so a free ID is always found.
+  uint64_t id;
+  do {
+    id = next_upstream_id_++ & MaxUpstreamId;
+  } while (!idAvailable(id));
+  return id;
+}
+
+bool MultiplexedConnection::addRequest(MultiplexedRequest& request) {
+  if (!canAccept()) {
+    return false;
+  }
+
+  uint64_t upstream_id = nextUpstreamId();
+  if (!request.rewriteRequestId(demux_ != nullptr ? demux_->codec() : *codec_, upstream_id)) {
+    upstream_id = request.requestId();
+    if (!idAvailable(upstream_id)) {
+      return false;
+    }
+  }
+  request.onConnectionAssigned(*this, upstream_id);
+
+  if (conn_data_ != nullptr) {
+    demux_->add(upstream_id, request.requestId(), request);
+    request.onConnectionReady(*this, host_);
+    return true;
+  }
+
+  pending_requests_[upstream_id] = &request;
+  if (conn_pool_handle_ == nullptr) {
+    // This is the first request of the connection, the pool may invoke onPoolReady() or
+    // onPoolFailure() synchronously.
+    Tcp::ConnectionPool::Cancellable* handle = conn_pool_data_.newConnection(*this);
+    if (handle != nullptr) {
+      conn_pool_handle_ = handle;
+    }
+  }
+  return true;
+}
+
+void MultiplexedConnection::removeRequest(MultiplexedRequest& request, uint64_t upstream_id) {
+  auto it = pending_requests_.find(upstream_id);
+  if (it == pending_requests_.end() || it->second != &request) {
+    if (demux_ != nullptr) {
+      // The request has been sent, reserve its ID until the response arrives.
+      demux_->remove(upstream_id, request, true);
+      if (!draining_ && demux_->reserved() >= max_requests_) {
+        ENVOY_LOG(debug,
+                  "meta protocol multiplexed connection: {} late responses from {}, drain the "
+                  "connection",
+                  demux_->reserved(), host_->address()->asString());
+        draining_ = true;
+      }
+      if (!dispatching_) {
+        releaseIfIdle();
+      }
+    }
+    return;
+  }
+
+  pending_requests_.erase(it);
+  if (pending_requests_.empty() && conn_pool_handle_ != nullptr) {
+    ENVOY_LOG(debug, "meta protocol multiplexed connection: no pending request, cancel connecting "
+                     "to {}",
+              host_->address()->asString());
+    conn_pool_handle_->cancel(Tcp::ConnectionPool::CancelPolicy::Default);
+    conn_pool_handle_ = nullptr;
+    remove();
+  }
+}
+
+void MultiplexedConnection::write(MultiplexedRequest& request, uint64_t upstream_id,
+                                  Buffer::Instance& data, bool oneway) {
+  ASSERT(conn_data_ != nullptr);
+  ENVOY_LOG(trace, "meta protocol multiplexed connection: proxying {} bytes to {}", data.length(),
+            host_->address()->asString());
+  conn_data_->connection().write(data, false);
+
+  if (oneway) {
+    demux_->remove(upstream_id, request, false);
+    if (!dispatching_) {
+      releaseIfIdle();
+    }
+  }
+}
+
+void MultiplexedConnection::onPoolFailure(ConnectionPool::PoolFailureReason reason,
+                                          absl::string_view,
+                                          Upstream::HostDescriptionConstSharedPtr host) {
+  ENVOY_LOG(debug, "meta protocol multiplexed connection: failed to connect to {}",
+            host->address()->asString());
+  conn_pool_handle_ = nullptr;
+
+  if (reason == ConnectionPool::PoolFailureReason::Timeout) {
+    host->outlierDetector().putResult(Upstream::Outlier::Result::LocalOriginTimeout);
+  } else if (reason == ConnectionPool::PoolFailureReason::RemoteConnectionFailure) {
+    host->outlierDetector().putResult(Upstream::Outlier::Result::LocalOriginConnectFailed);
+  }
+
+  remove();
+  auto requests = std::move(pending_requests_);
+  pending_requests_.clear();
+  for (const auto& entry : requests) {
+    entry.second->onConnectionFailure(reason, host);
+  }
+}
+
+void MultiplexedConnection::onPoolReady(Tcp::ConnectionPool::ConnectionDataPtr&& conn_data,
+                                        Upstream::HostDescriptionConstSharedPtr host) {
+  ENVOY_LOG(debug, "meta protocol multiplexed connection: connected to {}",
+            host->address()->asString());
+  host->outlierDetector().putResult(Upstream::Outlier::Result::LocalOriginConnectSuccess);
+
+  conn_pool_handle_ = nullptr;
+  conn_data_ = std::move(conn_data);
+  conn_data_->addUpstreamCallbacks(*this);
+  demux_ = &ResponseDemultiplexer::attach(*conn_data_, codec_hash_,
+                                          [this]() { return std::move(codec_); });
+  ASSERT(demux_->idle());
+  // A streamed response would hold up the responses of the other requests on the connection.
+  demux_->setStreamingThreshold(0);
+
+  auto requests = std::move(pending_requests_);
+  pending_requests_.clear();
+  for (const auto& entry : requests) {
+    demux_->add(entry.first, entry.second->requestId(), *entry.second);
+  }
+
+  // The notified requests may remove other requests or even close the connection, so check that
+  // each request is still in flight before notifying it.
+  dispatching_ = true;
+  for (const auto& entry : requests) {
+    if (demux_->handler(entry.first) == entry.second) {
+      entry.second->onConnectionReady(*this, host_);
+    }
+  }
+  dispatching_ = false;
+
+  releaseIfIdle();
+}
+
+void MultiplexedConnection::onUpstreamData(Buffer::Instance& data, bool) {
+  ENVOY_LOG(trace, "meta protocol multiplexed connection: reading response from {}: {} bytes",
+            host_->address()->asString(), data.length());
+
+  dispatching_ = true;
+  try {
+    demux_->onData(data, conn_data_->connection());
+  } catch (const EnvoyException& ex) {
+    ENVOY_LOG(error, "meta protocol multiplexed connection: bad response from {}: {}",
+              host_->address()->asString(), ex.what());
+    dispatching_ = false;
+
+    auto handlers = demux_->takeHandlers();
+    conn_data_->connection().close(Network::ConnectionCloseType::NoFlush);
+    for (ResponseHandler* handler : handlers) {
+      handler->onResponseError(ex.what());
+    }
+    return;
+  }
+  dispatching_ = false;
+
+  releaseIfIdle();
+}
+
+void MultiplexedConnection::onEvent(Network::ConnectionEvent event) {
+  if (event == Network::ConnectionEvent::Connected) {
+    // Connected is consumed by the connection pool.
+    return;
+  }
+
+  ENVOY_LOG(debug, "meta protocol multiplexed connection: connection to {} closed with {} requests",
+            host_->address()->asString(), activeRequests());
+  if (event == Network::ConnectionEvent::RemoteClose && activeRequests() > 0) {
+    host_->outlierDetector().putResult(Upstream::Outlier::Result::LocalOriginConnectFailed);
+  }
+
+  remove();
+  for (ResponseHandler* handler : demux_->takeHandlers()) {
+    handler->onConnectionClose(event);
+  }
+}
+
+void MultiplexedConnection::releaseIfIdle() {
+  if (closed_ || conn_data_ == nullptr || !pending_requests_.empty()) {
+    return;
+  }
+
+  if (draining_ && demux_->size() == 0) {
+    // The late responses are no longer waited for, closing the connection frees their IDs.
+    ENVOY_LOG(debug, "meta protocol multiplexed connection: close the drained connection to {}",
+              host_->address()->asString());
+    remove();
+    demux_->takeHandlers();
+    conn_data_->connection().close(Network::ConnectionCloseType::NoFlush);
+    return;
+  }
+
+  if (!demux_->idle()) {
+    return;
+  }
+
+  ENVOY_LOG(debug, "meta protocol multiplexed connection: release the idle connection to {}",
+            host_->address()->asString());
+  demux_ = nullptr;
+  conn_data_.reset();
+  remove();
+}
+
+void MultiplexedConnection::remove() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  parent_.removeConnection(*this);
+}
+
+// class MultiplexedConnectionManager
+MultiplexedConnectionManager::MultiplexedConnectionManager(
+    const envoy::extensions::filters::meta_protocol_proxy::router::v1alpha::Multiplexing& config,
+    Event::Dispatcher& dispatcher)
+    : dispatcher_(dispatcher),
+      max_connections_per_host_(PROTOBUF_GET_WRAPPED_OR_DEFAULT(config, max_connections_per_host,
+                                                                DefaultMaxConnectionsPerHost)),
+      max_requests_per_connection_(PROTOBUF_GET_WRAPPED_OR_DEFAULT(
+          config, max_requests_per_connection, DefaultMaxRequestsPerConnection)) {}
+
+void MultiplexedConnectionManager::addRequest(Upstream::TcpPoolData& pool_data,
+                                              DecoderFilterCallbacks& callbacks,
+                                              MultiplexedRequest& request) {
+  Upstream::HostDescriptionConstSharedPtr host = pool_data.host();
+  ConnectionList& connections = connections_[host.get()];
+
+  // The least loaded connections are tried first.
+  absl::InlinedVector<MultiplexedConnection*, 4> candidates;
+  for (const auto& connection : connections) {
+    if (connection->canAccept()) {
+      candidates.push_back(connection.get());
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const MultiplexedConnection* a, const MultiplexedConnection* b) {
+              return a->activeRequests() < b->activeRequests();
+            });
+
+  // Spread the requests over up to max_connections_per_host_ connections, an idle connection is
+  // used before a new one is created.
+  const auto open_connections =
+      std::count_if(connections.begin(), connections.end(),
+                    [](const MultiplexedConnectionPtr& connection) {
+                      return !connection->draining();
+                    });
+  const bool can_create = static_cast<uint32_t>(open_connections) < max_connections_per_host_;
+  if (!can_create || (!candidates.empty() && candidates.front()->activeRequests() == 0)) {
+    for (MultiplexedConnection* connection : candidates) {
+      if (connection->addRequest(request)) {
+        return;
+      }
+    }
+  }
+
+  if (can_create) {
+    ENVOY_LOG(debug, "meta protocol multiplexed connection: new connection to {}, {} existing",
+              host->address()->asString(), connections.size());
+    LinkedList::moveIntoList(
+        std::make_unique<MultiplexedConnection>(*this, pool_data, host, callbacks.createCodec(),
+                                                callbacks.codecHash(),
+                                                max_requests_per_connection_),
+        connections);
+    // A new connection has no request, so it accepts the request with any ID.
+    const bool added = connections.front()->addRequest(request);
+    ASSERT(added);
+    return;
+  }
+
+  ENVOY_LOG(debug,
+            "meta protocol multiplexed connection: no connection to {} can accept the request, "
+            "{} connections",
+            host->address()->asString(), connections.size());
+  host->cluster().stats().upstream_rq_pending_overflow_.inc();
+  request.onConnectionFailure(ConnectionPool::PoolFailureReason::Overflow, host);
+}
+
+void MultiplexedConnectionManager::removeConnection(MultiplexedConnection& connection) {
+  auto it = connections_.find(connection.host().get());
+  ASSERT(it != connections_.end());
+
+  dispatcher_.deferredDelete(connection.removeFromList(it->second));
+  if (it->second.empty()) {
+    connections_.erase(it);
+  }
+}
+
+} // namespace Router
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
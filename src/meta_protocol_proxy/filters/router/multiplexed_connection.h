@@ -0,0 +1,253 @@
+#pragma once
+
+#include <list>
+#include <memory>
+
+#include "envoy/event/deferred_deletable.h"
+#include "envoy/event/dispatcher.h"
+#include "envoy/tcp/conn_pool.h"
+#include "envoy/thread_local/thread_local.h"
+#include "envoy/upstream/thread_local_cluster.h"
+
+#include "source/common/buffer/buffer_impl.h"
+#include "source/common/common/linked_object.h"
+#include "source/common/common/logger.h"
+
+#include "api/router/v1alpha/router.pb.h"
+#include "src/meta_protocol_proxy/codec/codec.h"
+#include "src/meta_protocol_proxy/filters/filter.h"
+#include "src/meta_protocol_proxy/filters/router/response_demultiplexer.h"
+
+#include "absl/container/flat_hash_map.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace Router {
+
+class MultiplexedConnection;
+class MultiplexedConnectionManager;
+
+/**
+ * MultiplexedRequest is implemented by an upstream request which is sent over a multiplexed
+ * connection. All the callbacks may be invoked synchronously from
+ * MultiplexedConnectionManager::addRequest().
+ */
+class MultiplexedRequest : public ResponseHandler {
+public:
+  ~MultiplexedRequest() override = default;
+
+  /**
+   * @return uint64_t the ID of the request, which is given back to its response.
+   */
+  virtual uint64_t requestId() const PURE;
+
+  /**
+   * Rewrites the request ID of the encoded request, so that it's unique on the connection.
+   * @param codec the codec of the connection
+   * @param upstream_id the request ID the request is sent with
+   * @return bool whether the ID has been rewritten, the request is sent with its own ID if not.
+   */
+  virtual bool rewriteRequestId(Codec& codec, uint64_t upstream_id) PURE;
+
+  /**
+   * Called when the request has been added to a connection, before any other callback.
+   * @param connection the connection the request has been added to
+   * @param upstream_id the request ID the request is sent with, which identifies the request on
+   * the connection.
+   */
+  virtual void onConnectionAssigned(MultiplexedConnection& connection, uint64_t upstream_id) PURE;
+
+  /**
+   * Called when the connection is ready for the request to be sent.
+   * @param connection the connection the request should be written to
+   * @param host the upstream host of the connection
+   */
+  virtual void onConnectionReady(MultiplexedConnection& connection,
+                                 Upstream::HostDescriptionConstSharedPtr host) PURE;
+
+  /**
+   * Called when the connection could not be established. The request has been removed from the
+   * connection.
+   * @param reason the reason of the failure
+   * @param host the upstream host of the connection
+   */
+  virtual void onConnectionFailure(ConnectionPool::PoolFailureReason reason,
+                                   Upstream::HostDescriptionConstSharedPtr host) PURE;
+};
+
+/**
+ * MultiplexedConnection is an upstream connection shared by the requests from all the downstream
+ * connections of a worker thread. The responses are dispatched to their requests by the
+ * ResponseDemultiplexer attached to the connection.
+ *
+ * The underlying connection is taken from the cluster's TCP connection pool when the first
+ * request is added, and is returned to the pool once there's no request in flight, so the pool
+ * still governs the connection lifetime, e.g. draining and circuit breaking.
+ */
+class MultiplexedConnection : public Tcp::ConnectionPool::Callbacks,
+                              public Tcp::ConnectionPool::UpstreamCallbacks,
+                              public Event::DeferredDeletable,
+                              public LinkedObject<MultiplexedConnection>,
+                              Logger::Loggable<Logger::Id::filter> {
+public:
+  MultiplexedConnection(MultiplexedConnectionManager& parent, Upstream::TcpPoolData& pool_data,
+                        Upstream::HostDescriptionConstSharedPtr host, CodecPtr&& codec,
+                        uint64_t codec_hash, uint32_t max_requests);
+  ~MultiplexedConnection() override;
+
+  /**
+   * @return bool whether this connection is open and has room for another request.
+   */
+  bool canAccept() const { return !closed_ && !draining_ && activeRequests() < max_requests_; }
+
+  /**
+   * @return bool whether this connection takes no more requests and is closed once the requests in
+   * flight have completed, see removeRequest().
+   */
+  bool draining() const { return draining_; }
+
+  /**
+   * Adds a request to this connection. The request is given an upstream request ID which isn't
+   * used by the other requests on the connection, or keeps its own ID if the codec can't rewrite
+   * it. The request is notified by onConnectionAssigned(), then by onConnectionReady() once the
+   * connection is ready, which happens synchronously if the connection has been established.
+   * @return bool false if the connection is full, or the request keeps its own ID and the ID is
+   * used by another request on the connection, in which case the request isn't notified.
+   */
+  bool addRequest(MultiplexedRequest& request);
+
+  /**
+   * Removes a request from this connection, e.g. when its downstream request has been reset. The
+   * ID of a request which has been sent stays reserved until its response arrives, it isn't
+   * counted as an active request. Once as many IDs are reserved as the connection takes requests,
+   * e.g. because the upstream doesn't answer the requests which time out, the connection is
+   * drained and closed, which frees the reserved IDs.
+   * @param request the request
+   * @param upstream_id the request ID the request is sent with
+   */
+  void removeRequest(MultiplexedRequest& request, uint64_t upstream_id);
+
+  /**
+   * Writes an encoded request to the upstream.
+   * @param request the request being sent
+   * @param upstream_id the request ID the request is sent with
+   * @param data the encoded request
+   * @param oneway whether the request expects no response, a oneway request is removed from the
+   * connection once it has been written.
+   */
+  void write(MultiplexedRequest& request, uint64_t upstream_id, Buffer::Instance& data,
+             bool oneway);
+
+  /**
+   * @return size_t the number of requests waiting for the connection or in flight, the reserved
+   * request IDs aren't counted.
+   */
+  size_t activeRequests() const {
+    return pending_requests_.size() + (demux_ != nullptr ? demux_->size() : 0);
+  }
+  const Upstream::HostDescriptionConstSharedPtr& host() const { return host_; }
+
+  // Tcp::ConnectionPool::Callbacks
+  void onPoolFailure(ConnectionPool::PoolFailureReason reason,
+                     absl::string_view transport_failure_reason,
+                     Upstream::HostDescriptionConstSharedPtr host) override;
+  void onPoolReady(Tcp::ConnectionPool::ConnectionDataPtr&& conn_data,
+                   Upstream::HostDescriptionConstSharedPtr host) override;
+
+  // Tcp::ConnectionPool::UpstreamCallbacks
+  void onUpstreamData(Buffer::Instance& data, bool end_stream) override;
+  void onEvent(Network::ConnectionEvent event) override;
+  void onAboveWriteBufferHighWatermark() override {}
+  void onBelowWriteBufferLowWatermark() override {}
+
+private:
+  bool idAvailable(uint64_t id) const {
+    return !pending_requests_.contains(id) && (demux_ == nullptr || !demux_->contains(id));
+  }
+  // Returns the next upstream request ID which isn't used on this connection.
+  uint64_t nextUpstreamId();
+  void releaseIfIdle();
+  void remove();
+
+  MultiplexedConnectionManager& parent_;
+  Upstream::TcpPoolData conn_pool_data_;
+  Upstream::HostDescriptionConstSharedPtr host_;
+  // The codec of the demultiplexer, in case the pooled connection has none of the same codec
+  // configuration attached.
+  CodecPtr codec_;
+  const uint64_t codec_hash_;
+  const uint32_t max_requests_;
+
+  Tcp::ConnectionPool::Cancellable* conn_pool_handle_{};
+  Tcp::ConnectionPool::ConnectionDataPtr conn_data_;
+  ResponseDemultiplexer* demux_{};
+
+  // The requests waiting for the connection to be established, keyed by upstream request ID. Once
+  // the connection is ready they are moved to the demultiplexer. A request which has been sent but
+  // reset before its response arrives keeps its ID reserved in the demultiplexer, so that the
+  // late response is discarded instead of being mismatched.
+  absl::flat_hash_map<uint64_t, MultiplexedRequest*> pending_requests_;
+  // The upstream request IDs are allocated in sequence, they're kept below 2^31 so that they
+  // fit the request IDs of all the codecs, e.g. the int32 sequence IDs of Thrift.
+  uint64_t next_upstream_id_{0};
+
+  // Whether this connection has been closed or removed from its manager.
+  bool closed_{false};
+  // Whether this connection has too many reserved request IDs and is closed once idle.
+  bool draining_{false};
+  // Whether the requests are being notified or the responses are being dispatched, the connection
+  // is only released at the end of the iteration.
+  bool dispatching_{false};
+};
+
+using MultiplexedConnectionPtr = std::unique_ptr<MultiplexedConnection>;
+
+/**
+ * MultiplexedConnectionManager holds the multiplexed connections of a worker thread keyed by
+ * upstream host.
+ */
+class MultiplexedConnectionManager : public ThreadLocal::ThreadLocalObject,
+                                     Logger::Loggable<Logger::Id::filter> {
+public:
+  MultiplexedConnectionManager(
+      const envoy::extensions::filters::meta_protocol_proxy::router::v1alpha::Multiplexing& config,
+      Event::Dispatcher& dispatcher);
+  ~MultiplexedConnectionManager() override = default;
+
+  /**
+   * Adds a request to a connection to the host of the given connection pool. The requests are
+   * spread over up to max_connections_per_host connections, a new connection is created if the
+   * existing connections are busy and the limit hasn't been reached. The draining connections
+   * aren't counted against the limit. If no connection can accept
+   * the request, it's rejected by onConnectionFailure() with an overflow and counted as a pending
+   * overflow of the cluster.
+   * @param pool_data the connection pool of the host selected by the load balancer
+   * @param callbacks the callbacks of the request, used to create a codec for a new connection
+   * @param request the request
+   */
+  void addRequest(Upstream::TcpPoolData& pool_data, DecoderFilterCallbacks& callbacks,
+                  MultiplexedRequest& request);
+
+  /**
+   * Removes a connection which is closed or idle, it's deleted in the next event loop iteration.
+   */
+  void removeConnection(MultiplexedConnection& connection);
+
+private:
+  using ConnectionList = std::list<MultiplexedConnectionPtr>;
+
+  Event::Dispatcher& dispatcher_;
+  const uint32_t max_connections_per_host_;
+  const uint32_t max_requests_per_connection_;
+
+  // The key is the host of the connections, the hosts are kept alive by their connections.
+  absl::flat_hash_map<const Upstream::HostDescription*, ConnectionList> connections_;
+};
+
+} // namespace Router
+} // namespace MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
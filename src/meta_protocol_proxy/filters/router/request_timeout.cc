@@ -0,0 +1,132 @@
+#include "src/meta_protocol_proxy/filters/router/request_timeout.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace Router {
+
+// class RequestTimeout
+void RequestTimeout::disarm() {
+  if (queue_ == nullptr) {
+    return;
+  }
+
+  if (prev_ != nullptr) {
+    prev_->next_ = next_;
+  } else {
+    queue_->head_ = next_;
+  }
+  if (next_ != nullptr) {
+    next_->prev_ = prev_;
+  } else {
+    queue_->tail_ = prev_;
+  }
+
+  // An empty queue is kept until the timer fires, the timer may fire early as a result.
+  queue_ = nullptr;
+  prev_ = nullptr;
+  next_ = nullptr;
+}
+
+// class RequestTimeoutManager
+RequestTimeoutManager::RequestTimeoutManager(Event::Dispatcher& dispatcher)
+    : dispatcher_(dispatcher), timer_(dispatcher.createTimer([this]() { onTimer(); })) {}
+
+RequestTimeoutManager::~RequestTimeoutManager() {
+  for (const auto& entry : queues_) {
+    while (entry.second->head_ != nullptr) {
+      entry.second->head_->disarm();
+    }
+  }
+}
+
+void RequestTimeoutManager::arm(RequestTimeout& request, std::chrono::milliseconds timeout) {
+  ASSERT(timeout.count() > 0);
+  request.disarm();
+
+  auto& queue = queues_[timeout.count()];
+  if (queue == nullptr) {
+    queue = std::make_unique<RequestTimeout::Queue>();
+    queue->timeout_ = timeout.count();
+  }
+
+  const MonotonicTime now = dispatcher_.timeSource().monotonicTime();
+  request.deadline_ = now + timeout;
+  request.queue_ = queue.get();
+  request.prev_ = queue->tail_;
+  if (queue->tail_ != nullptr) {
+    queue->tail_->next_ = &request;
+  } else {
+    queue->head_ = &request;
+  }
+  queue->tail_ = &request;
+
+  // The deadline is later than the deadlines of the timeouts already in the queue, so the queue
+  // only needs to be added to the heap if it isn't there yet.
+  if (!queue->scheduled_) {
+    schedule(*queue);
+    if (!scheduled_deadline_.has_value() || request.deadline_ < scheduled_deadline_.value()) {
+      scheduleTimer(now);
+    }
+  }
+}
+
+void RequestTimeoutManager::schedule(RequestTimeout::Queue& queue) {
+  ASSERT(queue.head_ != nullptr && !queue.scheduled_);
+  queue.scheduled_ = true;
+  heap_.emplace(queue.head_->deadline_, &queue);
+}
+
+void RequestTimeoutManager::onTimer() {
+  scheduled_deadline_.reset();
+  const MonotonicTime now = dispatcher_.timeSource().monotonicTime();
+
+  while (!heap_.empty() && heap_.top().first <= now) {
+    RequestTimeout::Queue& queue = *heap_.top().second;
+    heap_.pop();
+    queue.scheduled_ = false;
+
+    // The timeout callbacks may arm or disarm any timeout, including the ones of this queue, which
+    // is then added to the heap again by arm().
+    while (queue.head_ != nullptr && queue.head_->deadline_ <= now) {
+      RequestTimeout* expired = queue.head_;
+      expired->disarm();
+      expired->onRequestTimeout();
+    }
+    if (queue.scheduled_) {
+      continue;
+    }
+    if (queue.head_ != nullptr) {
+      schedule(queue);
+      continue;
+    }
+
+    // The empty queue is removed, another one is created by the next timeout of its duration.
+    queues_.erase(queue.timeout_);
+  }
+
+  scheduleTimer(now);
+}
+
+void RequestTimeoutManager::scheduleTimer(MonotonicTime now) {
+  if (heap_.empty()) {
+    timer_->disableTimer();
+    scheduled_deadline_.reset();
+    return;
+  }
+
+  // The timer has a millisecond resolution, round up so that the timeouts have expired when it
+  // fires.
+  const MonotonicTime deadline = heap_.top().first;
+  const auto delay = deadline > now ? std::chrono::ceil<std::chrono::milliseconds>(deadline - now)
+                                    : std::chrono::milliseconds(0);
+  timer_->enableTimer(delay);
+  scheduled_deadline_ = deadline;
+}
+
+} // namespace Router
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
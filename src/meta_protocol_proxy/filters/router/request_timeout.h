@@ -0,0 +1,116 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "envoy/common/time.h"
+#include "envoy/event/dispatcher.h"
+#include "envoy/event/timer.h"
+#include "envoy/thread_local/thread_local.h"
+
+#include "source/common/common/logger.h"
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/optional.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace Router {
+
+class RequestTimeoutManager;
+
+/**
+ * RequestTimeout is implemented by the router of a request, whose upstream request, including its
+ * retries, is timed out by a RequestTimeoutManager. It's disarmed when destroyed.
+ */
+class RequestTimeout {
+public:
+  virtual ~RequestTimeout() { disarm(); }
+
+  /**
+   * Called when the timeout expires, the timeout has been disarmed.
+   */
+  virtual void onRequestTimeout() PURE;
+
+  /**
+   * Cancels the timeout if it's armed.
+   */
+  void disarm();
+
+  bool armed() const { return queue_ != nullptr; }
+
+private:
+  friend class RequestTimeoutManager;
+
+  struct Queue {
+    // The timeout duration in milliseconds.
+    uint64_t timeout_{};
+    RequestTimeout* head_{};
+    RequestTimeout* tail_{};
+    // Whether the queue has an entry in the deadline heap of its manager.
+    bool scheduled_{false};
+  };
+
+  // The queue of the timeout duration, the timeouts in it are linked in deadline order.
+  Queue* queue_{};
+  RequestTimeout* prev_{};
+  RequestTimeout* next_{};
+  MonotonicTime deadline_;
+};
+
+/**
+ * RequestTimeoutManager times out the upstream requests of a worker thread with a single timer.
+ *
+ * The timeouts are kept in a FIFO queue per timeout duration. The requests with the same timeout
+ * expire in the order they are armed, so arming and disarming a timeout is a constant time list
+ * operation without allocation. The queues are ordered by the deadline of their first timeout in
+ * a heap, and the timer is enabled for the earliest one. There are as many queues as distinct
+ * timeout durations, which may be many when the timeouts of the requests are used, so a timeout
+ * costs a logarithmic heap operation in the number of queues at most, and the queues are never
+ * scanned.
+ */
+class RequestTimeoutManager : public ThreadLocal::ThreadLocalObject,
+                              Logger::Loggable<Logger::Id::filter> {
+public:
+  RequestTimeoutManager(Event::Dispatcher& dispatcher);
+  ~RequestTimeoutManager() override;
+
+  /**
+   * Arms the timeout, it's rearmed if it's armed already.
+   * @param request the timeout of the request
+   * @param timeout the timeout duration, must be greater than zero
+   */
+  void arm(RequestTimeout& request, std::chrono::milliseconds timeout);
+
+private:
+  using HeapEntry = std::pair<MonotonicTime, RequestTimeout::Queue*>;
+
+  void onTimer();
+  // Adds the queue to the heap with the deadline of its first timeout.
+  void schedule(RequestTimeout::Queue& queue);
+  void scheduleTimer(MonotonicTime now);
+
+  Event::Dispatcher& dispatcher_;
+  Event::TimerPtr timer_;
+  // The queues keyed by timeout duration in milliseconds, the queues are referred to by their
+  // timeouts so their addresses must be stable.
+  absl::flat_hash_map<uint64_t, std::unique_ptr<RequestTimeout::Queue>> queues_;
+  // A queue is in the heap once at most, with a deadline which isn't later than the deadline of its
+  // first timeout. The first timeout of a queue may have been disarmed, or the queue emptied, since
+  // it was added, in which case the entry expires early and the queue is added again or removed.
+  std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> heap_;
+  // The deadline the timer is enabled for, if it's enabled.
+  absl::optional<MonotonicTime> scheduled_deadline_;
+};
+
+} // namespace Router
+} // namespace MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
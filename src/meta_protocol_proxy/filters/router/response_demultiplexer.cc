@@ -0,0 +1,188 @@
+#include "src/meta_protocol_proxy/filters/router/response_demultiplexer.h"
+
+#include <algorithm>
+
+#include "envoy/common/exception.h"
+
+#include "source/common/common/fmt.h"
+
+#include "src/meta_protocol_proxy/heartbeat_response.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace Router {
+
+ResponseDemultiplexer::ResponseDemultiplexer(CodecPtr&& codec, uint64_t codec_hash)
+    : codec_(std::move(codec)), codec_hash_(codec_hash),
+      decoder_(std::make_unique<ResponseDecoder>(*codec_, *this)) {}
+
+ResponseDemultiplexer&
+ResponseDemultiplexer::attach(Tcp::ConnectionPool::ConnectionData& conn_data, uint64_t codec_hash,
+                              const std::function<CodecPtr()>& create_codec) {
+  ResponseDemultiplexer* demux = conn_data.connectionStateTyped<ResponseDemultiplexer>();
+  if (demux == nullptr || demux->codec_hash_ != codec_hash) {
+    // The connection has no request in flight, the demultiplexer of another codec configuration
+    // is simply replaced.
+    ASSERT(demux == nullptr || demux->idle());
+    conn_data.setConnectionState(
+        std::make_unique<ResponseDemultiplexer>(create_codec(), codec_hash));
+    demux = conn_data.connectionStateTyped<ResponseDemultiplexer>();
+  }
+  return *demux;
+}
+
+void ResponseDemultiplexer::add(uint64_t upstream_id, uint64_t request_id,
+                                ResponseHandler& handler) {
+  ASSERT(!contains(upstream_id));
+  handlers_[upstream_id] = RequestEntry{&handler, request_id};
+}
+
+void ResponseDemultiplexer::remove(uint64_t request_id, const ResponseHandler& handler,
+                                   bool reserve) {
+  if (streaming_handler_ == &handler) {
+    // The rest of the streamed response is discarded.
+    streaming_handler_ = nullptr;
+    return;
+  }
+
+  auto it = handlers_.find(request_id);
+  if (it == handlers_.end() || it->second.handler != &handler) {
+    return;
+  }
+
+  if (reserve) {
+    it->second.handler = nullptr;
+    reserved_++;
+  } else {
+    handlers_.erase(it);
+  }
+}
+
+ResponseHandler* ResponseDemultiplexer::handler(uint64_t request_id) const {
+  auto it = handlers_.find(request_id);
+  return it != handlers_.end() ? it->second.handler : nullptr;
+}
+
+std::vector<ResponseHandler*> ResponseDemultiplexer::takeHandlers() {
+  std::vector<ResponseHandler*> handlers;
+  handlers.reserve(handlers_.size() + 1);
+  if (streaming_handler_ != nullptr) {
+    handlers.push_back(streaming_handler_);
+    streaming_handler_ = nullptr;
+  }
+  for (const auto& entry : handlers_) {
+    if (entry.second.handler != nullptr) {
+      handlers.push_back(entry.second.handler);
+    }
+  }
+  handlers_.clear();
+  reserved_ = 0;
+  return handlers;
+}
+
+void ResponseDemultiplexer::onData(Buffer::Instance& data, Network::Connection& connection) {
+  ENVOY_LOG(debug, "meta protocol response: the received reply data length is {}", data.length());
+  buffer_.move(data);
+
+  connection_ = &connection;
+  try {
+    bool underflow = buffer_.length() == 0;
+    while (!underflow) {
+      // The rest of a streamed response precedes the next response on the connection.
+      if (streamed_bytes_ > 0) {
+        forwardStreamedBody();
+        underflow = buffer_.length() == 0;
+        continue;
+      }
+      // The heartbeats recognized by the codec are answered without being decoded.
+      if (codec_->respondHeartbeat(buffer_, heartbeat_response_)) {
+        if (connection.state() == Network::Connection::State::Open) {
+          connection.write(heartbeat_response_, false);
+        } else {
+          heartbeat_response_.drain(heartbeat_response_.length());
+        }
+        underflow = buffer_.length() == 0;
+        continue;
+      }
+      decoder_->onData(buffer_, underflow);
+    }
+  } catch (const EnvoyException&) {
+    // The rest of the stream can't be decoded, start over if the connection is ever reused.
+    connection_ = nullptr;
+    decoder_->reset();
+    buffer_.drain(buffer_.length());
+    streaming_handler_ = nullptr;
+    streamed_bytes_ = 0;
+    throw;
+  }
+  connection_ = nullptr;
+}
+
+void ResponseDemultiplexer::forwardStreamedBody() {
+  const uint64_t bytes = std::min(streamed_bytes_, buffer_.length());
+  streamed_bytes_ -= bytes;
+  if (streaming_handler_ == nullptr) {
+    buffer_.drain(bytes);
+    return;
+  }
+
+  Buffer::OwnedImpl chunk;
+  chunk.move(buffer_, bytes);
+  ResponseHandler* handler = streaming_handler_;
+  const bool end_stream = streamed_bytes_ == 0;
+  if (end_stream) {
+    streaming_handler_ = nullptr;
+  }
+  handler->onResponseBody(chunk, end_stream);
+}
+
+void ResponseDemultiplexer::onHeartbeat(MetadataSharedPtr metadata) {
+  if (connection_ == nullptr || connection_->state() != Network::Connection::State::Open) {
+    return;
+  }
+
+  // The upstream checks the liveness of the connection, reply to it as a downstream does.
+  HeartbeatResponse heartbeat;
+  Buffer::OwnedImpl response_buffer;
+  heartbeat.encode(*metadata, *codec_, response_buffer);
+  connection_->write(response_buffer, false);
+}
+
+void ResponseDemultiplexer::onStreamDecoded(MetadataSharedPtr metadata,
+                                            MutationSharedPtr mutation) {
+  auto it = handlers_.find(metadata->getRequestId());
+  if (it == handlers_.end()) {
+    throw EnvoyException(fmt::format("meta protocol response: no request in flight for response {}",
+                                     metadata->getRequestId()));
+  }
+
+  ResponseHandler* handler = it->second.handler;
+  const uint64_t request_id = it->second.request_id;
+  handlers_.erase(it);
+  if (metadata->getStreamedBytes() > 0) {
+    // The rest of the response follows it, it's discarded if the request has been reset.
+    streaming_handler_ = handler;
+    streamed_bytes_ = metadata->getStreamedBytes();
+  }
+  if (handler == nullptr) {
+    reserved_--;
+    ENVOY_LOG(debug, "meta protocol response: response {} of a reset request, discarded",
+              metadata->getRequestId());
+    return;
+  }
+
+  if (request_id != metadata->getRequestId()) {
+    // The request has been sent with another ID, give the response back the ID of the request.
+    codec_->rewriteRequestId(metadata->getOriginMessage(), request_id);
+    metadata->setRequestId(request_id);
+  }
+  handler->onResponse(metadata, mutation);
+}
+
+} // namespace Router
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
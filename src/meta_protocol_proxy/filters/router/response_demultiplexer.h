@@ -0,0 +1,201 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "envoy/network/connection.h"
+#include "envoy/tcp/conn_pool.h"
+
+#include "source/common/buffer/buffer_impl.h"
+#include "source/common/common/logger.h"
+
+#include "src/meta_protocol_proxy/codec/codec.h"
+#include "src/meta_protocol_proxy/decoder.h"
+#include "src/meta_protocol_proxy/decoder_event_handler.h"
+
+#include "absl/container/flat_hash_map.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace Router {
+
+/**
+ * ResponseHandler is implemented by a request in flight on an upstream connection.
+ */
+class ResponseHandler {
+public:
+  virtual ~ResponseHandler() = default;
+
+  /**
+   * Called when the response of the request has been decoded. The handler has been removed from
+   * the demultiplexer.
+   * @param metadata the metadata of the response
+   * @param mutation the mutation of the response
+   */
+  virtual void onResponse(MetadataSharedPtr metadata, MutationSharedPtr mutation) PURE;
+
+  /**
+   * Called with the next bytes of a streamed response, see Metadata::getStreamedBytes(). The bytes
+   * which follow the response are handed over until its end, unless the handler is removed.
+   * @param data the bytes, which are drained by the handler
+   * @param end_stream whether these are the last bytes of the response
+   */
+  virtual void onResponseBody(Buffer::Instance& data, bool end_stream) PURE;
+
+  /**
+   * Called when the responses on the connection can't be decoded. The handler has been removed
+   * from the demultiplexer.
+   * @param what the decoding error
+   */
+  virtual void onResponseError(const std::string& what) PURE;
+
+  /**
+   * Called when the connection is closed before the response is received. The handler has been
+   * removed from the demultiplexer.
+   * @param event the close event of the connection
+   */
+  virtual void onConnectionClose(Network::ConnectionEvent event) PURE;
+};
+
+/**
+ * ResponseDemultiplexer decodes the response stream of an upstream connection and hands each
+ * decoded response over to the request in flight with the same request ID. It's attached to the
+ * upstream connection as its connection state, so the codec and the decoder are created once per
+ * upstream connection and reused for as long as the pool reuses the connection. The connections of
+ * a cluster may be used by the routers of proxies with different codec configurations, so the
+ * demultiplexer is replaced when the connection is used with another codec configuration.
+ *
+ * A request may be sent with an upstream request ID other than its own, e.g. to keep the IDs
+ * unique on a multiplexed connection. Its response is given back the ID of the request before
+ * it's handed over.
+ *
+ * A response larger than the streaming threshold is handed over once its head is decoded, and the
+ * rest of it is handed over to the same request as it arrives.
+ */
+class ResponseDemultiplexer : public Tcp::ConnectionPool::ConnectionState,
+                              public ResponseDecoderCallbacks,
+                              public StreamHandler,
+                              Logger::Loggable<Logger::Id::filter> {
+public:
+  ResponseDemultiplexer(CodecPtr&& codec, uint64_t codec_hash);
+  ~ResponseDemultiplexer() override = default;
+
+  /**
+   * Returns the demultiplexer attached to the connection. A new one is attached if there's none,
+   * or if the attached one decodes with a codec of another configuration.
+   * @param conn_data the upstream connection, which has no request in flight
+   * @param codec_hash the hash of the codec configuration, see DecoderFilterCallbacks::codecHash()
+   * @param create_codec creates the codec of a new demultiplexer
+   */
+  static ResponseDemultiplexer& attach(Tcp::ConnectionPool::ConnectionData& conn_data,
+                                       uint64_t codec_hash,
+                                       const std::function<CodecPtr()>& create_codec);
+
+  /**
+   * Adds a request in flight, its response will be handed over to the handler.
+   */
+  void add(uint64_t request_id, ResponseHandler& handler) { add(request_id, request_id, handler); }
+
+  /**
+   * Adds a request in flight which is sent with another request ID.
+   * @param upstream_id the request ID the request is sent with
+   * @param request_id the ID of the request, which is restored in the response
+   * @param handler the handler of the request
+   */
+  void add(uint64_t upstream_id, uint64_t request_id, ResponseHandler& handler);
+
+  /**
+   * @return Codec& the codec of the responses, which is also used to rewrite the request IDs.
+   */
+  Codec& codec() { return *codec_; }
+
+  /**
+   * Sets the size of the responses above which they're streamed, zero if they aren't streamed.
+   */
+  void setStreamingThreshold(uint64_t threshold) { codec_->setStreamingThreshold(threshold); }
+
+  /**
+   * Removes a request in flight, or the request whose response is being streamed.
+   * @param request_id the request ID the request is sent with
+   * @param handler the handler of the request
+   * @param reserve whether the ID stays reserved until the response arrives, so that the late
+   * response is discarded instead of being handed over to a later request with the same ID.
+   */
+  void remove(uint64_t request_id, const ResponseHandler& handler, bool reserve);
+
+  /**
+   * @return ResponseHandler* the handler of the request sent with the request ID, or nullptr if
+   * there's none.
+   */
+  ResponseHandler* handler(uint64_t request_id) const;
+
+  /**
+   * Removes all the requests in flight, including the request whose response is being streamed.
+   * @return the handlers of the requests.
+   */
+  std::vector<ResponseHandler*> takeHandlers();
+
+  bool contains(uint64_t request_id) const { return handlers_.contains(request_id); }
+  /**
+   * @return size_t the number of requests in flight, not counting the reserved request IDs.
+   */
+  size_t size() const { return handlers_.size() - reserved_; }
+  /**
+   * @return size_t the number of request IDs reserved for the late responses of removed requests.
+   */
+  size_t reserved() const { return reserved_; }
+  bool idle() const {
+    return handlers_.empty() && buffer_.length() == 0 && streamed_bytes_ == 0;
+  }
+
+  /**
+   * Decodes the data received on the connection and dispatches the complete responses.
+   * @param data the data received
+   * @param connection the upstream connection, used to answer upstream heartbeats
+   * @throw EnvoyException if the data can't be decoded, or a response has no request in flight.
+   */
+  void onData(Buffer::Instance& data, Network::Connection& connection);
+
+  // ResponseDecoderCallbacks
+  StreamHandler& newStream() override { return *this; }
+  void onHeartbeat(MetadataSharedPtr metadata) override;
+
+  // StreamHandler
+  void onStreamDecoded(MetadataSharedPtr metadata, MutationSharedPtr mutation) override;
+
+private:
+  struct RequestEntry {
+    // The handler of the request, or nullptr if the request ID is reserved.
+    ResponseHandler* handler;
+    // The ID of the request, which differs from the key if the ID has been rewritten.
+    uint64_t request_id;
+  };
+
+  // Hands the buffered bytes of the streamed response over to its request.
+  void forwardStreamedBody();
+
+  CodecPtr codec_;
+  const uint64_t codec_hash_;
+  ResponseDecoderPtr decoder_;
+  Buffer::OwnedImpl buffer_;
+  // The response of a heartbeat answered by the codec, it's reused for all the heartbeats.
+  Buffer::OwnedImpl heartbeat_response_;
+  Network::Connection* connection_{};
+
+  // The requests in flight keyed by the request ID they're sent with.
+  absl::flat_hash_map<uint64_t, RequestEntry> handlers_;
+  // The number of entries of handlers_ whose request ID is reserved.
+  size_t reserved_{0};
+  // The request whose response is being streamed, or nullptr if the rest of it is discarded.
+  ResponseHandler* streaming_handler_{};
+  // The bytes of the streamed response which haven't been received yet.
+  uint64_t streamed_bytes_{0};
+};
+
+} // namespace Router
+} // namespace MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
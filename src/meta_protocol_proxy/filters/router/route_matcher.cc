@@ -3,24 +3,96 @@
 #include "envoy/config/route/v3/route_components.pb.h"
 #include "api/v1alpha/route.pb.h"
 
+#include <algorithm>
+
+#include "envoy/common/exception.h"
+
+#include "source/common/common/hash.h"
+#include "source/common/common/macros.h"
 #include "source/common/protobuf/utility.h"
 
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_split.h"
+#include "absl/types/span.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace NetworkFilters {
 namespace MetaProtocolProxy {
 namespace Router {
 
+RetryPolicyImpl::RetryPolicyImpl(
+    const envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::RetryPolicy& config)
+    : num_retries_(
+          PROTOBUF_GET_WRAPPED_OR_DEFAULT(config, num_retries, config.retry_on().empty() ? 0 : 1)) {
+  for (const absl::string_view condition :
+       absl::StrSplit(config.retry_on(), ',', absl::SkipWhitespace())) {
+    const absl::string_view name = absl::StripAsciiWhitespace(condition);
+    if (name == "connect-failure") {
+      retry_on_ |= RetryOn::ConnectFailure;
+    } else if (name == "reset") {
+      retry_on_ |= RetryOn::Reset;
+    } else if (name == "error-response") {
+      retry_on_ |= RetryOn::ErrorResponse;
+    } else {
+      throw EnvoyException(
+          fmt::format("meta protocol route matcher: unknown retry condition '{}'", name));
+    }
+  }
+}
+
+HashPolicyImpl::HashPolicyImpl(
+    const envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::HashPolicy& config)
+    : keys_(config.metadata_keys().begin(), config.metadata_keys().end()) {}
+
+absl::optional<uint64_t> HashPolicyImpl::generateHash(const Metadata& metadata) const {
+  absl::optional<uint64_t> hash;
+  for (const std::string& key : keys_) {
+    const absl::string_view value = metadata.getString(key);
+    if (value.empty()) {
+      continue;
+    }
+
+    // Rotate the hash before combining, so that the values of different keys are distinguished by
+    // their order.
+    const uint64_t value_hash = HashUtil::xxHash64(value);
+    hash = hash.has_value() ? ((hash.value() << 1) | (hash.value() >> 63)) ^ value_hash
+                            : value_hash;
+  }
+  return hash;
+}
+
 RouteEntryImplBase::RouteEntryImplBase(
-    const envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::Route& route)
-    : cluster_name_(route.route().cluster()),
-      config_headers_(Http::HeaderUtility::buildHeaderDataVector(route.match().metadata())) {
+    const envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::Route& route,
+    Stats::SymbolTable& symbol_table)
+    : stat_names_(symbol_table), cluster_name_(route.route().cluster()),
+      route_stat_name_(route.name().empty() ? Stats::StatName() : stat_names_.add(route.name())),
+      cluster_stat_name_(stat_names_.add(cluster_name_)),
+      use_request_timeout_(route.route().use_request_timeout()),
+      retry_policy_(route.route().retry_policy()) {
+  for (const auto& matcher : route.match().metadata()) {
+    metadata_matchers_.emplace_back(matcher);
+  }
+
+  if (route.route().has_hash_policy()) {
+    hash_policy_ = std::make_unique<const HashPolicyImpl>(route.route().hash_policy());
+  }
+
+  if (route.route().has_timeout()) {
+    const uint64_t timeout = PROTOBUF_GET_MS_REQUIRED(route.route(), timeout);
+    if (timeout > 0) {
+      timeout_ = std::chrono::milliseconds(timeout);
+    }
+  }
+
   if (route.route().cluster_specifier_case() ==
       envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::RouteAction::
           ClusterSpecifierCase::kWeightedClusters) {
     total_cluster_weight_ = 0UL;
     for (const auto& cluster : route.route().weighted_clusters().clusters()) {
-      weighted_clusters_.emplace_back(std::make_shared<WeightedClusterEntry>(*this, cluster));
+      weighted_clusters_.emplace_back(
+          std::make_shared<WeightedClusterEntry>(*this, cluster, stat_names_));
       total_cluster_weight_ += weighted_clusters_.back()->clusterWeight();
     }
     ENVOY_LOG(debug, "meta protocol route matcher: weighted_clusters_size {}",
@@ -44,25 +116,56 @@ RouteConstSharedPtr RouteEntryImplBase::clusterEntry(uint64_t random_value) cons
 }
 
 bool RouteEntryImplBase::headersMatch(const Metadata& metadata) const {
-  if (config_headers_.empty()) {
+  if (metadata_matchers_.empty()) {
     ENVOY_LOG(debug, "meta protocol route matcher: no headers match");
     return true;
   }
-  const MetadataImpl* metadataImpl = static_cast<const MetadataImpl*>(&metadata);
-  const auto& headers = metadataImpl->getHeaders();
-  ENVOY_LOG(debug, "meta protocol route matcher: headers size {}, metadata headers size {}",
-            config_headers_.size(), headers.size());
-  return Http::HeaderUtility::matchHeaders(headers, config_headers_);
+
+  const Http::HeaderMap* headers = nullptr;
+  for (const MetadataMatcher& matcher : metadata_matchers_) {
+    // The string is looked up first, so that a value decoded on demand, e.g. an attachment of a
+    // Dubbo request, is in the header map too.
+    const absl::string_view value = metadata.getString(matcher.key_);
+    if (!matcher.exact_value_.empty() && !value.empty()) {
+      if (value != matcher.exact_value_) {
+        return false;
+      }
+      continue;
+    }
+
+    // The other matchers, and an exact match on a key which may have been put with another case,
+    // are evaluated on the header map, whose keys are case insensitive.
+    if (headers == nullptr) {
+      headers = &static_cast<const MetadataImpl&>(metadata).getHeaders();
+    }
+    if (!Http::HeaderUtility::matchHeaders(*headers, *matcher.header_data_)) {
+      return false;
+    }
+  }
+  return true;
 }
 
+RouteEntryImplBase::MetadataMatcher::MetadataMatcher(
+    const envoy::config::route::v3::HeaderMatcher& config)
+    : key_(config.name()),
+      exact_value_(config.header_match_specifier_case() ==
+                               envoy::config::route::v3::HeaderMatcher::kExactMatch &&
+                           !config.invert_match()
+                       ? config.exact_match()
+                       : ""),
+      header_data_(std::make_unique<Http::HeaderUtility::HeaderData>(config)) {}
+
 RouteEntryImplBase::WeightedClusterEntry::WeightedClusterEntry(const RouteEntryImplBase& parent,
-                                                               const WeightedCluster& cluster)
+                                                               const WeightedCluster& cluster,
+                                                               Stats::StatNamePool& stat_names)
     : parent_(parent), cluster_name_(cluster.name()),
-      cluster_weight_(PROTOBUF_GET_WRAPPED_REQUIRED(cluster, weight)) {}
+      cluster_weight_(PROTOBUF_GET_WRAPPED_REQUIRED(cluster, weight)),
+      cluster_stat_name_(stat_names.add(cluster_name_)) {}
 
 RouteEntryImpl::RouteEntryImpl(
-    const envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::Route& route)
-    : RouteEntryImplBase(route) {}
+    const envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::Route& route,
+    Stats::SymbolTable& symbol_table)
+    : RouteEntryImplBase(route, symbol_table) {}
 
 RouteEntryImpl::~RouteEntryImpl() = default;
 
@@ -76,26 +179,88 @@ RouteConstSharedPtr RouteEntryImpl::matches(const Metadata& metadata,
   return clusterEntry(random_value);
 }
 
+namespace {
+
+// The metadata keys which are indexed by RouteMatcherImpl. These are the keys a route usually
+// matches on, e.g. the service interface and the method of a Dubbo request.
+const std::vector<std::string>& indexedKeys() {
+  CONSTRUCT_ON_FIRST_USE(std::vector<std::string>, {"interface", "method"});
+}
+
+} // namespace
+
 RouteMatcherImpl::RouteMatcherImpl(const RouteConfig& config,
-                                   Server::Configuration::FactoryContext&) {
-  using envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::RouteMatch;
+                                   Server::Configuration::FactoryContext& context) {
+  for (const std::string& key : indexedKeys()) {
+    indexes_.emplace_back(key);
+  }
 
   for (const auto& route : config.routes()) {
-    routes_.emplace_back(std::make_shared<RouteEntryImpl>(route));
+    indexRoute(route, routes_.size());
+    routes_.emplace_back(std::make_shared<RouteEntryImpl>(route, context.scope().symbolTable()));
   }
-  ENVOY_LOG(debug, "meta protocol route matcher: routes list size {}", routes_.size());
+  ENVOY_LOG(debug, "meta protocol route matcher: routes list size {}, unindexed routes size {}",
+            routes_.size(), unindexed_routes_.size());
+}
+
+void RouteMatcherImpl::indexRoute(const RouteConfigEntry& route, size_t position) {
+  using envoy::config::route::v3::HeaderMatcher;
+
+  // A route is indexed by the value of the first indexed key it requires an exact match on. It can
+  // only match the requests with that value, so it doesn't need to be considered for the others.
+  for (RouteIndex& index : indexes_) {
+    for (const auto& matcher : route.match().metadata()) {
+      if (matcher.header_match_specifier_case() == HeaderMatcher::kExactMatch &&
+          !matcher.invert_match() && index.key_ == absl::AsciiStrToLower(matcher.name())) {
+        index.routes_[matcher.exact_match()].push_back(position);
+        return;
+      }
+    }
+  }
+
+  // Regex, prefix, presence and other matchers are evaluated by scanning the routes in order.
+  unindexed_routes_.push_back(position);
 }
 
 RouteConstSharedPtr RouteMatcherImpl::route(const Metadata& metadata,
                                             uint64_t random_value) const {
-  for (const auto& route : routes_) {
-    RouteConstSharedPtr route_entry = route->matches(metadata, random_value);
+  // The routes which may match the request: the unindexed ones, plus the indexed ones whose
+  // required value is the value of the request. Each list is in configuration order.
+  absl::InlinedVector<absl::Span<const size_t>, 3> candidates;
+  if (!unindexed_routes_.empty()) {
+    candidates.emplace_back(unindexed_routes_);
+  }
+  for (const RouteIndex& index : indexes_) {
+    if (index.routes_.empty()) {
+      continue;
+    }
+    // The indexed keys are put by the codecs, the value is looked up without the header map.
+    auto it = index.routes_.find(metadata.getString(index.key_));
+    if (it != index.routes_.end()) {
+      candidates.emplace_back(it->second);
+    }
+  }
+
+  // Merge the candidate lists so that the routes are tried in configuration order, the first
+  // matching route wins as if all the routes were scanned.
+  while (true) {
+    absl::Span<const size_t>* next = nullptr;
+    for (auto& routes : candidates) {
+      if (!routes.empty() && (next == nullptr || routes.front() < next->front())) {
+        next = &routes;
+      }
+    }
+    if (next == nullptr) {
+      return nullptr;
+    }
+
+    const size_t position = next->front();
+    next->remove_prefix(1);
+    RouteConstSharedPtr route_entry = routes_[position]->matches(metadata, random_value);
     if (nullptr != route_entry) {
       return route_entry;
     }
   }
-
-  return nullptr;
 }
 
 } // namespace Router
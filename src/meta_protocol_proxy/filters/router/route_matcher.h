@@ -6,6 +6,7 @@
 
 #include "envoy/type/v3/range.pb.h"
 #include "envoy/config/route/v3/route_components.pb.h"
+#include "envoy/stats/symbol_table.h"
 
 #include "api/v1alpha/route.pb.h"
 
@@ -13,10 +14,12 @@
 #include "source/common/common/matchers.h"
 #include "source/common/http/header_utility.h"
 #include "source/common/protobuf/protobuf.h"
+#include "source/common/stats/symbol_table_impl.h"
 #include "src/meta_protocol_proxy/codec/codec.h"
 #include "src/meta_protocol_proxy/filters/router/route.h"
 #include "src/meta_protocol_proxy/filters/router/router.h"
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/types/optional.h"
 
 namespace Envoy {
@@ -25,13 +28,40 @@ namespace NetworkFilters {
 namespace MetaProtocolProxy {
 namespace Router {
 
+class RetryPolicyImpl : public RetryPolicy {
+public:
+  RetryPolicyImpl(
+      const envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::RetryPolicy& config);
+
+  // Router::RetryPolicy
+  uint32_t retryOn() const override { return retry_on_; }
+  uint32_t numRetries() const override { return num_retries_; }
+
+private:
+  uint32_t retry_on_{};
+  const uint32_t num_retries_;
+};
+
+class HashPolicyImpl : public HashPolicy {
+public:
+  HashPolicyImpl(
+      const envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::HashPolicy& config);
+
+  // Router::HashPolicy
+  absl::optional<uint64_t> generateHash(const Metadata& metadata) const override;
+
+private:
+  const std::vector<std::string> keys_;
+};
+
 class RouteEntryImplBase : public RouteEntry,
                            public Route,
                            public std::enable_shared_from_this<RouteEntryImplBase>,
                            public Logger::Loggable<Logger::Id::filter> {
 public:
   RouteEntryImplBase(
-      const envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::Route& route);
+      const envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::Route& route,
+      Stats::SymbolTable& symbol_table);
   ~RouteEntryImplBase() override = default;
 
   // Router::RouteEntry
@@ -39,6 +69,12 @@ public:
   const Envoy::Router::MetadataMatchCriteria* metadataMatchCriteria() const override {
     return metadata_match_criteria_.get();
   }
+  absl::optional<std::chrono::milliseconds> timeout() const override { return timeout_; }
+  bool useRequestTimeout() const override { return use_request_timeout_; }
+  const RetryPolicy& retryPolicy() const override { return retry_policy_; }
+  const HashPolicy* hashPolicy() const override { return hash_policy_.get(); }
+  Stats::StatName routeStatName() const override { return route_stat_name_; }
+  Stats::StatName clusterStatName() const override { return cluster_stat_name_; }
 
   // Router::Route
   const RouteEntry* routeEntry() const override;
@@ -51,10 +87,23 @@ protected:
   bool headersMatch(const Metadata& metadata) const;
 
 private:
+  // A matcher of the route on a metadata string. A non-inverted exact match on a non-empty value
+  // is done on the string of the key, the header map of the metadata is only built when another
+  // matcher runs.
+  struct MetadataMatcher {
+    MetadataMatcher(const envoy::config::route::v3::HeaderMatcher& config);
+
+    std::string key_;
+    // The value of an exact match done on the string, empty for the other matchers.
+    std::string exact_value_;
+    Http::HeaderUtility::HeaderDataPtr header_data_;
+  };
+
   class WeightedClusterEntry : public RouteEntry, public Route {
   public:
     using WeightedCluster = envoy::config::route::v3::WeightedCluster::ClusterWeight;
-    WeightedClusterEntry(const RouteEntryImplBase& parent, const WeightedCluster& cluster);
+    WeightedClusterEntry(const RouteEntryImplBase& parent, const WeightedCluster& cluster,
+                         Stats::StatNamePool& stat_names);
 
     uint64_t clusterWeight() const { return cluster_weight_; }
 
@@ -64,6 +113,14 @@ private:
       return metadata_match_criteria_ ? metadata_match_criteria_.get()
                                       : parent_.metadataMatchCriteria();
     }
+    absl::optional<std::chrono::milliseconds> timeout() const override {
+      return parent_.timeout();
+    }
+    bool useRequestTimeout() const override { return parent_.useRequestTimeout(); }
+    const RetryPolicy& retryPolicy() const override { return parent_.retryPolicy(); }
+    const HashPolicy* hashPolicy() const override { return parent_.hashPolicy(); }
+    Stats::StatName routeStatName() const override { return parent_.routeStatName(); }
+    Stats::StatName clusterStatName() const override { return cluster_stat_name_; }
 
     // Router::Route
     const RouteEntry* routeEntry() const override { return this; }
@@ -72,15 +129,24 @@ private:
     const RouteEntryImplBase& parent_;
     const std::string cluster_name_;
     const uint64_t cluster_weight_;
+    const Stats::StatName cluster_stat_name_;
     Envoy::Router::MetadataMatchCriteriaConstPtr metadata_match_criteria_;
   };
 
   using WeightedClusterEntrySharedPtr = std::shared_ptr<WeightedClusterEntry>;
 
+  // The stat names are interned when the route is loaded, the weighted clusters' names included.
+  Stats::StatNamePool stat_names_;
   uint64_t total_cluster_weight_;
   const std::string cluster_name_;
-  const std::vector<Http::HeaderUtility::HeaderDataPtr> config_headers_;
+  const Stats::StatName route_stat_name_;
+  const Stats::StatName cluster_stat_name_;
+  std::vector<MetadataMatcher> metadata_matchers_;
   std::vector<WeightedClusterEntrySharedPtr> weighted_clusters_;
+  absl::optional<std::chrono::milliseconds> timeout_;
+  const bool use_request_timeout_;
+  const RetryPolicyImpl retry_policy_;
+  std::unique_ptr<const HashPolicyImpl> hash_policy_;
 
   // TODO(gengleilei) Implement it.
   Envoy::Router::MetadataMatchCriteriaConstPtr metadata_match_criteria_;
@@ -91,7 +157,8 @@ using RouteEntryImplBaseConstSharedPtr = std::shared_ptr<const RouteEntryImplBas
 class RouteEntryImpl : public RouteEntryImplBase {
 public:
   RouteEntryImpl(
-      const envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::Route& route);
+      const envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::Route& route,
+      Stats::SymbolTable& symbol_table);
   ~RouteEntryImpl() override;
 
   // RoutEntryImplBase
@@ -109,7 +176,22 @@ public:
                             uint64_t random_value) const override;
 
 private:
+  using RouteConfigEntry = envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::Route;
+
+  // The routes which require an exact value of a metadata key, indexed by that value.
+  struct RouteIndex {
+    RouteIndex(const std::string& key) : key_(key) {}
+
+    const std::string key_;
+    absl::flat_hash_map<std::string, std::vector<size_t>> routes_;
+  };
+
+  void indexRoute(const RouteConfigEntry& route, size_t position);
+
   std::vector<RouteEntryImplBaseConstSharedPtr> routes_;
+  std::vector<RouteIndex> indexes_;
+  // The positions of the routes which can't be indexed, in configuration order.
+  std::vector<size_t> unindexed_routes_;
 };
 
 } // namespace Router
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <string>
 
 #include "envoy/router/router.h"
+#include "envoy/stats/symbol_table.h"
 
 #include "src/meta_protocol_proxy/codec/codec.h"
 
@@ -13,6 +15,50 @@ namespace NetworkFilters {
 namespace MetaProtocolProxy {
 namespace Router {
 
+/**
+ * RetryPolicy specifies when the upstream request of a route is retried.
+ */
+class RetryPolicy {
+public:
+  /**
+   * The conditions under which a request is retried, combined as bit flags.
+   */
+  enum RetryOn : uint32_t {
+    // The connection to the upstream host can't be established.
+    ConnectFailure = 0x1,
+    // The upstream connection is closed before the response is received.
+    Reset = 0x2,
+    // The response is decoded as an error by the codec.
+    ErrorResponse = 0x4,
+  };
+
+  virtual ~RetryPolicy() = default;
+
+  /**
+   * @return uint32_t the RetryOn conditions under which the request is retried.
+   */
+  virtual uint32_t retryOn() const PURE;
+
+  /**
+   * @return uint32_t the maximum number of retries of a request.
+   */
+  virtual uint32_t numRetries() const PURE;
+};
+
+/**
+ * HashPolicy computes the hash key of a request for a consistent hashing load balancer.
+ */
+class HashPolicy {
+public:
+  virtual ~HashPolicy() = default;
+
+  /**
+   * @param metadata the metadata of the request
+   * @return the hash key of the request, or absl::nullopt if the request has no value to hash.
+   */
+  virtual absl::optional<uint64_t> generateHash(const Metadata& metadata) const PURE;
+};
+
 /**
  * RouteEntry is an individual resolved route entry.
  */
@@ -30,6 +76,38 @@ public:
    * selecting an upstream host
    */
   virtual const Envoy::Router::MetadataMatchCriteria* metadataMatchCriteria() const PURE;
+
+  /**
+   * @return the timeout of the upstream request, or absl::nullopt if the request never times out.
+   */
+  virtual absl::optional<std::chrono::milliseconds> timeout() const PURE;
+
+  /**
+   * @return bool whether the timeout carried by the request is honored.
+   */
+  virtual bool useRequestTimeout() const PURE;
+
+  /**
+   * @return const RetryPolicy& the retry policy of the upstream request.
+   */
+  virtual const RetryPolicy& retryPolicy() const PURE;
+
+  /**
+   * @return const HashPolicy* the hash policy of the route, or nullptr if the requests aren't
+   * hashed.
+   */
+  virtual const HashPolicy* hashPolicy() const PURE;
+
+  /**
+   * @return Stats::StatName the name of the route in the scoped stats, or an empty StatName if the
+   * route has no name.
+   */
+  virtual Stats::StatName routeStatName() const PURE;
+
+  /**
+   * @return Stats::StatName the name of the upstream cluster in the scoped stats.
+   */
+  virtual Stats::StatName clusterStatName() const PURE;
 };
 
 using RouteEntryPtr = std::shared_ptr<RouteEntry>;
@@ -1,21 +1,35 @@
 #include "src/meta_protocol_proxy/filters/router/router_impl.h"
 
+#include <algorithm>
+
 #include "envoy/upstream/cluster_manager.h"
 #include "envoy/upstream/thread_local_cluster.h"
 
+#include "source/common/http/header_map_impl.h"
+#include "source/common/tracing/http_tracer_impl.h"
+
 #include "src/meta_protocol_proxy/app_exception.h"
 #include "src/meta_protocol_proxy/codec/codec.h"
 
+#include "absl/strings/str_cat.h"
+
 namespace Envoy {
 namespace Extensions {
 namespace NetworkFilters {
 namespace MetaProtocolProxy {
 namespace Router {
 
+// The number of times the load balancer picks a host again if it picks a host which has been
+// attempted by the request.
+constexpr uint32_t RetryHostSelectionCount = 3;
+
 void Router::onDestroy() {
   if (upstream_request_) {
     upstream_request_->resetStream();
   }
+  if (retry_timer_ != nullptr) {
+    retry_timer_->disableTimer();
+  }
   cleanup();
 }
 
@@ -24,7 +38,7 @@ void Router::setDecoderFilterCallbacks(DecoderFilterCallbacks& callbacks) {
 }
 
 FilterStatus Router::onMessageDecoded(MetadataSharedPtr metadata,
-                                      MutationSharedPtr) {
+                                      MutationSharedPtr mutation) {
   route_ = callbacks_->route();
   if (!route_) {
     ENVOY_STREAM_LOG(debug, "meta protocol router: no cluster match for request '{}'", *callbacks_,
@@ -39,6 +53,14 @@ FilterStatus Router::onMessageDecoded(MetadataSharedPtr metadata,
   }
 
   route_entry_ = route_->routeEntry();
+  // The metadata is hashed by computeHashKey() when the load balancer picks a host.
+  metadata_ = metadata;
+  streamed_ = metadata->getStreamedBytes() > 0;
+  if (scoped_stats_ != nullptr) {
+    scoped_stats_->resolveScopes(*route_entry_, *metadata, stat_scopes_);
+    scoped_stats_->chargeRequest(stat_scopes_);
+    routed_time_ = now();
+  }
 
   Upstream::ThreadLocalCluster* cluster =
       cluster_manager_.getThreadLocalCluster(route_entry_->clusterName());
@@ -79,10 +101,57 @@ FilterStatus Router::onMessageDecoded(MetadataSharedPtr metadata,
 
   ENVOY_STREAM_LOG(debug, "meta protocol router: decoding request", *callbacks_);
 
-  // TODO encode mutation into the outgoing request
-  upstream_request_buffer_.move(metadata->getOriginMessage(), metadata->getOriginMessage().length());
-  upstream_request_ = std::make_unique<UpstreamRequest>(*this, *conn_pool_data, metadata);
-  return upstream_request_->start();
+  Tracing::Span* active_span = callbacks_->activeSpan();
+  if (active_span != nullptr) {
+    startUpstreamSpan(*active_span, mutation.get());
+  }
+
+  // The request is re-encoded only if the filters have mutated it, otherwise the original message
+  // is forwarded as is. A streamed request can't be re-encoded as its body hasn't been read.
+  if (!streamed_ && mutation != nullptr && mutation->hasStrings()) {
+    try {
+      callbacks_->encodeRequest(*metadata, *mutation, upstream_request_buffer_);
+    } catch (const EnvoyException& ex) {
+      ENVOY_STREAM_LOG(error, "meta protocol router: failed to encode request: {}", *callbacks_,
+                       ex.what());
+      callbacks_->sendLocalReply(
+          AppException(Error{ErrorType::Unspecified,
+                             fmt::format("meta protocol router: failed to encode request: {}",
+                                         ex.what())}),
+          false);
+      return FilterStatus::StopIteration;
+    }
+  }
+  if (upstream_request_buffer_.length() == 0) {
+    upstream_request_buffer_.move(metadata->getOriginMessage(),
+                                  metadata->getOriginMessage().length());
+  }
+  upstream_request_ = std::make_unique<UpstreamRequest>(*this, *conn_pool_data, metadata_);
+
+  absl::optional<std::chrono::milliseconds> timeout = route_entry_->timeout();
+  if (route_entry_->useRequestTimeout()) {
+    const auto request_timeout = metadata->getTimeout();
+    if (request_timeout.has_value() && request_timeout.value().count() > 0 &&
+        (!timeout.has_value() || request_timeout.value() < timeout.value())) {
+      timeout = request_timeout;
+    }
+  }
+  if (timeout.has_value() && metadata->getMessageType() != MessageType::Oneway) {
+    timeouts_.arm(*this, timeout.value());
+  }
+
+  FilterStatus status = upstream_request_->start();
+  if (retry_timer_ != nullptr && retry_timer_->enabled()) {
+    // The request failed synchronously and is to be retried, pause until the retry is sent.
+    status = FilterStatus::StopIteration;
+  }
+
+  if (status == FilterStatus::StopIteration) {
+    decoding_stopped_ = true;
+  } else {
+    filter_complete_ = true;
+  }
+  return status;
 }
 
 void Router::setEncoderFilterCallbacks(EncoderFilterCallbacks& callbacks) {
@@ -97,6 +166,15 @@ FilterStatus Router::onMessageEncoded(MetadataSharedPtr metadata,
 
   ENVOY_STREAM_LOG(trace, "meta protocol router: response status: {}", *encoder_callbacks_,
                    metadata->getResponseStatus());
+  if (scoped_stats_ != nullptr) {
+    scoped_stats_->chargeResponse(
+        stat_scopes_, *metadata,
+        std::chrono::duration_cast<std::chrono::microseconds>(now() - routed_time_));
+  }
+  if (upstream_span_ != nullptr && (metadata->getResponseStatus() == ResponseStatus::Error ||
+                                    metadata->getMessageType() == MessageType::Error)) {
+    upstream_span_->setTag(Tracing::Tags::get().Error, Tracing::Tags::get().True);
+  }
 
   switch (metadata->getResponseStatus()) {
   case ResponseStatus::Ok:
@@ -125,31 +203,30 @@ void Router::onUpstreamData(Buffer::Instance& data, bool end_stream) {
   ENVOY_STREAM_LOG(trace, "meta protocol router: reading response: {} bytes", *callbacks_,
                    data.length());
 
-  // Handle normal response.
-  if (!upstream_request_->response_started_) {
-    callbacks_->startUpstreamResponse();
-    upstream_request_->response_started_ = true;
-  }
-
-  UpstreamResponseStatus status = callbacks_->upstreamData(data);
-  if (status == UpstreamResponseStatus::Complete) {
-    ENVOY_STREAM_LOG(debug, "meta protocol router: response complete", *callbacks_);
-    upstream_request_->onResponseComplete();
-    cleanup();
-    return;
-  } else if (status == UpstreamResponseStatus::Reset) {
-    ENVOY_STREAM_LOG(debug, "meta protocol router: upstream reset", *callbacks_);
-    // When the upstreamData function returns Reset,
-    // the current stream is already released from the upper layer,
-    // so there is no need to call callbacks_->resetStream() to notify
-    // the upper layer to release the stream.
-    upstream_request_->resetStream();
+  // The demultiplexer hands the decoded response over to the upstream request, which may
+  // complete and clean up the upstream request.
+  try {
+    upstream_request_->response_demux_->onData(data, upstream_request_->conn_data_->connection());
+  } catch (const EnvoyException& ex) {
+    if (upstream_request_ == nullptr) {
+      ENVOY_LOG(debug, "meta protocol router: bad data after the response: {}", ex.what());
+      return;
+    }
+    upstream_request_->onResponseError(ex.what());
     return;
   }
 
-  if (end_stream) {
+  if (upstream_request_ != nullptr && end_stream) {
     // Response is incomplete, but no more data is coming.
     ENVOY_STREAM_LOG(debug, "meta protocol router: response underflow", *callbacks_);
+    if (response_streaming_) {
+      onStreamedResponseReset();
+      return;
+    }
+    if (shouldRetry(RetryPolicy::RetryOn::Reset)) {
+      retry();
+      return;
+    }
     upstream_request_->onResetStream(ConnectionPool::PoolFailureReason::RemoteConnectionFailure);
     upstream_request_->onResponseComplete();
     cleanup();
@@ -170,9 +247,17 @@ void Router::onEvent(Network::ConnectionEvent event) {
 
   switch (event) {
   case Network::ConnectionEvent::RemoteClose:
-    upstream_request_->onResetStream(ConnectionPool::PoolFailureReason::RemoteConnectionFailure);
     upstream_request_->upstream_host_->outlierDetector().putResult(
         Upstream::Outlier::Result::LocalOriginConnectFailed);
+    if (response_streaming_) {
+      onStreamedResponseReset();
+      break;
+    }
+    if (shouldRetry(RetryPolicy::RetryOn::Reset)) {
+      retry();
+      break;
+    }
+    upstream_request_->onResetStream(ConnectionPool::PoolFailureReason::RemoteConnectionFailure);
     break;
   case Network::ConnectionEvent::LocalClose:
     upstream_request_->onResetStream(ConnectionPool::PoolFailureReason::LocalConnectionFailure);
@@ -183,14 +268,374 @@ void Router::onEvent(Network::ConnectionEvent event) {
   }
 }
 
+void Router::onUpstreamResponse(MetadataSharedPtr metadata, MutationSharedPtr mutation) {
+  ASSERT(!upstream_request_->response_complete_);
+  ENVOY_STREAM_LOG(trace, "meta protocol router: response {} received", *callbacks_,
+                   metadata->getRequestId());
+
+  upstream_request_->response_started_ = true;
+  if (metadata->getResponseStatus() == ResponseStatus::Error &&
+      shouldRetry(RetryPolicy::RetryOn::ErrorResponse)) {
+    // The response isn't handed over to the filters, report the failure to the outlier detector
+    // here.
+    upstream_request_->upstream_host_->outlierDetector().putResult(
+        Upstream::Outlier::Result::ExtOriginRequestFailed);
+    upstream_request_->onResponseComplete();
+    retry();
+    return;
+  }
+
+  UpstreamResponseStatus status = callbacks_->upstreamResponse(metadata, mutation);
+  if (status == UpstreamResponseStatus::Complete) {
+    ENVOY_STREAM_LOG(debug, "meta protocol router: response complete", *callbacks_);
+    if (retries_ > 0) {
+      cluster_->stats().upstream_rq_retry_success_.inc();
+    }
+    upstream_request_->onResponseComplete();
+    cleanup();
+    return;
+  }
+
+  if (status == UpstreamResponseStatus::MoreData) {
+    // The head of a streamed response has been forwarded, the request can't time out or be retried
+    // from now on.
+    ENVOY_STREAM_LOG(debug, "meta protocol router: streaming response", *callbacks_);
+    disarm();
+    response_streaming_ = true;
+    callbacks_->setDownstreamWatermarkCallbacks(this);
+    return;
+  }
+
+  if (status == UpstreamResponseStatus::Retry) {
+    // Nothing has been sent to the downstream, the response is either retried or replaced with a
+    // local reply.
+    upstream_request_->onResponseComplete();
+    if (shouldRetry(absl::nullopt)) {
+      retry();
+      return;
+    }
+
+    ENVOY_STREAM_LOG(debug, "meta protocol router: no retry left for the response", *callbacks_);
+    disarm();
+    callbacks_->sendLocalReply(
+        AppException(Error{ErrorType::Unspecified,
+                           fmt::format("meta protocol router: no retry left for request '{}'",
+                                       metadata_->getRequestId())}),
+        false);
+    releaseStream();
+    return;
+  }
+
+  ENVOY_STREAM_LOG(debug, "meta protocol router: upstream reset", *callbacks_);
+  // When the upstreamResponse function returns Reset,
+  // the current stream is already released from the upper layer,
+  // so there is no need to call callbacks_->resetStream() to notify
+  // the upper layer to release the stream.
+  upstream_request_->resetStream();
+}
+
+void Router::onUpstreamResponseBody(Buffer::Instance& data, bool end_stream) {
+  ASSERT(response_streaming_);
+  if (end_stream) {
+    ENVOY_STREAM_LOG(debug, "meta protocol router: streamed response complete", *callbacks_);
+    response_streaming_ = false;
+    callbacks_->setDownstreamWatermarkCallbacks(nullptr);
+    // The connection is returned to the pool with reading enabled.
+    setUpstreamReadDisabled(false);
+    if (retries_ > 0) {
+      cluster_->stats().upstream_rq_retry_success_.inc();
+    }
+    upstream_request_->onResponseComplete();
+    cleanup();
+  }
+
+  // The current stream is released once the last bytes are forwarded.
+  callbacks_->forwardResponseBody(data, end_stream);
+}
+
+void Router::onUpstreamResponseError(const std::string& what) {
+  ENVOY_STREAM_LOG(debug, "meta protocol router: bad upstream response: {}", *callbacks_, what);
+  if (response_streaming_) {
+    onStreamedResponseReset();
+    return;
+  }
+  onUpstreamFailure();
+  disarm();
+  // The local reply releases the current stream.
+  callbacks_->upstreamResponseError(what);
+  upstream_request_->resetStream();
+}
+
+void Router::onAboveWriteBufferHighWatermark() {
+  if (streaming_) {
+    ENVOY_STREAM_LOG(trace, "meta protocol router: pause streaming the request", *callbacks_);
+    callbacks_->setStreamedBodyHandler(nullptr);
+  }
+}
+
+void Router::onBelowWriteBufferLowWatermark() {
+  if (streaming_) {
+    ENVOY_STREAM_LOG(trace, "meta protocol router: resume streaming the request", *callbacks_);
+    callbacks_->setStreamedBodyHandler(this);
+  }
+}
+
+void Router::onDownstreamAboveWriteBufferHighWatermark() {
+  if (response_streaming_) {
+    ENVOY_STREAM_LOG(trace, "meta protocol router: pause reading the response", *callbacks_);
+    setUpstreamReadDisabled(true);
+  }
+}
+
+void Router::onDownstreamBelowWriteBufferLowWatermark() {
+  if (response_streaming_) {
+    ENVOY_STREAM_LOG(trace, "meta protocol router: resume reading the response", *callbacks_);
+    setUpstreamReadDisabled(false);
+  }
+}
+
+void Router::setUpstreamReadDisabled(bool disabled) {
+  if (disabled == upstream_read_disabled_) {
+    return;
+  }
+  upstream_read_disabled_ = disabled;
+  if (upstream_request_ != nullptr && upstream_request_->conn_data_ != nullptr) {
+    upstream_request_->conn_data_->connection().readDisable(disabled);
+  }
+}
+
+void Router::onStreamedResponseReset() {
+  ENVOY_STREAM_LOG(debug, "meta protocol router: streamed response cut short", *callbacks_);
+  onUpstreamFailure();
+  response_streaming_ = false;
+  callbacks_->setDownstreamWatermarkCallbacks(nullptr);
+  upstream_request_->resetStream();
+  cleanup();
+  callbacks_->resetDownstreamConnection();
+}
+
+void Router::onUpstreamFailure() {
+  if (scoped_stats_ != nullptr) {
+    scoped_stats_->chargeUpstreamFailure(stat_scopes_);
+  }
+  if (upstream_span_ != nullptr) {
+    upstream_span_->setTag(Tracing::Tags::get().Error, Tracing::Tags::get().True);
+  }
+}
+
+void Router::startUpstreamSpan(Tracing::Span& parent, Mutation* mutation) {
+  upstream_span_ = parent.spawnChild(Tracing::EgressConfig::get(),
+                                     absl::StrCat("router ", cluster_->name(), " egress"),
+                                     callbacks_->dispatcher().timeSource().systemTime());
+  upstream_span_->setTag(Tracing::Tags::get().UpstreamCluster, cluster_->name());
+  // A streamed request isn't re-encoded, so its upstream call can't carry the context.
+  if (streamed_ || mutation == nullptr) {
+    return;
+  }
+
+  // The tracer injects the context into a header map, whose entries are then put in the mutation
+  // and encoded into the request by the codec.
+  Http::RequestHeaderMapPtr context = Http::RequestHeaderMapImpl::create();
+  upstream_span_->injectContext(*context);
+  context->iterate([mutation](const Http::HeaderEntry& entry) -> Http::HeaderMap::Iterate {
+    mutation->putString(entry.key().getStringView(), entry.value().getStringView());
+    return Http::HeaderMap::Iterate::Continue;
+  });
+}
+
+void Router::onStreamedBody(Buffer::Instance& data, bool end_stream) {
+  if (end_stream) {
+    streaming_ = false;
+  }
+  if (upstream_request_ == nullptr || upstream_request_->conn_data_ == nullptr) {
+    // The upstream request has been reset, the rest of the request is discarded.
+    data.drain(data.length());
+    return;
+  }
+
+  ENVOY_STREAM_LOG(trace, "proxying {} streamed bytes", *callbacks_, data.length());
+  upstream_request_->conn_data_->connection().write(data, false);
+}
+
+void Router::onRequestTimeout() {
+  ENVOY_STREAM_LOG(debug, "meta protocol router: upstream request timeout", *callbacks_);
+  stats_.upstream_rq_timeout_.inc();
+  if (scoped_stats_ != nullptr) {
+    scoped_stats_->chargeRequestTimeout(stat_scopes_);
+  }
+  if (upstream_span_ != nullptr) {
+    upstream_span_->setTag(Tracing::Tags::get().Error, Tracing::Tags::get().True);
+  }
+  if (retry_timer_ != nullptr) {
+    retry_timer_->disableTimer();
+  }
+  if (upstream_request_ != nullptr) {
+    if (upstream_request_->upstream_host_ != nullptr) {
+      upstream_request_->upstream_host_->outlierDetector().putResult(
+          Upstream::Outlier::Result::LocalOriginTimeout);
+    }
+    upstream_request_->resetStream();
+  }
+
+  callbacks_->sendLocalReply(
+      AppException(Error{ErrorType::Timeout,
+                         fmt::format("meta protocol router: upstream request timeout for '{}'",
+                                     route_entry_->clusterName())}),
+      false);
+  releaseStream();
+}
+
 const Network::Connection* Router::downstreamConnection() const {
   return callbacks_ != nullptr ? callbacks_->connection() : nullptr;
 }
 
+absl::optional<uint64_t> Router::computeHashKey() {
+  if (route_entry_ == nullptr || route_entry_->hashPolicy() == nullptr) {
+    return absl::nullopt;
+  }
+  return route_entry_->hashPolicy()->generateHash(*metadata_);
+}
+
+bool Router::shouldSelectAnotherHost(const Upstream::Host& host) {
+  return std::any_of(attempted_hosts_.begin(), attempted_hosts_.end(),
+                     [&host](const Upstream::HostDescriptionConstSharedPtr& attempted) {
+                       return attempted.get() == &host;
+                     });
+}
+
+uint32_t Router::hostSelectionRetryCount() const {
+  return attempted_hosts_.empty() ? LoadBalancerContextBase::hostSelectionRetryCount()
+                                  : RetryHostSelectionCount;
+}
+
+Buffer::Instance& Router::requestData(Buffer::Instance& copy) {
+  if (streamed_ || retries_ >= route_entry_->retryPolicy().numRetries()) {
+    // This is the last attempt, the request is written as is.
+    return upstream_request_buffer_;
+  }
+
+  copy.add(upstream_request_buffer_);
+  return copy;
+}
+
+bool Router::shouldRetry(absl::optional<RetryPolicy::RetryOn> condition) {
+  if (streamed_) {
+    // The streamed body isn't kept, so the request can't be sent again.
+    return false;
+  }
+  const RetryPolicy& policy = route_entry_->retryPolicy();
+  if (condition.has_value() && (policy.retryOn() & condition.value()) == 0) {
+    return false;
+  }
+  if (retries_ >= policy.numRetries()) {
+    return false;
+  }
+
+  // The retry held by the current attempt is released before another one is taken.
+  releaseRetry();
+  if (!cluster_->resourceManager(Upstream::ResourcePriority::Default).retries().canCreate()) {
+    ENVOY_STREAM_LOG(debug, "meta protocol router: retry overflow for '{}'", *callbacks_,
+                     cluster_->name());
+    cluster_->stats().upstream_rq_retry_overflow_.inc();
+    return false;
+  }
+  return true;
+}
+
+void Router::retry() {
+  ASSERT(upstream_request_ != nullptr);
+  retries_++;
+  retry_held_ = true;
+  cluster_->resourceManager(Upstream::ResourcePriority::Default).retries().inc();
+  cluster_->stats().upstream_rq_retry_.inc();
+  ENVOY_STREAM_LOG(debug, "meta protocol router: retry {} of request '{}'", *callbacks_, retries_,
+                   metadata_->getRequestId());
+
+  if (upstream_request_->upstream_host_ != nullptr) {
+    attempted_hosts_.push_back(upstream_request_->upstream_host_);
+  }
+  upstream_request_->resetStream();
+  // The failure may be notified through the failed upstream request, so it's deleted once the
+  // callback returns.
+  callbacks_->dispatcher().deferredDelete(std::move(upstream_request_));
+
+  // The retry is sent in the next event loop iteration, out of the callbacks of the connection of
+  // the failed upstream request.
+  if (retry_timer_ == nullptr) {
+    retry_timer_ = callbacks_->dispatcher().createTimer([this]() { doRetry(); });
+  }
+  retry_timer_->enableTimer(std::chrono::milliseconds(0));
+}
+
+void Router::doRetry() {
+  Upstream::ThreadLocalCluster* cluster =
+      cluster_manager_.getThreadLocalCluster(route_entry_->clusterName());
+  absl::optional<Upstream::TcpPoolData> conn_pool_data;
+  if (cluster != nullptr) {
+    conn_pool_data = cluster->tcpConnPool(Upstream::ResourcePriority::Default, this);
+  }
+  if (!conn_pool_data) {
+    disarm();
+    callbacks_->sendLocalReply(AppException(Error{
+                                   ErrorType::NoHealthyUpstream,
+                                   fmt::format("meta protocol router: no healthy upstream for '{}'",
+                                               route_entry_->clusterName())}),
+                               false);
+    releaseStream();
+    return;
+  }
+
+  upstream_request_ = std::make_unique<UpstreamRequest>(*this, *conn_pool_data, metadata_);
+  // The filter chain is continued once the retry is sent, if it has been stopped.
+  upstream_request_->start();
+}
+
+void Router::continueDecoding() {
+  // Only invoke continueDecoding if we'd previously stopped the filter chain.
+  if (!decoding_stopped_) {
+    return;
+  }
+  decoding_stopped_ = false;
+  filter_complete_ = true;
+  callbacks_->continueDecoding();
+}
+
+void Router::releaseStream() {
+  if (filter_complete_) {
+    // The filter chain has ended, call resetStream to release the current stream, which eventually
+    // triggers the onDestroy function call.
+    callbacks_->resetStream();
+    return;
+  }
+
+  // The local reply triggers the release of the current stream at the end of the filter chain.
+  continueDecoding();
+}
+
+void Router::releaseRetry() {
+  if (retry_held_) {
+    retry_held_ = false;
+    cluster_->resourceManager(Upstream::ResourcePriority::Default).retries().dec();
+  }
+}
+
 void Router::cleanup() {
+  // The rest of a streamed request is discarded once the stream is released.
+  streaming_ = false;
+  response_streaming_ = false;
+  upstream_read_disabled_ = false;
+  disarm();
+  releaseRetry();
   if (upstream_request_) {
     upstream_request_.reset();
   }
+  if (upstream_span_ != nullptr) {
+    if (retries_ > 0) {
+      upstream_span_->setTag("retries", std::to_string(retries_));
+    }
+    upstream_span_->finishSpan();
+    upstream_span_.reset();
+  }
 }
 
 Router::UpstreamRequest::UpstreamRequest(Router& parent, Upstream::TcpPoolData& pool_data,
@@ -198,9 +643,26 @@ Router::UpstreamRequest::UpstreamRequest(Router& parent, Upstream::TcpPoolData&
     : parent_(parent), conn_pool_data_(pool_data), metadata_(metadata), request_complete_(false),
       response_started_(false), response_complete_(false), stream_reset_(false) {}
 
-Router::UpstreamRequest::~UpstreamRequest() = default;
+Router::UpstreamRequest::~UpstreamRequest() {
+  if (multiplexed_connection_ != nullptr) {
+    multiplexed_connection_->removeRequest(*this, upstream_request_id_);
+  }
+}
 
 FilterStatus Router::UpstreamRequest::start() {
+  pool_start_time_ = parent_.now();
+  // The streamed body would hold up the other requests of a multiplexed connection.
+  if (parent_.multiplexer_ != nullptr && !parent_.streamed_) {
+    // The request may be sent, or fail, synchronously.
+    parent_.multiplexer_->addRequest(conn_pool_data_, *parent_.callbacks_, *this);
+    if (request_complete_ || multiplexed_connection_ == nullptr) {
+      return FilterStatus::Continue;
+    }
+
+    // Pause while we wait for the multiplexed connection.
+    return FilterStatus::StopIteration;
+  }
+
   Tcp::ConnectionPool::Cancellable* handle = conn_pool_data_.newConnection(*this);
   if (handle) {
     // Pause while we wait for a connection.
@@ -214,6 +676,13 @@ FilterStatus Router::UpstreamRequest::start() {
 void Router::UpstreamRequest::resetStream() {
   stream_reset_ = true;
 
+  if (multiplexed_connection_ != nullptr) {
+    // Other requests may still be in flight on the connection, only this request is removed.
+    multiplexed_connection_->removeRequest(*this, upstream_request_id_);
+    multiplexed_connection_ = nullptr;
+    ENVOY_LOG(debug, "meta protocol upstream request: removed from multiplexed connection");
+  }
+
   if (conn_pool_handle_) {
     ASSERT(!conn_data_);
     conn_pool_handle_->cancel(Tcp::ConnectionPool::CancelPolicy::Default);
@@ -224,15 +693,18 @@ void Router::UpstreamRequest::resetStream() {
   if (conn_data_) {
     ASSERT(!conn_pool_handle_);
     conn_data_->connection().close(Network::ConnectionCloseType::NoFlush);
+    response_demux_ = nullptr;
     conn_data_.reset();
     ENVOY_LOG(debug, "meta protocol upstream request: reset connection data");
   }
 }
 
-void Router::UpstreamRequest::encodeData(Buffer::Instance& data) {
+void Router::UpstreamRequest::encodeData() {
   ASSERT(conn_data_);
   ASSERT(!conn_pool_handle_);
 
+  Buffer::OwnedImpl copy;
+  Buffer::Instance& data = parent_.requestData(copy);
   ENVOY_STREAM_LOG(trace, "proxying {} bytes", *parent_.callbacks_, data.length());
   conn_data_->connection().write(data, false);
 }
@@ -241,54 +713,148 @@ void Router::UpstreamRequest::onPoolFailure(ConnectionPool::PoolFailureReason re
                                             absl::string_view,
                                             Upstream::HostDescriptionConstSharedPtr host) {
   conn_pool_handle_ = nullptr;
-
-  // Mimic an upstream reset.
   onUpstreamHostSelected(host);
-  onResetStream(reason);
 
-  parent_.upstream_request_buffer_.drain(parent_.upstream_request_buffer_.length());
+  if (reason == ConnectionPool::PoolFailureReason::Timeout) {
+    host->outlierDetector().putResult(Upstream::Outlier::Result::LocalOriginTimeout);
+  } else if (reason == ConnectionPool::PoolFailureReason::RemoteConnectionFailure) {
+    host->outlierDetector().putResult(Upstream::Outlier::Result::LocalOriginConnectFailed);
+  }
 
-  // If it is a connection error, it means that the connection pool returned
-  // the error asynchronously and the upper layer needs to be notified to continue decoding.
-  // If it is a non-connection error, it is returned synchronously from the connection pool
-  // and is still in the callback at the current Filter, nothing to do.
-  if (reason == ConnectionPool::PoolFailureReason::Timeout ||
-      reason == ConnectionPool::PoolFailureReason::LocalConnectionFailure ||
-      reason == ConnectionPool::PoolFailureReason::RemoteConnectionFailure) {
-    if (reason == ConnectionPool::PoolFailureReason::Timeout) {
-      host->outlierDetector().putResult(Upstream::Outlier::Result::LocalOriginTimeout);
-    } else if (reason == ConnectionPool::PoolFailureReason::RemoteConnectionFailure) {
-      host->outlierDetector().putResult(Upstream::Outlier::Result::LocalOriginConnectFailed);
-    }
-    parent_.callbacks_->continueDecoding();
+  if (reason != ConnectionPool::PoolFailureReason::Overflow &&
+      parent_.shouldRetry(RetryPolicy::RetryOn::ConnectFailure)) {
+    parent_.retry();
+    return;
   }
+
+  // Mimic an upstream reset. An overflow is returned synchronously from the connection pool, while
+  // a connection error is returned asynchronously and the filter chain is continued.
+  onResetStream(reason);
+
+  parent_.upstream_request_buffer_.drain(parent_.upstream_request_buffer_.length());
 }
 
 void Router::UpstreamRequest::onPoolReady(Tcp::ConnectionPool::ConnectionDataPtr&& conn_data,
                                           Upstream::HostDescriptionConstSharedPtr host) {
   ENVOY_LOG(debug, "meta protocol upstream request: tcp connection has ready");
 
-  // Only invoke continueDecoding if we'd previously stopped the filter chain.
-  bool continue_decoding = conn_pool_handle_ != nullptr;
-
   onUpstreamHostSelected(host);
   host->outlierDetector().putResult(Upstream::Outlier::Result::LocalOriginConnectSuccess);
 
   conn_data_ = std::move(conn_data);
   conn_data_->addUpstreamCallbacks(parent_);
   conn_pool_handle_ = nullptr;
+  onConnectionAcquired();
+
+  response_demux_ = &ResponseDemultiplexer::attach(
+      *conn_data_, parent_.callbacks_->codecHash(),
+      [this]() { return parent_.callbacks_->createCodec(); });
+  ASSERT(response_demux_->idle());
+  // The connection may have been used by a router with another threshold.
+  response_demux_->setStreamingThreshold(parent_.response_streaming_threshold_);
+  if (metadata_->getMessageType() != MessageType::Oneway) {
+    response_demux_->add(requestId(), *this);
+  }
+
+  onRequestStart();
+  parent_.streaming_ = parent_.streamed_;
+  encodeData();
+  if (parent_.streaming_ && !conn_data_->connection().aboveHighWatermark()) {
+    parent_.callbacks_->setStreamedBodyHandler(&parent_);
+  }
+}
 
-  onRequestStart(continue_decoding);
-  encodeData(parent_.upstream_request_buffer_);
+bool Router::UpstreamRequest::rewriteRequestId(Codec& codec, uint64_t upstream_id) {
+  // The kept request is rewritten, a retry on another connection rewrites it again.
+  return codec.rewriteRequestId(parent_.upstream_request_buffer_, upstream_id);
 }
 
-void Router::UpstreamRequest::onRequestStart(bool continue_decoding) {
+void Router::UpstreamRequest::onConnectionAssigned(MultiplexedConnection& connection,
+                                                   uint64_t upstream_id) {
+  multiplexed_connection_ = &connection;
+  upstream_request_id_ = upstream_id;
+}
+
+void Router::UpstreamRequest::onConnectionReady(MultiplexedConnection& connection,
+                                                Upstream::HostDescriptionConstSharedPtr host) {
+  ENVOY_LOG(debug, "meta protocol upstream request: multiplexed connection has ready");
+
+  ASSERT(multiplexed_connection_ == &connection);
+  onUpstreamHostSelected(host);
+  onConnectionAcquired();
+
+  Buffer::OwnedImpl copy;
+  Buffer::Instance& data = parent_.requestData(copy);
+  ENVOY_STREAM_LOG(trace, "proxying {} bytes", *parent_.callbacks_, data.length());
+  const bool oneway = metadata_->getMessageType() == MessageType::Oneway;
+  connection.write(*this, upstream_request_id_, data, oneway);
+  if (oneway) {
+    multiplexed_connection_ = nullptr;
+  }
+
+  onRequestStart();
+}
+
+void Router::UpstreamRequest::onConnectionFailure(ConnectionPool::PoolFailureReason reason,
+                                                  Upstream::HostDescriptionConstSharedPtr host) {
+  multiplexed_connection_ = nullptr;
+  onUpstreamHostSelected(host);
+
+  if (reason != ConnectionPool::PoolFailureReason::Overflow &&
+      parent_.shouldRetry(RetryPolicy::RetryOn::ConnectFailure)) {
+    parent_.retry();
+    return;
+  }
+
+  // Mimic an upstream reset, the outlier detector has been notified by the connection.
+  onResetStream(reason);
+
+  parent_.upstream_request_buffer_.drain(parent_.upstream_request_buffer_.length());
+}
+
+void Router::UpstreamRequest::onResponse(MetadataSharedPtr metadata, MutationSharedPtr mutation) {
+  multiplexed_connection_ = nullptr;
+  parent_.stats_.upstream_rq_time_us_.recordValue(
+      std::chrono::duration_cast<std::chrono::microseconds>(parent_.now() - request_sent_time_)
+          .count());
+  parent_.onUpstreamResponse(metadata, mutation);
+}
+
+void Router::UpstreamRequest::onResponseBody(Buffer::Instance& data, bool end_stream) {
+  parent_.onUpstreamResponseBody(data, end_stream);
+}
+
+void Router::UpstreamRequest::onResponseError(const std::string& what) {
+  multiplexed_connection_ = nullptr;
+  if (response_complete_ || stream_reset_) {
+    return;
+  }
+
+  parent_.onUpstreamResponseError(what);
+}
+
+void Router::UpstreamRequest::onConnectionClose(Network::ConnectionEvent event) {
+  multiplexed_connection_ = nullptr;
+  if (response_complete_ || stream_reset_) {
+    return;
+  }
+
+  if (event == Network::ConnectionEvent::RemoteClose &&
+      parent_.shouldRetry(RetryPolicy::RetryOn::Reset)) {
+    parent_.retry();
+    return;
+  }
+
+  onResetStream(event == Network::ConnectionEvent::RemoteClose
+                    ? ConnectionPool::PoolFailureReason::RemoteConnectionFailure
+                    : ConnectionPool::PoolFailureReason::LocalConnectionFailure);
+}
+
+void Router::UpstreamRequest::onRequestStart() {
   ENVOY_LOG(debug, "meta protocol upstream request: start sending data to the server {}",
             upstream_host_->address()->asString());
 
-  if (continue_decoding) {
-    parent_.callbacks_->continueDecoding();
-  }
+  parent_.continueDecoding();
   onRequestComplete();
 }
 
@@ -296,16 +862,37 @@ void Router::UpstreamRequest::onRequestComplete() { request_complete_ = true; }
 
 void Router::UpstreamRequest::onResponseComplete() {
   response_complete_ = true;
+  if (conn_data_ != nullptr && !response_demux_->idle()) {
+    // Unexpected data is left on the connection, it can't be returned to the pool.
+    ENVOY_LOG(debug, "meta protocol upstream request: close the connection with unexpected data");
+    conn_data_->connection().close(Network::ConnectionCloseType::NoFlush);
+  }
+  response_demux_ = nullptr;
   conn_data_.reset();
 }
 
+void Router::UpstreamRequest::onConnectionAcquired() {
+  request_sent_time_ = parent_.now();
+  parent_.stats_.upstream_cx_pool_wait_time_us_.recordValue(
+      std::chrono::duration_cast<std::chrono::microseconds>(request_sent_time_ - pool_start_time_)
+          .count());
+}
+
 void Router::UpstreamRequest::onUpstreamHostSelected(Upstream::HostDescriptionConstSharedPtr host) {
   ENVOY_LOG(debug, "meta protocol upstream request: selected upstream {}",
             host->address()->asString());
   upstream_host_ = host;
+  parent_.callbacks_->streamInfo().onUpstreamHostSelected(host);
+  if (parent_.upstream_span_ != nullptr) {
+    parent_.upstream_span_->setTag(Tracing::Tags::get().UpstreamAddress,
+                                   host->address()->asString());
+  }
 }
 
 void Router::UpstreamRequest::onResetStream(ConnectionPool::PoolFailureReason reason) {
+  parent_.disarm();
+  parent_.onUpstreamFailure();
+
   if (metadata_->getMessageType() == MessageType::Oneway) {
     // For oneway requests, we should not attempt a response. Reset the downstream to signal
     // an error.
@@ -355,11 +942,8 @@ void Router::UpstreamRequest::onResetStream(ConnectionPool::PoolFailureReason re
     NOT_REACHED_GCOVR_EXCL_LINE;
   }
 
-  if (parent_.filter_complete_ && !response_complete_) {
-    // When the filter's callback has ended and the reply message has not been processed,
-    // call resetStream to release the current stream.
-    // the resetStream eventually triggers the onDestroy function call.
-    parent_.callbacks_->resetStream();
+  if (!response_complete_) {
+    parent_.releaseStream();
   }
 }
 
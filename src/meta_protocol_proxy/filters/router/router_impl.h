@@ -2,9 +2,15 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "envoy/buffer/buffer.h"
+#include "envoy/event/deferred_deletable.h"
+#include "envoy/event/timer.h"
+#include "envoy/stats/scope.h"
+#include "envoy/stats/stats_macros.h"
 #include "envoy/tcp/conn_pool.h"
+#include "envoy/tracing/http_tracer.h"
 #include "envoy/upstream/thread_local_cluster.h"
 
 #include "source/common/common/logger.h"
@@ -12,7 +18,11 @@
 #include "source/common/upstream/load_balancer_impl.h"
 
 #include "src/meta_protocol_proxy/filters/filter.h"
+#include "src/meta_protocol_proxy/filters/router/multiplexed_connection.h"
+#include "src/meta_protocol_proxy/filters/router/request_timeout.h"
+#include "src/meta_protocol_proxy/filters/router/response_demultiplexer.h"
 #include "src/meta_protocol_proxy/filters/router/router.h"
+#include "src/meta_protocol_proxy/filters/router/scoped_stats.h"
 
 namespace Envoy {
 namespace Extensions {
@@ -20,12 +30,67 @@ namespace NetworkFilters {
 namespace MetaProtocolProxy {
 namespace Router {
 
+/**
+ * All meta protocol router filter stats. @see stats_macros.h
+ *
+ * The stage histograms in microseconds:
+ * - upstream_cx_pool_wait_time_us: from asking the connection pool, or the multiplexer, for a
+ *   connection until the request can be written to it.
+ * - upstream_rq_time_us: from the request being written to the upstream until its response is
+ *   decoded.
+ */
+#define ALL_META_PROTOCOL_ROUTER_STATS(COUNTER, HISTOGRAM)                                         \
+  COUNTER(upstream_rq_timeout)                                                                     \
+  HISTOGRAM(upstream_cx_pool_wait_time_us, Microseconds)                                           \
+  HISTOGRAM(upstream_rq_time_us, Microseconds)
+
+/**
+ * Struct definition for all meta protocol router filter stats. @see stats_macros.h
+ */
+struct RouterStats {
+  ALL_META_PROTOCOL_ROUTER_STATS(GENERATE_COUNTER_STRUCT, GENERATE_HISTOGRAM_STRUCT)
+
+  static RouterStats generateStats(const std::string& prefix, Stats::Scope& scope) {
+    return RouterStats{ALL_META_PROTOCOL_ROUTER_STATS(POOL_COUNTER_PREFIX(scope, prefix),
+                                                      POOL_HISTOGRAM_PREFIX(scope, prefix))};
+  }
+};
+
+/**
+ * Router forwards a request to an upstream host of the route's cluster and hands the response over
+ * to the filter chain.
+ *
+ * A failed upstream request is retried according to the route's retry policy. The request bytes are
+ * kept in upstream_request_buffer_ and a copy is written to the upstream, so a retry resends the
+ * request without decoding it again. The retries are sent to the hosts which haven't been
+ * attempted, and the concurrent retries of a cluster are bounded by its retry circuit breaker.
+ *
+ * A streamed request is written to a dedicated upstream connection as it arrives and it's never
+ * retried. The streaming is paused while the upstream connection is above its write buffer high
+ * watermark.
+ *
+ * A response larger than the response streaming threshold is forwarded once its head is decoded,
+ * and its body is forwarded as it arrives. Reading the response is paused while the downstream
+ * connection is above its write buffer high watermark.
+ *
+ * The upstream call of a traced request is a client span, the child of the server span of the
+ * request, which spans the retries. Its trace context is put in the mutation of the request, so
+ * it's sent to the upstream if the codec re-encodes the request, e.g. as Dubbo attachments.
+ */
 class Router : public Tcp::ConnectionPool::UpstreamCallbacks,
                public Upstream::LoadBalancerContextBase,
                public CodecFilter,
+               public RequestTimeout,
+               public StreamedBodyHandler,
+               public DownstreamWatermarkCallbacks,
                Logger::Loggable<Logger::Id::filter> {
 public:
-  Router(Upstream::ClusterManager& cluster_manager) : cluster_manager_(cluster_manager) {}
+  Router(Upstream::ClusterManager& cluster_manager, const RouterStats& stats,
+         RequestTimeoutManager& timeouts, MultiplexedConnectionManager* multiplexer,
+         uint32_t response_streaming_threshold, const ScopedStats* scoped_stats)
+      : cluster_manager_(cluster_manager), stats_(stats), timeouts_(timeouts),
+        multiplexer_(multiplexer), response_streaming_threshold_(response_streaming_threshold),
+        scoped_stats_(scoped_stats) {}
   ~Router() override = default;
 
   // DecoderFilter
@@ -43,25 +108,40 @@ public:
   // Upstream::LoadBalancerContextBase
   const Envoy::Router::MetadataMatchCriteria* metadataMatchCriteria() override { return nullptr; }
   const Network::Connection* downstreamConnection() const override;
+  absl::optional<uint64_t> computeHashKey() override;
+  bool shouldSelectAnotherHost(const Upstream::Host& host) override;
+  uint32_t hostSelectionRetryCount() const override;
 
   // Tcp::ConnectionPool::UpstreamCallbacks
   void onUpstreamData(Buffer::Instance& data, bool end_stream) override;
   void onEvent(Network::ConnectionEvent event) override;
-  void onAboveWriteBufferHighWatermark() override {}
-  void onBelowWriteBufferLowWatermark() override {}
+  void onAboveWriteBufferHighWatermark() override;
+  void onBelowWriteBufferLowWatermark() override;
+
+  // RequestTimeout
+  void onRequestTimeout() override;
+
+  // StreamedBodyHandler
+  void onStreamedBody(Buffer::Instance& data, bool end_stream) override;
+
+  // DownstreamWatermarkCallbacks
+  void onDownstreamAboveWriteBufferHighWatermark() override;
+  void onDownstreamBelowWriteBufferLowWatermark() override;
 
   // This function is for testing only.
   Envoy::Buffer::Instance& upstreamRequestBufferForTest() { return upstream_request_buffer_; }
 
 private:
-  struct UpstreamRequest : public Tcp::ConnectionPool::Callbacks {
+  struct UpstreamRequest : public Tcp::ConnectionPool::Callbacks,
+                           public MultiplexedRequest,
+                           public Event::DeferredDeletable {
     UpstreamRequest(Router& parent, Upstream::TcpPoolData& pool_data,
                     MetadataSharedPtr& metadata);
     ~UpstreamRequest() override;
 
     FilterStatus start();
     void resetStream();
-    void encodeData(Buffer::Instance& data);
+    void encodeData();
 
     // Tcp::ConnectionPool::Callbacks
     void onPoolFailure(ConnectionPool::PoolFailureReason reason,
@@ -70,10 +150,27 @@ private:
     void onPoolReady(Tcp::ConnectionPool::ConnectionDataPtr&& conn,
                      Upstream::HostDescriptionConstSharedPtr host) override;
 
-    void onRequestStart(bool continue_decoding);
+    // MultiplexedRequest
+    uint64_t requestId() const override { return metadata_->getRequestId(); }
+    bool rewriteRequestId(Codec& codec, uint64_t upstream_id) override;
+    void onConnectionAssigned(MultiplexedConnection& connection, uint64_t upstream_id) override;
+    void onConnectionReady(MultiplexedConnection& connection,
+                           Upstream::HostDescriptionConstSharedPtr host) override;
+    void onConnectionFailure(ConnectionPool::PoolFailureReason reason,
+                             Upstream::HostDescriptionConstSharedPtr host) override;
+
+    // ResponseHandler
+    void onResponse(MetadataSharedPtr metadata, MutationSharedPtr mutation) override;
+    void onResponseBody(Buffer::Instance& data, bool end_stream) override;
+    void onResponseError(const std::string& what) override;
+    void onConnectionClose(Network::ConnectionEvent event) override;
+
+    void onRequestStart();
     void onRequestComplete();
     void onResponseComplete();
     void onUpstreamHostSelected(Upstream::HostDescriptionConstSharedPtr host);
+    // Records the time waited for the connection, the request is written right after.
+    void onConnectionAcquired();
     void onResetStream(ConnectionPool::PoolFailureReason reason);
 
     Router& parent_;
@@ -83,7 +180,15 @@ private:
 
     Tcp::ConnectionPool::Cancellable* conn_pool_handle_{};
     Tcp::ConnectionPool::ConnectionDataPtr conn_data_;
+    // The demultiplexer attached to conn_data_, it's owned by the connection.
+    ResponseDemultiplexer* response_demux_{};
+    MultiplexedConnection* multiplexed_connection_{};
+    // The request ID the request is sent with on multiplexed_connection_.
+    uint64_t upstream_request_id_{};
     Upstream::HostDescriptionConstSharedPtr upstream_host_;
+    // When the connection was asked for, and when the request was written to the upstream.
+    MonotonicTime pool_start_time_;
+    MonotonicTime request_sent_time_;
 
     bool request_complete_ : 1;
     bool response_started_ : 1;
@@ -91,9 +196,39 @@ private:
     bool stream_reset_ : 1;
   };
 
+  void onUpstreamResponse(MetadataSharedPtr metadata, MutationSharedPtr mutation);
+  void onUpstreamResponseBody(Buffer::Instance& data, bool end_stream);
+  void onUpstreamResponseError(const std::string& what);
+  // Resets the upstream request and the downstream connection when a streamed response is cut
+  // short, a local reply can't follow the part of the response which has been forwarded.
+  void onStreamedResponseReset();
+  // Charges the scoped stats and tags the client span when the upstream request fails.
+  void onUpstreamFailure();
+  // Starts the client span of a traced request and injects its context into the mutation.
+  void startUpstreamSpan(Tracing::Span& parent, Mutation* mutation);
+  void setUpstreamReadDisabled(bool disabled);
+  // Returns the request to be written to the upstream. It's a copy of upstream_request_buffer_ if
+  // the request may be retried.
+  Buffer::Instance& requestData(Buffer::Instance& copy);
+  // Returns whether the request should be retried under the given condition. If condition is
+  // absl::nullopt, the retry is requested by a filter and only the retry limits apply.
+  bool shouldRetry(absl::optional<RetryPolicy::RetryOn> condition);
+  void retry();
+  void doRetry();
+  void continueDecoding();
+  // Releases the current stream after a local reply is sent out of onMessageDecoded().
+  void releaseStream();
+  void releaseRetry();
   void cleanup();
+  MonotonicTime now() const { return callbacks_->dispatcher().timeSource().monotonicTime(); }
 
   Upstream::ClusterManager& cluster_manager_;
+  const RouterStats& stats_;
+  RequestTimeoutManager& timeouts_;
+  MultiplexedConnectionManager* multiplexer_;
+  const uint32_t response_streaming_threshold_;
+  // The per route, per cluster and per method stats, or nullptr if they're disabled.
+  const ScopedStats* scoped_stats_;
 
   DecoderFilterCallbacks* callbacks_{};
   EncoderFilterCallbacks* encoder_callbacks_{};
@@ -101,9 +236,33 @@ private:
   const RouteEntry* route_entry_{};
   Upstream::ClusterInfoConstSharedPtr cluster_;
 
+  MetadataSharedPtr metadata_;
+  ScopedStats::Scopes stat_scopes_;
+  // When the request was routed, the response time in the scoped stats is measured from it.
+  MonotonicTime routed_time_;
+  // The client span of a traced request, it's finished when the router is cleaned up.
+  Tracing::SpanPtr upstream_span_;
   std::unique_ptr<UpstreamRequest> upstream_request_;
   Envoy::Buffer::OwnedImpl upstream_request_buffer_;
 
+  // The hosts the request has been sent to, they're avoided when a host is selected for a retry.
+  std::vector<Upstream::HostDescriptionConstSharedPtr> attempted_hosts_;
+  Event::TimerPtr retry_timer_;
+  uint32_t retries_{0};
+  // Whether a retry of the cluster's retry circuit breaker is held by this request.
+  bool retry_held_{false};
+
+  // Whether the request is followed by a streamed body.
+  bool streamed_{false};
+  // Whether the streamed body is being written to the upstream connection.
+  bool streaming_{false};
+  // Whether the body of a streamed response is being forwarded to the downstream.
+  bool response_streaming_{false};
+  // Whether reading the upstream connection has been disabled by this filter.
+  bool upstream_read_disabled_{false};
+  // Whether the filter chain has been stopped by onMessageDecoded().
+  bool decoding_stopped_{false};
+  // Whether the filter chain has gone past this filter.
   bool filter_complete_{false};
 };
 
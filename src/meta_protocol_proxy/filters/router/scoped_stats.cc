@@ -0,0 +1,144 @@
+#include "src/meta_protocol_proxy/filters/router/scoped_stats.h"
+
+#include "source/common/protobuf/utility.h"
+#include "source/common/stats/utility.h"
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/strip.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace Router {
+
+ScopedStats::ScopedStats(const ScopedStatsConfig& config, const std::string& stat_prefix,
+                         Stats::Scope& scope, ThreadLocal::SlotAllocator& tls)
+    : scope_(scope), stat_names_(scope.symbolTable()), per_route_(config.per_route()),
+      per_cluster_(config.per_cluster()),
+      max_methods_(PROTOBUF_GET_WRAPPED_OR_DEFAULT(config, max_methods, 0)),
+      prefix_(stat_names_.add(absl::StripSuffix(stat_prefix, "."))),
+      route_(stat_names_.add("route")), cluster_(stat_names_.add("cluster")),
+      method_(stat_names_.add("method")), other_(stat_names_.add("other")),
+      request_(stat_names_.add("request")),
+      response_success_(stat_names_.add("response_success")),
+      response_error_(stat_names_.add("response_error")),
+      request_timeout_(stat_names_.add("request_timeout")),
+      upstream_failure_(stat_names_.add("upstream_failure")),
+      response_time_us_(stat_names_.add("response_time_us")) {
+  worker_scopes_ = tls.allocateSlot();
+  worker_scopes_->set([](Event::Dispatcher&) -> ThreadLocal::ThreadLocalObjectSharedPtr {
+    return std::make_shared<WorkerScopes>();
+  });
+}
+
+bool ScopedStats::enabled(const ScopedStatsConfig& config) {
+  return config.per_route() || config.per_cluster() ||
+         PROTOBUF_GET_WRAPPED_OR_DEFAULT(config, max_methods, 0) > 0;
+}
+
+void ScopedStats::resolveScopes(const RouteEntry& route, const Metadata& metadata,
+                                Scopes& scopes) const {
+  scopes.clear();
+  auto& worker = worker_scopes_->getTyped<WorkerScopes>();
+  if (per_route_ && !route.routeStatName().empty()) {
+    scopes.push_back(&cachedScopeStats(worker.routes_, route_, route.routeStatName()));
+  }
+  if (per_cluster_) {
+    scopes.push_back(&cachedScopeStats(worker.clusters_, cluster_, route.clusterStatName()));
+  }
+  if (max_methods_ > 0) {
+    const ScopeStats* stats = methodScopeStats(worker, metadata);
+    if (stats != nullptr) {
+      scopes.push_back(stats);
+    }
+  }
+}
+
+void ScopedStats::chargeRequest(const Scopes& scopes) const {
+  for (const ScopeStats* stats : scopes) {
+    stats->request_.inc();
+  }
+}
+
+void ScopedStats::chargeResponse(const Scopes& scopes, const Metadata& response,
+                                 std::chrono::microseconds response_time) const {
+  const bool error = response.getResponseStatus() == ResponseStatus::Error ||
+                     response.getMessageType() == MessageType::Error;
+  for (const ScopeStats* stats : scopes) {
+    (error ? stats->response_error_ : stats->response_success_).inc();
+    stats->response_time_us_.recordValue(response_time.count());
+  }
+}
+
+void ScopedStats::chargeRequestTimeout(const Scopes& scopes) const {
+  for (const ScopeStats* stats : scopes) {
+    stats->request_timeout_.inc();
+  }
+}
+
+void ScopedStats::chargeUpstreamFailure(const Scopes& scopes) const {
+  for (const ScopeStats* stats : scopes) {
+    stats->upstream_failure_.inc();
+  }
+}
+
+ScopedStats::ScopeStats ScopedStats::scopeStats(Stats::StatName kind,
+                                                Stats::StatName name) const {
+  const auto counter = [this, kind, name](Stats::StatName stat) -> Stats::Counter& {
+    return Stats::Utility::counterFromStatNames(scope_, {prefix_, kind, name, stat});
+  };
+  Stats::Histogram& response_time_us = Stats::Utility::histogramFromStatNames(
+      scope_, {prefix_, kind, name, response_time_us_}, Stats::Histogram::Unit::Microseconds);
+  return {counter(request_),         counter(response_success_), counter(response_error_),
+          counter(request_timeout_), counter(upstream_failure_), response_time_us};
+}
+
+const ScopedStats::ScopeStats&
+ScopedStats::cachedScopeStats(absl::flat_hash_map<std::string, ScopeStatsPtr>& cache,
+                              Stats::StatName kind, Stats::StatName name) const {
+  const absl::string_view key(reinterpret_cast<const char*>(name.data()), name.dataSize());
+  auto it = cache.find(key);
+  if (it == cache.end()) {
+    auto stats = std::make_unique<const ScopeStats>(scopeStats(kind, name));
+    it = cache.emplace(std::string(key), std::move(stats)).first;
+  }
+  return *it->second;
+}
+
+// A dynamic stat name is encoded without the symbol table lock.
+ScopedStats::MethodScope::MethodScope(const std::string& name, const ScopedStats& parent)
+    : name_(name, parent.scope_.symbolTable()),
+      stats_(parent.scopeStats(parent.method_, name_.statName())) {}
+
+const ScopedStats::ScopeStats* ScopedStats::methodScopeStats(WorkerScopes& worker,
+                                                             const Metadata& metadata) const {
+  const absl::string_view method = metadata.getString("method");
+  if (method.empty()) {
+    return nullptr;
+  }
+
+  const absl::string_view interface = metadata.getString("interface");
+  std::string key = interface.empty() ? std::string(method) : absl::StrCat(interface, ".", method);
+  auto it = worker.methods_.find(key);
+  if (it != worker.methods_.end()) {
+    return &it->second->stats_;
+  }
+  if (worker.methods_.size() >= max_methods_) {
+    if (worker.other_method_ == nullptr) {
+      worker.other_method_ = std::make_unique<const ScopeStats>(scopeStats(method_, other_));
+    }
+    return worker.other_method_.get();
+  }
+
+  auto scope = std::make_unique<const MethodScope>(key, *this);
+  const ScopeStats* stats = &scope->stats_;
+  worker.methods_.emplace(std::move(key), std::move(scope));
+  return stats;
+}
+
+} // namespace Router
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
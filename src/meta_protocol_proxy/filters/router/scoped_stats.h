@@ -0,0 +1,150 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "envoy/stats/histogram.h"
+#include "envoy/stats/scope.h"
+#include "envoy/stats/stats.h"
+#include "envoy/stats/symbol_table.h"
+#include "envoy/thread_local/thread_local.h"
+
+#include "source/common/stats/symbol_table_impl.h"
+
+#include "api/router/v1alpha/router.pb.h"
+
+#include "src/meta_protocol_proxy/codec/codec.h"
+#include "src/meta_protocol_proxy/filters/router/router.h"
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/inlined_vector.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace Router {
+
+/**
+ * ScopedStats counts the requests and their responses per route, per upstream cluster and per
+ * method, under the stat prefix of the router:
+ * - <stat_prefix>route.<route name>.<stat>, the routes without a name aren't counted.
+ * - <stat_prefix>cluster.<cluster name>.<stat>
+ * - <stat_prefix>method.<method>.<stat>, the method is "<interface>.<method>" if the request has an
+ *   interface, e.g. a Dubbo request.
+ *
+ * The stats of each scope:
+ * - request: the requests routed to the scope.
+ * - response_success, response_error: the upstream responses, by the status decoded by the codec.
+ * - request_timeout: the requests timed out before the response.
+ * - upstream_failure: the requests failed by the upstream connection, or by a bad response.
+ * - response_time_us: the histogram of the time from the request being routed until its response
+ *   is decoded, the retries included.
+ *
+ * The stats of a scope are looked up once on each worker thread, when its first request is routed,
+ * and are kept in a cache of the worker, so the requests are counted without looking up the stats
+ * in the store. The route and cluster names are interned with the route configuration, and the
+ * method names are encoded as dynamic stat names, so the cache is filled without taking the symbol
+ * table lock.
+ *
+ * The cache of each worker thread holds up to max_methods methods, the requests of the other
+ * methods are counted under method.other. As the workers meet the methods independently, up to
+ * (number of workers) * max_methods methods are counted in total, and the requests of a method may
+ * be counted under its own name on a worker and under method.other on another.
+ */
+class ScopedStats {
+public:
+  using ScopedStatsConfig = envoy::extensions::filters::meta_protocol_proxy::router::v1alpha::
+      ScopedStats;
+
+  ScopedStats(const ScopedStatsConfig& config, const std::string& stat_prefix, Stats::Scope& scope,
+              ThreadLocal::SlotAllocator& tls);
+
+  /**
+   * @return bool whether any scope is enabled by the configuration.
+   */
+  static bool enabled(const ScopedStatsConfig& config);
+
+  // The stats of a scope, e.g. of a cluster.
+  struct ScopeStats {
+    Stats::Counter& request_;
+    Stats::Counter& response_success_;
+    Stats::Counter& response_error_;
+    Stats::Counter& request_timeout_;
+    Stats::Counter& upstream_failure_;
+    Stats::Histogram& response_time_us_;
+  };
+
+  /**
+   * The stats of the scopes of a request. They're valid on the worker thread they're resolved on,
+   * as long as the ScopedStats.
+   */
+  using Scopes = absl::InlinedVector<const ScopeStats*, 3>;
+
+  /**
+   * Resolves the scopes of a routed request, it must be called on a worker thread.
+   * @param route the route entry of the request
+   * @param metadata the metadata of the request
+   * @param scopes receives the scopes of the request
+   */
+  void resolveScopes(const RouteEntry& route, const Metadata& metadata, Scopes& scopes) const;
+
+  void chargeRequest(const Scopes& scopes) const;
+  void chargeResponse(const Scopes& scopes, const Metadata& response,
+                      std::chrono::microseconds response_time) const;
+  void chargeRequestTimeout(const Scopes& scopes) const;
+  void chargeUpstreamFailure(const Scopes& scopes) const;
+
+private:
+  using ScopeStatsPtr = std::unique_ptr<const ScopeStats>;
+
+  struct MethodScope {
+    MethodScope(const std::string& name, const ScopedStats& parent);
+
+    Stats::StatNameDynamicStorage name_;
+    const ScopeStats stats_;
+  };
+
+  // The scopes a worker thread has met, they're kept until the configuration is removed. The
+  // routes and the clusters are keyed by the encoding of their stat names, which isn't reused for
+  // other names while the cached stats hold the symbols of the names.
+  struct WorkerScopes : public ThreadLocal::ThreadLocalObject {
+    absl::flat_hash_map<std::string, ScopeStatsPtr> routes_;
+    absl::flat_hash_map<std::string, ScopeStatsPtr> clusters_;
+    absl::flat_hash_map<std::string, std::unique_ptr<const MethodScope>> methods_;
+    ScopeStatsPtr other_method_;
+  };
+
+  ScopeStats scopeStats(Stats::StatName kind, Stats::StatName name) const;
+  const ScopeStats& cachedScopeStats(absl::flat_hash_map<std::string, ScopeStatsPtr>& cache,
+                                     Stats::StatName kind, Stats::StatName name) const;
+  const ScopeStats* methodScopeStats(WorkerScopes& worker, const Metadata& metadata) const;
+
+  Stats::Scope& scope_;
+  Stats::StatNamePool stat_names_;
+  const bool per_route_;
+  const bool per_cluster_;
+  const uint32_t max_methods_;
+  ThreadLocal::SlotPtr worker_scopes_;
+
+  const Stats::StatName prefix_;
+  const Stats::StatName route_;
+  const Stats::StatName cluster_;
+  const Stats::StatName method_;
+  const Stats::StatName other_;
+  const Stats::StatName request_;
+  const Stats::StatName response_success_;
+  const Stats::StatName response_error_;
+  const Stats::StatName request_timeout_;
+  const Stats::StatName upstream_failure_;
+  const Stats::StatName response_time_us_;
+};
+
+using ScopedStatsSharedPtr = std::shared_ptr<const ScopedStats>;
+
+} // namespace Router
+} // namespace MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
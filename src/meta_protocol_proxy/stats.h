@@ -12,10 +12,20 @@ namespace MetaProtocolProxy {
 
 /**
  * All meta protocol  filter stats. @see stats_macros.h
+ *
+ * The stage histograms in microseconds:
+ * - request_decode_time_us: from the first byte of a request being received, or the previous
+ *   message being decoded if the request was buffered behind it, until the request is decoded.
+ * - request_filter_time_us: the time the decoder filter chain runs when a request is decoded,
+ *   until a filter stops the iteration, e.g. the router waiting for an upstream connection.
+ * - response_time_us: from an upstream response being decoded until it's written to the
+ *   downstream, including the encoder filters and the body of a streamed response.
+ * The upstream stages are measured by the router, see RouterStats.
  */
 #define ALL_META_PROTOCOL_PROXY_STATS(COUNTER, GAUGE, HISTOGRAM)                                   \
   COUNTER(cx_destroy_local_with_active_rq)                                                         \
   COUNTER(cx_destroy_remote_with_active_rq)                                                        \
+  COUNTER(cx_read_disabled)                                                                        \
   COUNTER(local_response_business_exception)                                                       \
   COUNTER(local_response_error)                                                                    \
   COUNTER(local_response_success)                                                                  \
@@ -33,7 +43,10 @@ namespace MetaProtocolProxy {
   COUNTER(response_error_caused_connection_close)                                                  \
   COUNTER(response_success)                                                                        \
   GAUGE(request_active, Accumulate)                                                                \
-  HISTOGRAM(request_time_ms, Milliseconds)
+  HISTOGRAM(request_decode_time_us, Microseconds)                                                  \
+  HISTOGRAM(request_filter_time_us, Microseconds)                                                  \
+  HISTOGRAM(request_time_ms, Milliseconds)                                                         \
+  HISTOGRAM(response_time_us, Microseconds)
 
 /**
  * Struct definition for all meta protocol  proxy stats. @see stats_macros.h
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+
+#include "source/common/stream_info/stream_info_impl.h"
+
+#include "src/meta_protocol_proxy/codec/codec.h"
+
+#include "absl/types/optional.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+
+/**
+ * MessageStreamInfo is the stream info of a meta protocol request. Besides what StreamInfoImpl
+ * records, it keeps the metadata of the request and its response and the time the request spent
+ * in each stage, which are logged by the meta protocol access log formatter commands.
+ */
+class MessageStreamInfo : public StreamInfo::StreamInfoImpl {
+public:
+  using StreamInfo::StreamInfoImpl::StreamInfoImpl;
+
+  /**
+   * The stages of a request, they follow each other without a gap:
+   * - Decode: from the first byte of the request being received until it's decoded.
+   * - Filter: the decoder filter chain running when the request is decoded.
+   * - Upstream: from then until the upstream response is decoded, including the wait for an
+   *   upstream connection and the retries.
+   * - Response: from the response being decoded until it's written to the downstream.
+   */
+  enum class Stage { Decode, Filter, Upstream, Response };
+  static constexpr size_t StageCount = 4;
+
+  void setRequestMetadata(MetadataSharedPtr metadata) { request_metadata_ = std::move(metadata); }
+  const Metadata* requestMetadata() const { return request_metadata_.get(); }
+  void setResponseMetadata(MetadataSharedPtr metadata) {
+    response_metadata_ = std::move(metadata);
+  }
+  const Metadata* responseMetadata() const { return response_metadata_.get(); }
+  void onLocalReply() { local_reply_ = true; }
+  bool localReply() const { return local_reply_; }
+
+  void setStageDuration(Stage stage, std::chrono::microseconds duration) {
+    stage_durations_[static_cast<size_t>(stage)] = duration;
+  }
+  absl::optional<std::chrono::microseconds> stageDuration(Stage stage) const {
+    return stage_durations_[static_cast<size_t>(stage)];
+  }
+
+private:
+  MetadataSharedPtr request_metadata_;
+  MetadataSharedPtr response_metadata_;
+  bool local_reply_{false};
+  std::array<absl::optional<std::chrono::microseconds>, StageCount> stage_durations_;
+};
+
+} // namespace MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
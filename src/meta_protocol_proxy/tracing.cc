@@ -0,0 +1,126 @@
+#include "src/meta_protocol_proxy/tracing.h"
+
+#include <vector>
+
+#include "envoy/singleton/manager.h"
+
+#include "source/common/common/macros.h"
+#include "source/common/http/header_map_impl.h"
+#include "source/common/tracing/http_tracer_config_impl.h"
+#include "source/common/tracing/http_tracer_impl.h"
+#include "source/common/tracing/http_tracer_manager_impl.h"
+
+#include "absl/strings/str_cat.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+
+SINGLETON_MANAGER_REGISTRATION(meta_protocol_http_tracer_manager);
+
+namespace {
+
+// The keys of the trace context of the tracers, e.g. B3, W3C, Jaeger, Datadog, Lightstep and
+// SkyWalking. Only these keys are read from the metadata, as the lazily decoded values, e.g. the
+// Dubbo attachments, are decoded when they're read.
+const std::vector<Http::LowerCaseString>& traceContextKeys() {
+  CONSTRUCT_ON_FIRST_USE(std::vector<Http::LowerCaseString>,
+                         {
+                             Http::LowerCaseString("traceparent"),
+                             Http::LowerCaseString("tracestate"),
+                             Http::LowerCaseString("x-b3-traceid"),
+                             Http::LowerCaseString("x-b3-spanid"),
+                             Http::LowerCaseString("x-b3-parentspanid"),
+                             Http::LowerCaseString("x-b3-sampled"),
+                             Http::LowerCaseString("x-b3-flags"),
+                             Http::LowerCaseString("b3"),
+                             Http::LowerCaseString("uber-trace-id"),
+                             Http::LowerCaseString("x-datadog-trace-id"),
+                             Http::LowerCaseString("x-datadog-parent-id"),
+                             Http::LowerCaseString("x-datadog-sampling-priority"),
+                             Http::LowerCaseString("x-ot-span-context"),
+                             Http::LowerCaseString("sw8"),
+                         });
+}
+
+} // namespace
+
+TracingConfigImpl::TracingConfigImpl(const TracingConfig& config,
+                                     const std::string& application_protocol,
+                                     Server::Configuration::FactoryContext& context)
+    : application_protocol_(application_protocol),
+      sampling_(config.has_random_sampling()
+                    ? static_cast<uint64_t>(config.random_sampling().value() * 100)
+                    : 10000) {
+  // The tracers are shared with the other meta protocol proxies of the same provider config.
+  tracer_manager_ = context.singletonManager().getTyped<Tracing::HttpTracerManagerImpl>(
+      SINGLETON_MANAGER_REGISTERED_NAME(meta_protocol_http_tracer_manager), [&context] {
+        return std::make_shared<Tracing::HttpTracerManagerImpl>(
+            std::make_unique<Tracing::TracerFactoryContextImpl>(
+                context.getServerFactoryContext(), context.messageValidationVisitor()));
+      });
+  tracer_ = tracer_manager_->getOrCreateHttpTracer(&config.provider());
+}
+
+TracingConfigImpl::TracingConfigImpl(const TracingConfig& config,
+                                     const std::string& application_protocol,
+                                     Tracing::HttpTracerSharedPtr tracer)
+    : application_protocol_(application_protocol),
+      sampling_(config.has_random_sampling()
+                    ? static_cast<uint64_t>(config.random_sampling().value() * 100)
+                    : 10000),
+      tracer_(std::move(tracer)) {}
+
+Tracing::SpanPtr TracingConfigImpl::startSpan(const Metadata& metadata,
+                                              const StreamInfo::StreamInfo& stream_info) const {
+  Http::RequestHeaderMapPtr context = Http::RequestHeaderMapImpl::create();
+  for (const Http::LowerCaseString& key : traceContextKeys()) {
+    const absl::string_view value = metadata.getString(key.get());
+    if (!value.empty()) {
+      context->addCopy(key, value);
+    }
+  }
+
+  // The request is sampled already, the tracer continues the trace of the caller if there's one.
+  Tracing::SpanPtr span =
+      tracer_->startSpan(*this, *context, stream_info, {Tracing::Reason::Sampling, true});
+  const absl::string_view interface = metadata.getString("interface");
+  const absl::string_view method = metadata.getString("method");
+  if (!method.empty()) {
+    span->setOperation(interface.empty() ? std::string(method)
+                                         : absl::StrCat(interface, ".", method));
+  }
+  span->setTag(Tracing::Tags::get().Component, Tracing::Tags::get().Proxy);
+  span->setTag("rpc.system", application_protocol_);
+  if (!interface.empty()) {
+    span->setTag("rpc.service", interface);
+  }
+  if (!method.empty()) {
+    span->setTag("rpc.method", method);
+  }
+  span->setTag("request_id", std::to_string(metadata.getRequestId()));
+  return span;
+}
+
+void TracingConfigImpl::finishSpan(Tracing::Span& span,
+                                   const MessageStreamInfo& stream_info) const {
+  const Metadata* response = stream_info.responseMetadata();
+  if (stream_info.localReply()) {
+    span.setTag("response_status", "LocalReply");
+    span.setTag(Tracing::Tags::get().Error, Tracing::Tags::get().True);
+  } else if (response != nullptr) {
+    const bool error = response->getResponseStatus() == ResponseStatus::Error ||
+                       response->getMessageType() == MessageType::Error;
+    span.setTag("response_status", error ? "Error" : "Ok");
+    if (error) {
+      span.setTag(Tracing::Tags::get().Error, Tracing::Tags::get().True);
+    }
+  }
+  span.finishSpan();
+}
+
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+
+#include "envoy/server/filter_config.h"
+#include "envoy/tracing/http_tracer.h"
+#include "envoy/tracing/http_tracer_manager.h"
+
+#include "api/v1alpha/meta_protocol_proxy.pb.h"
+
+#include "src/meta_protocol_proxy/codec/codec.h"
+#include "src/meta_protocol_proxy/stream_info.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+
+/**
+ * TracingConfigImpl starts the server spans of the sampled requests and is the tracing
+ * configuration of those spans.
+ *
+ * A request is sampled by a random value before anything else is done for its tracing, so the
+ * requests which aren't sampled don't read their metadata, build a header map or allocate a span.
+ * The trace context of a sampled request is extracted from the well-known keys of its string
+ * metadata, which the tracer reads from a header map as it does for an HTTP request. The lazily
+ * decoded strings of the metadata, e.g. the Dubbo attachments, are only decoded for the sampled
+ * requests.
+ */
+class TracingConfigImpl : public Tracing::Config {
+public:
+  using TracingConfig = envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::Tracing;
+
+  TracingConfigImpl(const TracingConfig& config, const std::string& application_protocol,
+                    Server::Configuration::FactoryContext& context);
+
+  /**
+   * Creates the configuration with the given tracer instead of the tracer of the configured
+   * provider, e.g. the InMemoryTracer of the tests.
+   */
+  TracingConfigImpl(const TracingConfig& config, const std::string& application_protocol,
+                    Tracing::HttpTracerSharedPtr tracer);
+
+  /**
+   * @param random_value a random value drawn for the request.
+   * @return bool whether the request is traced.
+   */
+  bool sampled(uint64_t random_value) const { return random_value % 10000 < sampling_; }
+
+  /**
+   * Starts the server span of a sampled request.
+   * @param metadata the metadata of the request, which may carry the trace context of the caller.
+   * @param stream_info the stream info of the request.
+   * @return Tracing::SpanPtr the span, which is finished by finishSpan().
+   */
+  Tracing::SpanPtr startSpan(const Metadata& metadata,
+                             const StreamInfo::StreamInfo& stream_info) const;
+
+  /**
+   * Tags the server span with the outcome of the request and finishes it.
+   */
+  void finishSpan(Tracing::Span& span, const MessageStreamInfo& stream_info) const;
+
+  // Tracing::Config
+  Tracing::OperationName operationName() const override { return Tracing::OperationName::Ingress; }
+  const Tracing::CustomTagMap* customTags() const override { return nullptr; }
+  bool verbose() const override { return false; }
+  uint32_t maxPathTagLength() const override { return Tracing::DefaultMaxPathTagLength; }
+
+private:
+  const std::string application_protocol_;
+  // The number of the requests out of 10000 which are sampled.
+  const uint64_t sampling_;
+  Tracing::HttpTracerManagerSharedPtr tracer_manager_;
+  Tracing::HttpTracerSharedPtr tracer_;
+};
+
+using TracingConfigImplPtr = std::unique_ptr<TracingConfigImpl>;
+
+} // namespace MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,92 @@
+// Note: this should be run with --compilation_mode=opt, and would benefit from a
+// quiescent system with disabled cstate power management. The allocations are only counted with
+// --define tcmalloc=disabled.
+
+#include <string>
+
+#include "source/common/buffer/buffer_impl.h"
+
+#include "src/application_protocols/dubbo/dubbo_codec.h"
+#include "src/meta_protocol_proxy/decoder.h"
+
+#include "test/application_protocols/dubbo/dubbo_test_messages.h"
+#include "test/meta_protocol_proxy/allocation_counter.h"
+
+#include "benchmark/benchmark.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace Dubbo {
+namespace {
+
+// The number of requests decoded from each read.
+constexpr uint64_t RequestsPerRead = 100;
+
+// Drops the decoded requests, which are released as soon as they're decoded.
+class RequestSink : public RequestDecoderCallbacks, public StreamHandler {
+public:
+  // RequestDecoderCallbacks
+  StreamHandler& newStream() override { return *this; }
+  void onHeartbeat(MetadataSharedPtr) override {}
+
+  // StreamHandler
+  void onStreamDecoded(MetadataSharedPtr, MutationSharedPtr) override {}
+};
+
+void encodeSizedRequest(Buffer::Instance& buffer, uint64_t request_id, uint64_t argument_size) {
+  Dubbo::encodeRequest(buffer, request_id, "org.apache.dubbo.samples.basic.api.DemoService",
+                       "sayHello", {{"path", "org.apache.dubbo.samples.basic.api.DemoService"}},
+                       std::string(argument_size, 'a'));
+}
+
+// Decodes Dubbo requests of about the given size in bytes through the request decoder of a
+// connection, as they're received in reads of RequestsPerRead requests.
+static void bmDecodeRequests(benchmark::State& state) {
+  const uint64_t message_size = state.range(0);
+  Buffer::OwnedImpl empty_request;
+  encodeSizedRequest(empty_request, 1, 0);
+  const uint64_t argument_size =
+      message_size > empty_request.length() ? message_size - empty_request.length() : 0;
+  Buffer::OwnedImpl requests;
+  for (uint64_t i = 0; i < RequestsPerRead; i++) {
+    encodeSizedRequest(requests, i + 1, argument_size);
+  }
+
+  DubboCodec codec;
+  RequestSink sink;
+  RequestDecoder decoder(codec, sink);
+  const auto decode = [&]() {
+    Buffer::OwnedImpl data(requests);
+    bool underflow = false;
+    while (!underflow) {
+      decoder.onData(data, underflow);
+    }
+  };
+  // The state kept for the messages of the connection is allocated by the first ones.
+  decode();
+
+  const uint64_t start_allocations = AllocationCounter::count();
+  for (auto _ : state) {
+    UNREFERENCED_PARAMETER(_);
+    decode();
+  }
+  const uint64_t messages = state.iterations() * RequestsPerRead;
+  if (AllocationCounter::enabled()) {
+    state.counters["allocations_per_message"] =
+        static_cast<double>(AllocationCounter::count() - start_allocations) / messages;
+  } else {
+    state.SetLabel("allocations aren't counted, build with --define tcmalloc=disabled");
+  }
+  state.SetItemsProcessed(messages);
+  state.SetBytesProcessed(state.iterations() * requests.length());
+}
+BENCHMARK(bmDecodeRequests)->Arg(200)->Arg(512)->Arg(2048);
+
+} // namespace
+} // namespace Dubbo
+} // namespace MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "envoy/buffer/buffer.h"
+
+#include "source/common/buffer/buffer_impl.h"
+
+#include "src/application_protocols/dubbo/hessian_utils.h"
+
+#include "hessian2/object.hpp"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace Dubbo {
+
+using Attachments = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * Encodes the 16 bytes header of a Dubbo message with the Hessian2 serialization.
+ */
+inline void encodeHeader(Buffer::Instance& buffer, uint8_t flag, uint64_t request_id,
+                         uint32_t body_size) {
+  buffer.writeBEInt<uint16_t>(0xdabb);
+  // Hessian2 is the serialization type 2.
+  buffer.writeByte(flag | 2);
+  // The status of a response, it's unused in a request.
+  buffer.writeByte(20);
+  buffer.writeBEInt<uint64_t>(request_id);
+  buffer.writeBEInt<uint32_t>(body_size);
+}
+
+/**
+ * Encodes a two-way request of a method with a string argument and the given attachments.
+ */
+inline void encodeRequest(Buffer::Instance& buffer, uint64_t request_id,
+                          const std::string& interface, const std::string& method,
+                          const Attachments& attachments, const std::string& argument = "hello") {
+  Buffer::OwnedImpl body;
+  Hessian2::Encoder encoder(std::make_unique<BufferWriter>(body));
+  encoder.encode<std::string>("2.7.8");
+  encoder.encode<std::string>(interface);
+  encoder.encode<std::string>("0.0.0");
+  encoder.encode<std::string>(method);
+  encoder.encode<std::string>("Ljava/lang/String;");
+  encoder.encode<std::string>(argument);
+  Hessian2::Object::UntypedMap map;
+  for (const auto& attachment : attachments) {
+    map.emplace(std::make_unique<Hessian2::StringObject>(attachment.first),
+                std::make_unique<Hessian2::StringObject>(attachment.second));
+  }
+  encoder.encode<Hessian2::Object>(Hessian2::UntypedMapObject(std::move(map)));
+
+  // A two-way request.
+  encodeHeader(buffer, 0x80 | 0x40, request_id, body.length());
+  buffer.move(body);
+}
+
+/**
+ * Encodes a successful response with a string value.
+ */
+inline void encodeResponse(Buffer::Instance& buffer, uint64_t request_id,
+                           const std::string& value) {
+  Buffer::OwnedImpl body;
+  Hessian2::Encoder encoder(std::make_unique<BufferWriter>(body));
+  // The response with a value.
+  encoder.encode<int32_t>(1);
+  encoder.encode<std::string>(value);
+
+  encodeHeader(buffer, 0, request_id, body.length());
+  buffer.move(body);
+}
+
+} // namespace Dubbo
+} // namespace MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,105 @@
+// Note: this should be run with --compilation_mode=opt, and would benefit from a
+// quiescent system with disabled cstate power management.
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "source/common/buffer/buffer_impl.h"
+
+#include "src/application_protocols/dubbo/hessian_utils.h"
+
+#include "benchmark/benchmark.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace Dubbo {
+namespace {
+
+// The size of the reads the fragmented buffers are received in.
+constexpr size_t FragmentSize = 256;
+
+// Reads the bytes of the buffer with Buffer::Instance::copyOut(), as BufferReader did before it
+// read through a BufferCursor.
+class CopyOutReader : public Hessian2::Reader {
+public:
+  CopyOutReader(Buffer::Instance& buffer) : buffer_(buffer) {}
+
+  // Hessian2::Reader
+  uint64_t length() const override { return buffer_.length(); }
+  void rawReadNBytes(void* data, size_t len, size_t peek_offset) override {
+    buffer_.copyOut(offset() + peek_offset, len, data);
+  }
+
+private:
+  Buffer::Instance& buffer_;
+};
+
+// Encodes a list of strings of about the given size in bytes, as the arguments of a large request.
+std::string encodeList(uint64_t size) {
+  Hessian2::Object::UntypedList list;
+  for (uint64_t encoded = 0; encoded < size; encoded += 32) {
+    list.push_back(std::make_unique<Hessian2::StringObject>(std::string(30, 'a')));
+  }
+  Buffer::OwnedImpl buffer;
+  Hessian2::Encoder encoder(std::make_unique<BufferWriter>(buffer));
+  encoder.encode<Hessian2::Object>(Hessian2::UntypedListObject(std::move(list)));
+  return buffer.toString();
+}
+
+// Holds the bytes in slices of FragmentSize bytes, as they're left by many small reads.
+class FragmentedBuffer {
+public:
+  FragmentedBuffer(const std::string& data) : data_(data) {
+    for (size_t offset = 0; offset < data_.size(); offset += FragmentSize) {
+      fragments_.push_back(std::make_unique<Buffer::BufferFragmentImpl>(
+          data_.data() + offset, std::min(FragmentSize, data_.size() - offset), nullptr));
+      buffer_.addBufferFragment(*fragments_.back());
+    }
+  }
+
+  Buffer::Instance& buffer() { return buffer_; }
+
+private:
+  const std::string data_;
+  std::vector<std::unique_ptr<Buffer::BufferFragmentImpl>> fragments_;
+  Buffer::OwnedImpl buffer_;
+};
+
+template <class Reader> void decode(benchmark::State& state, Buffer::Instance& buffer) {
+  for (auto _ : state) {
+    UNREFERENCED_PARAMETER(_);
+    Hessian2::Decoder decoder(std::make_unique<Reader>(buffer));
+    benchmark::DoNotOptimize(decoder.decode<Hessian2::Object>());
+  }
+  state.SetBytesProcessed(state.iterations() * buffer.length());
+}
+
+static void bmDecodeFragmented(benchmark::State& state) {
+  FragmentedBuffer fragmented(encodeList(state.range(0)));
+  decode<BufferReader>(state, fragmented.buffer());
+}
+BENCHMARK(bmDecodeFragmented)->RangeMultiplier(8)->Range(1 << 10, 1 << 20);
+
+static void bmDecodeFragmentedWithCopyOut(benchmark::State& state) {
+  FragmentedBuffer fragmented(encodeList(state.range(0)));
+  decode<CopyOutReader>(state, fragmented.buffer());
+}
+BENCHMARK(bmDecodeFragmentedWithCopyOut)->RangeMultiplier(8)->Range(1 << 10, 1 << 20);
+
+static void bmDecodeContiguous(benchmark::State& state) {
+  Buffer::OwnedImpl buffer(encodeList(state.range(0)));
+  buffer.linearize(buffer.length());
+  decode<BufferReader>(state, buffer);
+}
+BENCHMARK(bmDecodeContiguous)->RangeMultiplier(8)->Range(1 << 10, 1 << 20);
+
+} // namespace
+} // namespace Dubbo
+} // namespace MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
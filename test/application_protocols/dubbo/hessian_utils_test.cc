@@ -0,0 +1,272 @@
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "envoy/common/exception.h"
+
+#include "source/common/buffer/buffer_impl.h"
+#include "source/common/common/macros.h"
+
+#include "src/application_protocols/dubbo/hessian_utils.h"
+
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace Dubbo {
+namespace {
+
+// Encodes a value with the Hessian2 encoder, as the Dubbo clients encode the request bodies.
+std::string encode(const std::function<void(Hessian2::Encoder&)>& encode_value) {
+  Buffer::OwnedImpl buffer;
+  Hessian2::Encoder encoder(std::make_unique<BufferWriter>(buffer));
+  encode_value(encoder);
+  return buffer.toString();
+}
+
+template <class T> std::string encodeValue(const T& value) {
+  return encode([&value](Hessian2::Encoder& encoder) { encoder.encode<T>(value); });
+}
+
+std::string encodeObject(const Hessian2::Object& value) {
+  return encode([&value](Hessian2::Encoder& encoder) { encoder.encode<Hessian2::Object>(value); });
+}
+
+// The raw bytes of the values the encoder doesn't produce, as defined by the Hessian 2.0
+// serialization protocol.
+std::string bytes(std::initializer_list<uint8_t> values) {
+  return std::string(values.begin(), values.end());
+}
+
+// A string which is read after each value, to check that the value is skipped up to its end.
+const std::string& sentinel() {
+  CONSTRUCT_ON_FIRST_USE(std::string, encodeValue<std::string>("end"));
+}
+
+// Holds the bytes in slices of a byte each, as they're left by many small reads.
+class FragmentedBuffer {
+public:
+  FragmentedBuffer(const std::string& data) : data_(data) {
+    for (size_t i = 0; i < data_.size(); i++) {
+      fragments_.push_back(
+          std::make_unique<Buffer::BufferFragmentImpl>(data_.data() + i, 1, nullptr));
+      buffer_.addBufferFragment(*fragments_.back());
+    }
+  }
+
+  Buffer::Instance& buffer() { return buffer_; }
+
+private:
+  const std::string data_;
+  std::vector<std::unique_ptr<Buffer::BufferFragmentImpl>> fragments_;
+  Buffer::OwnedImpl buffer_;
+};
+
+struct SkipCase {
+  std::string name;
+  std::string value;
+};
+
+std::vector<SkipCase> skipCases() {
+  Hessian2::Object::UntypedList list;
+  list.push_back(std::make_unique<Hessian2::StringObject>("a"));
+  list.push_back(std::make_unique<Hessian2::StringObject>(std::string(100, 'b')));
+  list.push_back(std::make_unique<Hessian2::NullObject>());
+  Hessian2::Object::UntypedMap map;
+  map.emplace(std::make_unique<Hessian2::StringObject>("path"),
+              std::make_unique<Hessian2::StringObject>("org.apache.dubbo.DemoService"));
+  map.emplace(std::make_unique<Hessian2::StringObject>("timeout"),
+              std::make_unique<Hessian2::StringObject>("3000"));
+
+  return {
+      // Strings: compact, medium and chunked, with multi-byte UTF-8 characters.
+      {"EmptyString", encodeValue<std::string>("")},
+      {"CompactString", encodeValue<std::string>("hello")},
+      {"MediumString", encodeValue<std::string>(std::string(1000, 'a'))},
+      {"ChunkedString", encodeValue<std::string>(std::string(70000, 'a'))},
+      {"Utf8String", encodeValue<std::string>("h\xc3\xa9llo \xe4\xb8\x96")},
+      {"ChunkedUtf8String", encodeValue<std::string>(std::string(40000, 'a') + "\xe4\xb8\x96" +
+                                                     std::string(40000, 'b'))},
+      // Binaries: compact, medium and chunked.
+      {"EmptyBinary", encodeValue<std::vector<uint8_t>>({})},
+      {"CompactBinary", encodeValue<std::vector<uint8_t>>(std::vector<uint8_t>(10, 0xff))},
+      {"MediumBinary", encodeValue<std::vector<uint8_t>>(std::vector<uint8_t>(1000, 0xff))},
+      {"ChunkedBinary", encodeValue<std::vector<uint8_t>>(std::vector<uint8_t>(70000, 0xff))},
+      // Ints of one, two, three and five octets.
+      {"OneOctetInt", encodeValue<int32_t>(-16)},
+      {"TwoOctetInt", encodeValue<int32_t>(-2048)},
+      {"ThreeOctetInt", encodeValue<int32_t>(262143)},
+      {"Int", encodeValue<int32_t>(std::numeric_limits<int32_t>::min())},
+      // Longs of one, two, three, five and nine octets.
+      {"OneOctetLong", encodeValue<int64_t>(15)},
+      {"TwoOctetLong", encodeValue<int64_t>(2047)},
+      {"ThreeOctetLong", encodeValue<int64_t>(-262144)},
+      {"FourOctetLong", encodeValue<int64_t>(std::numeric_limits<int32_t>::max())},
+      {"Long", encodeValue<int64_t>(std::numeric_limits<int64_t>::max())},
+      // Doubles of each compact form.
+      {"DoubleZero", encodeValue<double>(0.0)},
+      {"DoubleOne", encodeValue<double>(1.0)},
+      {"DoubleOctet", encodeValue<double>(-128.0)},
+      {"DoubleShort", encodeValue<double>(32767.0)},
+      {"DoubleFloat", bytes({0x5f, 0x3f, 0xc0, 0x00, 0x00})},
+      {"Double", encodeValue<double>(0.1)},
+      {"True", encodeValue<bool>(true)},
+      {"False", encodeValue<bool>(false)},
+      {"Null", encodeObject(Hessian2::NullObject())},
+      {"Date", bytes({'J', 0x00, 0x00, 0x00, 0xd0, 0x4b, 0x92, 0x84, 0xb8})},
+      {"DateInMinutes", bytes({'K', 0x00, 0xe3, 0x83, 0x8f})},
+      // Lists of each form, typed and untyped.
+      {"UntypedList", encodeObject(Hessian2::UntypedListObject(std::move(list)))},
+      {"TypedFixedList", bytes({0x72, 0x04, '[', 'i', 'n', 't', 0x91, 0x92})},
+      {"UntypedFixedList", bytes({0x7a, 0x91, 0x92})},
+      {"TypedList", bytes({'V', 0x04, '[', 'i', 'n', 't', 0x92, 0x91, 0x92})},
+      {"UntypedListWithLength", bytes({'X', 0x92, 0x91, 0x92})},
+      {"TypedVariableList", bytes({'U', 0x04, '[', 'i', 'n', 't', 0x91, 0x92, 'Z'})},
+      {"UntypedVariableList", bytes({'W', 0x91, 0x92, 'Z'})},
+      // Maps, typed and untyped.
+      {"UntypedMap", encodeObject(Hessian2::UntypedMapObject(std::move(map)))},
+      {"TypedMap", bytes({'M', 0x08, 'j', 'a', 'v', 'a', '.', 'M', 'a', 'p', 0x01, 'a', 0x91,
+                          'Z'})},
+      // Objects with a compact and a long reference to their class definition, and a second
+      // object which refers to the definition of the first one.
+      {"ObjectWithCompactDefinitionRef",
+       bytes({'C', 0x03, 'C', 'a', 'r', 0x92, 0x05, 'c', 'o', 'l', 'o', 'r', 0x05, 'm', 'o', 'd',
+              'e', 'l', 0x60, 0x03, 'r', 'e', 'd', 0x08, 'c', 'o', 'r', 'v', 'e', 't', 't', 'e'})},
+      {"ObjectWithDefinitionRef",
+       bytes({'C', 0x03, 'C', 'a', 'r', 0x91, 0x05, 'c', 'o', 'l', 'o', 'r', 'O', 0x90, 0x03, 'r',
+              'e', 'd'})},
+      {"ObjectsOfSameDefinition",
+       bytes({0x7a, 'C', 0x03, 'C', 'a', 'r', 0x91, 0x05, 'c', 'o', 'l', 'o', 'r', 0x60, 0x03, 'r',
+              'e', 'd', 0x60, 0x04, 'b', 'l', 'u', 'e'})},
+      // A reference to the list in the list.
+      {"Ref", bytes({0x7a, 0x78, 'Q', 0x91})},
+  };
+}
+
+class HessianSkipperTest : public testing::TestWithParam<SkipCase> {};
+
+// The value is skipped up to the sentinel which follows it, as far as the decoder decodes it.
+TEST_P(HessianSkipperTest, SkipValue) {
+  Buffer::OwnedImpl value(GetParam().value);
+  Hessian2::Decoder decoder(std::make_unique<BufferReader>(value));
+  ASSERT_NE(nullptr, decoder.decode<Hessian2::Object>());
+  ASSERT_EQ(GetParam().value.size(), decoder.offset());
+
+  Buffer::OwnedImpl buffer(GetParam().value + sentinel());
+  HessianSkipper skipper(buffer, 0, buffer.length());
+  skipper.skipValue();
+  EXPECT_EQ(GetParam().value.size(), skipper.offset());
+  EXPECT_EQ("end", skipper.readString());
+}
+
+TEST_P(HessianSkipperTest, SkipFragmentedValue) {
+  FragmentedBuffer fragmented(GetParam().value + sentinel());
+  HessianSkipper skipper(fragmented.buffer(), 0, fragmented.buffer().length());
+  skipper.skipValue();
+  EXPECT_EQ(GetParam().value.size(), skipper.offset());
+  EXPECT_EQ("end", skipper.readString());
+}
+
+// A value which is cut off by the limit, e.g. the end of the message, isn't skipped.
+TEST_P(HessianSkipperTest, SkipTruncatedValue) {
+  Buffer::OwnedImpl buffer(GetParam().value + sentinel());
+  HessianSkipper skipper(buffer, 0, GetParam().value.size() - 1);
+  EXPECT_THROW(skipper.skipValue(), EnvoyException);
+}
+
+INSTANTIATE_TEST_SUITE_P(Values, HessianSkipperTest, testing::ValuesIn(skipCases()),
+                         [](const testing::TestParamInfo<SkipCase>& info) {
+                           return info.param.name;
+                         });
+
+TEST(HessianSkipperTest, SkipValueAtOffset) {
+  const std::string prefix = encodeValue<int32_t>(1);
+  Buffer::OwnedImpl buffer(prefix + encodeValue<std::string>("hello") + sentinel());
+  HessianSkipper skipper(buffer, prefix.size(), buffer.length());
+  skipper.skipValue();
+  EXPECT_EQ("end", skipper.readString());
+}
+
+TEST(HessianSkipperTest, SkipInvalidValue) {
+  // The reserved tag.
+  {
+    Buffer::OwnedImpl buffer(bytes({0x40}));
+    HessianSkipper skipper(buffer, 0, buffer.length());
+    EXPECT_THROW(skipper.skipValue(), EnvoyException);
+  }
+  // An object whose class definition hasn't been skipped.
+  {
+    Buffer::OwnedImpl buffer(bytes({0x60, 0x03, 'r', 'e', 'd'}));
+    HessianSkipper skipper(buffer, 0, buffer.length());
+    EXPECT_THROW(skipper.skipValue(), EnvoyException);
+  }
+  // A class definition with a negative number of fields.
+  {
+    Buffer::OwnedImpl buffer(bytes({'C', 0x03, 'C', 'a', 'r', 0x8f, 0x60}));
+    HessianSkipper skipper(buffer, 0, buffer.length());
+    EXPECT_THROW(skipper.skipValue(), EnvoyException);
+  }
+  // A non-final binary chunk followed by a string chunk.
+  {
+    Buffer::OwnedImpl buffer(bytes({'A', 0x00, 0x01, 0xff, 'S', 0x00, 0x01, 'a'}));
+    HessianSkipper skipper(buffer, 0, buffer.length());
+    EXPECT_THROW(skipper.skipValue(), EnvoyException);
+  }
+  // An invalid UTF-8 lead byte.
+  {
+    Buffer::OwnedImpl buffer(bytes({0x01, 0xff}));
+    HessianSkipper skipper(buffer, 0, buffer.length());
+    EXPECT_THROW(skipper.skipValue(), EnvoyException);
+  }
+}
+
+TEST(HessianSkipperTest, SkipDeeplyNestedValue) {
+  // Untyped fixed length lists of one element nested in each other.
+  Buffer::OwnedImpl buffer(std::string(10000, '\x79') + encodeValue<int32_t>(1));
+  HessianSkipper skipper(buffer, 0, buffer.length());
+  EXPECT_THROW(skipper.skipValue(), EnvoyException);
+}
+
+TEST(HessianSkipperTest, ReadString) {
+  const std::string chunked = std::string(40000, 'a') + "\xe4\xb8\x96" + std::string(40000, 'b');
+  Buffer::OwnedImpl buffer(encodeValue<std::string>("hello") +
+                           encodeValue<std::string>(std::string(1000, 'a')) +
+                           encodeValue<std::string>(chunked) +
+                           encodeObject(Hessian2::NullObject()) +
+                           encodeValue<std::string>("h\xc3\xa9llo"));
+  HessianSkipper skipper(buffer, 0, buffer.length());
+  EXPECT_EQ("hello", skipper.readString());
+  EXPECT_EQ(std::string(1000, 'a'), skipper.readString());
+  EXPECT_EQ(chunked, skipper.readString());
+  EXPECT_EQ("", skipper.readString());
+  EXPECT_EQ("h\xc3\xa9llo", skipper.readString());
+  EXPECT_EQ(buffer.length(), skipper.offset());
+}
+
+// A four-byte UTF-8 character is a surrogate pair, it counts as two characters of the length.
+TEST(HessianSkipperTest, ReadStringWithSurrogatePair) {
+  Buffer::OwnedImpl buffer(bytes({0x03, 0xf0, 0x9f, 0x98, 0x80, 'a'}) + sentinel());
+  HessianSkipper skipper(buffer, 0, buffer.length());
+  EXPECT_EQ("\xf0\x9f\x98\x80"
+            "a",
+            skipper.readString());
+  EXPECT_EQ("end", skipper.readString());
+}
+
+TEST(HessianSkipperTest, ReadNonString) {
+  Buffer::OwnedImpl buffer(encodeValue<int32_t>(1));
+  HessianSkipper skipper(buffer, 0, buffer.length());
+  EXPECT_THROW(skipper.readString(), EnvoyException);
+}
+
+} // namespace
+} // namespace Dubbo
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,177 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "source/common/buffer/buffer_impl.h"
+
+#include "src/application_protocols/thrift/thrift_codec.h"
+
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace Thrift {
+namespace {
+
+// The protocol IDs of the header transport.
+constexpr uint8_t HeaderBinaryProtocol = 0;
+constexpr uint8_t HeaderCompactProtocol = 2;
+
+void writeVarint(Buffer::Instance& buffer, uint32_t value) {
+  while (value >= 0x80) {
+    buffer.writeByte(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  buffer.writeByte(static_cast<uint8_t>(value));
+}
+
+// Encodes a call of the method with no argument with the strict binary protocol.
+std::string binaryCall(uint32_t seq_id, const std::string& method = "sayHello") {
+  Buffer::OwnedImpl buffer;
+  buffer.writeBEInt<uint16_t>(0x8001);
+  buffer.writeByte(0);
+  // The message type call.
+  buffer.writeByte(1);
+  buffer.writeBEInt<uint32_t>(method.size());
+  buffer.add(method);
+  buffer.writeBEInt<uint32_t>(seq_id);
+  // The empty arguments struct.
+  buffer.writeByte(0);
+  return buffer.toString();
+}
+
+// Encodes a call of the method with no argument with the compact protocol.
+std::string compactCall(uint32_t seq_id, const std::string& method = "sayHello") {
+  Buffer::OwnedImpl buffer;
+  buffer.writeByte(0x82);
+  // The message type call and the version.
+  buffer.writeByte((1 << 5) | 1);
+  writeVarint(buffer, seq_id);
+  writeVarint(buffer, method.size());
+  buffer.add(method);
+  // The empty arguments struct.
+  buffer.writeByte(0);
+  return buffer.toString();
+}
+
+std::string framed(const std::string& payload) {
+  Buffer::OwnedImpl buffer;
+  buffer.writeBEInt<uint32_t>(payload.size());
+  buffer.add(payload);
+  return buffer.toString();
+}
+
+// Frames the payload with the header transport, with the protocol ID and no transform.
+std::string headerFramed(const std::string& payload, uint8_t protocol_id) {
+  Buffer::OwnedImpl headers;
+  headers.writeByte(protocol_id);
+  // No transform, then the padding to a multiple of 4 bytes.
+  headers.writeByte(0);
+  headers.writeBEInt<uint16_t>(0);
+
+  Buffer::OwnedImpl buffer;
+  buffer.writeBEInt<uint32_t>(10 + headers.length() + payload.size());
+  buffer.writeBEInt<uint16_t>(0x0FFF);
+  // The flags and the sequence ID of the frame.
+  buffer.writeBEInt<uint16_t>(0);
+  buffer.writeBEInt<uint32_t>(7);
+  buffer.writeBEInt<uint16_t>(headers.length() / 4);
+  buffer.move(headers);
+  buffer.add(payload);
+  return buffer.toString();
+}
+
+struct RewriteCase {
+  std::string name;
+  std::string message;
+  uint64_t request_id;
+  std::string expected;
+};
+
+class ThriftCodecRewriteRequestIdTest : public testing::TestWithParam<RewriteCase> {};
+
+TEST_P(ThriftCodecRewriteRequestIdTest, Rewrite) {
+  ThriftCodec codec(false);
+  Buffer::OwnedImpl message(GetParam().message);
+  EXPECT_TRUE(codec.rewriteRequestId(message, GetParam().request_id));
+  EXPECT_EQ(GetParam().expected, message.toString());
+}
+
+// The compact varints of 1, 300 and 2^31 - 1 take 1, 2 and 5 bytes.
+INSTANTIATE_TEST_SUITE_P(
+    Messages, ThriftCodecRewriteRequestIdTest,
+    testing::Values(
+        RewriteCase{"BinaryUnframed", binaryCall(1), 0x12345678, binaryCall(0x12345678)},
+        RewriteCase{"BinaryFramed", framed(binaryCall(1)), 0x7fffffff,
+                    framed(binaryCall(0x7fffffff))},
+        RewriteCase{"BinaryHeader", headerFramed(binaryCall(1), HeaderBinaryProtocol), 300,
+                    headerFramed(binaryCall(300), HeaderBinaryProtocol)},
+        RewriteCase{"BinaryEmptyName", binaryCall(1, ""), 2, binaryCall(2, "")},
+        RewriteCase{"CompactUnframedSameSize", compactCall(1), 2, compactCall(2)},
+        RewriteCase{"CompactUnframedLonger", compactCall(1), 300, compactCall(300)},
+        RewriteCase{"CompactUnframedShorter", compactCall(0x7fffffff), 1, compactCall(1)},
+        RewriteCase{"CompactFramedLonger", framed(compactCall(1)), 0x7fffffff,
+                    framed(compactCall(0x7fffffff))},
+        RewriteCase{"CompactFramedShorter", framed(compactCall(300)), 1, framed(compactCall(1))},
+        RewriteCase{"CompactHeaderLonger", headerFramed(compactCall(1), HeaderCompactProtocol), 300,
+                    headerFramed(compactCall(300), HeaderCompactProtocol)},
+        RewriteCase{"CompactHeaderShorter",
+                    headerFramed(compactCall(0x7fffffff), HeaderCompactProtocol), 1,
+                    headerFramed(compactCall(1), HeaderCompactProtocol)}),
+    [](const testing::TestParamInfo<RewriteCase>& info) { return info.param.name; });
+
+// The message is received in reads of a byte each, so the sequence ID spans several slices.
+TEST(ThriftCodecTest, RewriteRequestIdOfFragmentedMessage) {
+  ThriftCodec codec(false);
+  const std::string message = framed(compactCall(1));
+  std::vector<std::unique_ptr<Buffer::BufferFragmentImpl>> fragments;
+  Buffer::OwnedImpl buffer;
+  for (size_t i = 0; i < message.size(); i++) {
+    fragments.push_back(
+        std::make_unique<Buffer::BufferFragmentImpl>(message.data() + i, 1, nullptr));
+    buffer.addBufferFragment(*fragments.back());
+  }
+  EXPECT_TRUE(codec.rewriteRequestId(buffer, 300));
+  EXPECT_EQ(framed(compactCall(300)), buffer.toString());
+}
+
+TEST(ThriftCodecTest, RewriteRequestIdOfUnknownMessage) {
+  ThriftCodec codec(false);
+
+  // The payload of a header transport frame which has been transformed, e.g. compressed.
+  const std::string transformed = headerFramed("\x1f\x8b\x08\x00", HeaderBinaryProtocol);
+  Buffer::OwnedImpl message(transformed);
+  EXPECT_FALSE(codec.rewriteRequestId(message, 2));
+  EXPECT_EQ(transformed, message.toString());
+
+  // The non-strict binary protocol has no version to recognize the message by.
+  const std::string non_strict = framed(std::string("\x00\x00\x00\x01", 4));
+  Buffer::OwnedImpl non_strict_message(non_strict);
+  EXPECT_FALSE(codec.rewriteRequestId(non_strict_message, 2));
+  EXPECT_EQ(non_strict, non_strict_message.toString());
+}
+
+TEST(ThriftCodecTest, RewriteRequestIdOfTruncatedMessage) {
+  ThriftCodec codec(false);
+
+  // The binary sequence ID is cut off.
+  const std::string binary = binaryCall(1).substr(0, 14);
+  Buffer::OwnedImpl binary_message(binary);
+  EXPECT_FALSE(codec.rewriteRequestId(binary_message, 2));
+  EXPECT_EQ(binary, binary_message.toString());
+
+  // The compact varint has no last byte.
+  const std::string compact = compactCall(0x7fffffff).substr(0, 4);
+  Buffer::OwnedImpl compact_message(compact);
+  EXPECT_FALSE(codec.rewriteRequestId(compact_message, 2));
+  EXPECT_EQ(compact, compact_message.toString());
+}
+
+} // namespace
+} // namespace Thrift
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,82 @@
+// Note: this should be run with --compilation_mode=opt, and would benefit from a
+// quiescent system with disabled cstate power management.
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "source/common/formatter/substitution_formatter.h"
+
+#include "src/meta_protocol_proxy/access_log_formatter.h"
+#include "src/meta_protocol_proxy/codec_impl.h"
+#include "src/meta_protocol_proxy/stream_info.h"
+
+#include "test/mocks/network/mocks.h"
+#include "test/test_common/simulated_time_system.h"
+#include "test/test_common/utility.h"
+
+#include "benchmark/benchmark.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace {
+
+// A format with all the meta protocol commands, as an access log of the requests would use it.
+constexpr absl::string_view Format =
+    "[%START_TIME%] %META_METADATA(interface)% %META_METADATA(method)% %META_REQUEST_ID% "
+    "%META_MESSAGE_TYPE% %META_RESPONSE_STATUS% %UPSTREAM_HOST% %DURATION% "
+    "%META_STAGE_DURATION(decode)% %META_STAGE_DURATION(filter)% "
+    "%META_STAGE_DURATION(upstream)% %META_STAGE_DURATION(response)%\n";
+
+// Formats the access log line of a proxied Dubbo request, as the access logs do once the request
+// is complete. No header map is built for the requests, the logs are given empty ones.
+static void bmFormatRequest(benchmark::State& state) {
+  Event::SimulatedTimeSystem time_system;
+  testing::NiceMock<Network::MockConnection> connection;
+  MessageStreamInfo stream_info(time_system, connection.addressProviderSharedPtr());
+
+  auto request = std::make_shared<MetadataImpl>();
+  request->setMessageType(MessageType::Request);
+  request->setRequestId(1);
+  request->putString("interface", "org.apache.dubbo.samples.basic.api.DemoService");
+  request->putString("method", "sayHello");
+  stream_info.setRequestMetadata(request);
+  auto response = std::make_shared<MetadataImpl>();
+  response->setMessageType(MessageType::Response);
+  response->setResponseStatus(ResponseStatus::Ok);
+  stream_info.setResponseMetadata(response);
+  stream_info.setStageDuration(MessageStreamInfo::Stage::Decode, std::chrono::microseconds(5));
+  stream_info.setStageDuration(MessageStreamInfo::Stage::Filter, std::chrono::microseconds(10));
+  stream_info.setStageDuration(MessageStreamInfo::Stage::Upstream,
+                               std::chrono::microseconds(800));
+  stream_info.setStageDuration(MessageStreamInfo::Stage::Response, std::chrono::microseconds(5));
+  time_system.advanceTimeWait(std::chrono::microseconds(820));
+  stream_info.onRequestComplete();
+
+  std::vector<Formatter::CommandParserPtr> command_parsers;
+  command_parsers.push_back(std::make_unique<MessageCommandParser>());
+  Formatter::FormatterImpl formatter(std::string(Format), false, command_parsers);
+
+  const Http::TestRequestHeaderMapImpl request_headers;
+  const Http::TestResponseHeaderMapImpl response_headers;
+  const Http::TestResponseTrailerMapImpl response_trailers;
+  size_t output_bytes = 0;
+  for (auto _ : state) {
+    UNREFERENCED_PARAMETER(_);
+    output_bytes += formatter
+                        .format(request_headers, response_headers, response_trailers, stream_info,
+                                absl::string_view())
+                        .length();
+  }
+  benchmark::DoNotOptimize(output_bytes);
+}
+BENCHMARK(bmFormatRequest);
+
+} // namespace
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,42 @@
+#include "test/meta_protocol_proxy/allocation_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if !defined(TCMALLOC) && !defined(GPERFTOOLS_TCMALLOC)
+namespace {
+std::atomic<uint64_t> allocations{0};
+} // namespace
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+#endif
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+
+#if !defined(TCMALLOC) && !defined(GPERFTOOLS_TCMALLOC)
+bool AllocationCounter::enabled() { return true; }
+uint64_t AllocationCounter::count() { return allocations.load(std::memory_order_relaxed); }
+#else
+bool AllocationCounter::enabled() { return false; }
+uint64_t AllocationCounter::count() { return 0; }
+#endif
+
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
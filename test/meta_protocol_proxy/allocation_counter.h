@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+
+/**
+ * AllocationCounter counts the calls to the global operator new of the process, which is replaced
+ * when it's linked in. The allocations aren't counted if tcmalloc is linked in instead, the
+ * benchmarks should then be built with --define tcmalloc=disabled to report them.
+ */
+class AllocationCounter {
+public:
+  /**
+   * @return whether the allocations are counted.
+   */
+  static bool enabled();
+
+  /**
+   * @return the number of allocations so far.
+   */
+  static uint64_t count();
+};
+
+} // namespace MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,165 @@
+// Note: this should be run with --compilation_mode=opt, and would benefit from a
+// quiescent system with disabled cstate power management. The allocations are only counted with
+// --define tcmalloc=disabled.
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "source/common/buffer/buffer_impl.h"
+#include "source/common/common/random_generator.h"
+#include "source/common/stats/isolated_store_impl.h"
+
+#include "src/application_protocols/dubbo/dubbo_codec.h"
+#include "src/meta_protocol_proxy/codec_impl.h"
+#include "src/meta_protocol_proxy/conn_manager.h"
+
+#include "test/application_protocols/dubbo/dubbo_test_messages.h"
+#include "test/meta_protocol_proxy/allocation_counter.h"
+#include "test/mocks/network/mocks.h"
+#include "test/test_common/utility.h"
+
+#include "benchmark/benchmark.h"
+
+using testing::NiceMock;
+using testing::ReturnRef;
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace {
+
+// Stands in for the router and its upstream: the requests wait in it until they're answered with
+// a response decoded from the upstream bytes, as the router decodes them.
+class Upstream {
+public:
+  Upstream() { Dubbo::encodeResponse(response_, 1, "world"); }
+
+  void add(DecoderFilterCallbacks& callbacks) { pending_.push_back(&callbacks); }
+
+  void respond() {
+    for (DecoderFilterCallbacks* callbacks : pending_) {
+      Buffer::OwnedImpl data(response_);
+      auto metadata = std::make_shared<MetadataImpl>();
+      codec_.decode(data, *metadata);
+      callbacks->upstreamResponse(metadata, std::make_shared<MutationImpl>());
+    }
+    pending_.clear();
+  }
+
+private:
+  Dubbo::DubboCodec codec_;
+  Buffer::OwnedImpl response_;
+  std::vector<DecoderFilterCallbacks*> pending_;
+};
+
+class UpstreamFilter : public DecoderFilter {
+public:
+  UpstreamFilter(Upstream& upstream) : upstream_(upstream) {}
+
+  // DecoderFilter
+  void onDestroy() override {}
+  void setDecoderFilterCallbacks(DecoderFilterCallbacks& callbacks) override {
+    callbacks_ = &callbacks;
+  }
+  FilterStatus onMessageDecoded(MetadataSharedPtr, MutationSharedPtr) override {
+    upstream_.add(*callbacks_);
+    return FilterStatus::StopIteration;
+  }
+
+private:
+  Upstream& upstream_;
+  DecoderFilterCallbacks* callbacks_{};
+};
+
+class BenchmarkConfig : public Config, public FilterChainFactory, public Router::Config {
+public:
+  BenchmarkConfig(Upstream& upstream)
+      : upstream_(upstream),
+        stats_(MetaProtocolProxyStats::generateStats("test.", store_)) {}
+
+  // Config
+  FilterChainFactory& filterFactory() override { return *this; }
+  MetaProtocolProxyStats& stats() override { return stats_; }
+  CodecPtr createCodec() override { return std::make_unique<Dubbo::DubboCodec>(); }
+  uint64_t codecHash() override { return 0; }
+  Router::Config& routerConfig() override { return *this; }
+  std::string applicationProtocol() override { return "dubbo"; }
+  uint32_t maxConcurrentRequests() override { return UINT32_MAX; }
+  uint32_t bufferLimit() override { return UINT32_MAX; }
+  uint32_t requestStreamingThreshold() override { return 0; }
+  const std::vector<AccessLog::InstanceSharedPtr>& accessLogs() override { return access_logs_; }
+  const TracingConfigImpl* tracingConfig() override { return nullptr; }
+
+  // FilterChainFactory
+  void createFilterChain(FilterChainFactoryCallbacks& callbacks) override {
+    callbacks.addDecoderFilter(std::make_shared<UpstreamFilter>(upstream_));
+  }
+
+  // Router::Config
+  Router::RouteConstSharedPtr route(const Metadata&, uint64_t) const override { return nullptr; }
+
+private:
+  Upstream& upstream_;
+  Stats::IsolatedStoreImpl store_;
+  MetaProtocolProxyStats stats_;
+  const std::vector<AccessLog::InstanceSharedPtr> access_logs_;
+};
+
+// Proxies Dubbo requests through a connection manager, the requests given in each read are
+// answered by the upstream before the next read. The messages are recycled by the event loop as
+// they would be between the reads of a connection.
+static void bmProxiedRpc(benchmark::State& state) {
+  const uint64_t requests_per_read = state.range(0);
+  Api::ApiPtr api = Api::createApiForTest();
+  Event::DispatcherPtr dispatcher = api->allocateDispatcher("test_thread");
+  Random::RandomGeneratorImpl random;
+  Upstream upstream;
+  BenchmarkConfig config(upstream);
+  NiceMock<Network::MockReadFilterCallbacks> read_callbacks;
+  ON_CALL(read_callbacks.connection_, dispatcher()).WillByDefault(ReturnRef(*dispatcher));
+
+  ConnectionManager manager(config, random, dispatcher->timeSource());
+  manager.initializeReadFilterCallbacks(read_callbacks);
+  manager.onNewConnection();
+
+  Buffer::OwnedImpl requests;
+  for (uint64_t i = 0; i < requests_per_read; i++) {
+    Dubbo::encodeRequest(requests, i + 1, "org.apache.dubbo.samples.basic.api.DemoService",
+                         "sayHello", {{"path", "org.apache.dubbo.samples.basic.api.DemoService"}});
+  }
+
+  const auto proxy = [&]() {
+    Buffer::OwnedImpl data(requests);
+    manager.onData(data, false);
+    upstream.respond();
+    dispatcher->run(Event::Dispatcher::RunType::NonBlock);
+  };
+  // The first messages are allocated before the pool of the connection has any to recycle.
+  proxy();
+
+  const uint64_t start_allocations = AllocationCounter::count();
+  for (auto _ : state) {
+    UNREFERENCED_PARAMETER(_);
+    proxy();
+  }
+  const uint64_t rpcs = state.iterations() * requests_per_read;
+  if (AllocationCounter::enabled()) {
+    state.counters["allocations_per_rpc"] =
+        static_cast<double>(AllocationCounter::count() - start_allocations) / rpcs;
+  } else {
+    state.SetLabel("allocations aren't counted, build with --define tcmalloc=disabled");
+  }
+  state.SetItemsProcessed(rpcs);
+
+  manager.onEvent(Network::ConnectionEvent::LocalClose);
+  dispatcher->run(Event::Dispatcher::RunType::NonBlock);
+}
+BENCHMARK(bmProxiedRpc)->Arg(1)->Arg(16)->Unit(benchmark::kMicrosecond);
+
+} // namespace
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,67 @@
+// Note: this should be run with --compilation_mode=opt, and would benefit from a
+// quiescent system with disabled cstate power management.
+
+#include "source/common/config/utility.h"
+#include "source/common/protobuf/message_validator_impl.h"
+
+#include "api/v1alpha/meta_protocol_proxy.pb.h"
+#include "src/application_protocols/dubbo/dubbo_codec.pb.h"
+#include "src/meta_protocol_proxy/codec/factory.h"
+
+#include "benchmark/benchmark.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace {
+
+using CodecConfig = envoy::extensions::filters::network::meta_protocol_proxy::v1alpha::Codec;
+
+CodecConfig dubboCodecConfig() {
+  CodecConfig config;
+  config.set_name("aeraki.meta_protocol.codec.dubbo");
+  config.mutable_config()->PackFrom(aeraki::meta_protocol::codec::DubboCodec());
+  return config;
+}
+
+// Creates a codec as ConfigImpl::createCodec() did before the codec factory and its config were
+// resolved at config load: the factory is looked up and the config translated for each codec.
+static void bmCreateCodecResolvingConfig(benchmark::State& state) {
+  const CodecConfig config = dubboCodecConfig();
+  for (auto _ : state) {
+    UNREFERENCED_PARAMETER(_);
+    auto& factory =
+        Envoy::Config::Utility::getAndCheckFactoryByName<NamedCodecConfigFactory>(config.name());
+    ProtobufTypes::MessagePtr message = factory.createEmptyConfigProto();
+    Envoy::Config::Utility::translateOpaqueConfig(
+        config.config(), ProtobufWkt::Struct::default_instance(),
+        ProtobufMessage::getStrictValidationVisitor(), *message);
+    benchmark::DoNotOptimize(factory.createCodec(*message));
+  }
+}
+BENCHMARK(bmCreateCodecResolvingConfig);
+
+// Creates a codec as ConfigImpl::createCodec() does, from the factory and the config resolved
+// once at config load.
+static void bmCreateCodec(benchmark::State& state) {
+  const CodecConfig config = dubboCodecConfig();
+  auto& factory =
+      Envoy::Config::Utility::getAndCheckFactoryByName<NamedCodecConfigFactory>(config.name());
+  ProtobufTypes::MessagePtr message = factory.createEmptyConfigProto();
+  Envoy::Config::Utility::translateOpaqueConfig(config.config(),
+                                                ProtobufWkt::Struct::default_instance(),
+                                                ProtobufMessage::getStrictValidationVisitor(),
+                                                *message);
+  for (auto _ : state) {
+    UNREFERENCED_PARAMETER(_);
+    benchmark::DoNotOptimize(factory.createCodec(*message));
+  }
+}
+BENCHMARK(bmCreateCodec);
+
+} // namespace
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
@@ -0,0 +1,79 @@
+// Note: this should be run with --compilation_mode=opt, and would benefit from a
+// quiescent system with disabled cstate power management.
+
+#include <string>
+
+#include "src/meta_protocol_proxy/codec_impl.h"
+#include "src/meta_protocol_proxy/filters/router/route_matcher.h"
+
+#include "test/mocks/server/factory_context.h"
+
+#include "benchmark/benchmark.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace Router {
+namespace {
+
+std::string interfaceName(int64_t i) { return absl::StrCat("org.apache.dubbo.Service", i, ".Api"); }
+
+// Routes the requests of the last of the interfaces, each of them has a route which matches the
+// interface name exactly if exact is set, or by prefix otherwise. The exact routes are looked up
+// in the index of the interfaces, the prefix routes are scanned in order.
+//
+// Each request has its own metadata as the decoded requests do, so whatever the matcher builds
+// from the metadata of a request is paid for each of them.
+void routeLastInterface(benchmark::State& state, bool exact) {
+  const int64_t route_count = state.range(0);
+  RouteMatcherImpl::RouteConfig config;
+  for (int64_t i = 0; i < route_count; i++) {
+    auto* route = config.add_routes();
+    auto* matcher = route->mutable_match()->add_metadata();
+    matcher->set_name("interface");
+    if (exact) {
+      matcher->set_exact_match(interfaceName(i));
+    } else {
+      matcher->set_prefix_match(interfaceName(i));
+    }
+    route->mutable_route()->set_cluster(absl::StrCat("cluster", i));
+  }
+  testing::NiceMock<Server::Configuration::MockFactoryContext> context;
+  RouteMatcherImpl matcher(config, context);
+
+  const std::string interface = interfaceName(route_count - 1);
+  for (auto _ : state) {
+    UNREFERENCED_PARAMETER(_);
+    MetadataImpl metadata;
+    metadata.putString("interface", interface);
+    metadata.putString("method", "sayHello");
+    benchmark::DoNotOptimize(matcher.route(metadata, 0));
+  }
+}
+
+static void bmRouteExactMatch(benchmark::State& state) { routeLastInterface(state, true); }
+BENCHMARK(bmRouteExactMatch)->RangeMultiplier(10)->Range(10, 50000);
+
+static void bmRoutePrefixMatch(benchmark::State& state) { routeLastInterface(state, false); }
+BENCHMARK(bmRoutePrefixMatch)->RangeMultiplier(10)->Range(10, 50000);
+
+// The cost of the metadata of a request alone, which is included in the routing benchmarks.
+static void bmRequestMetadata(benchmark::State& state) {
+  const std::string interface = interfaceName(0);
+  for (auto _ : state) {
+    UNREFERENCED_PARAMETER(_);
+    MetadataImpl metadata;
+    metadata.putString("interface", interface);
+    metadata.putString("method", "sayHello");
+    benchmark::DoNotOptimize(metadata);
+  }
+}
+BENCHMARK(bmRequestMetadata);
+
+} // namespace
+} // namespace Router
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
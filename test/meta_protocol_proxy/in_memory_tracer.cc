@@ -0,0 +1,90 @@
+#include "test/meta_protocol_proxy/in_memory_tracer.h"
+
+#include "source/common/common/hex.h"
+#include "source/common/common/macros.h"
+#include "source/common/http/header_map_impl.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+
+namespace {
+
+const Http::LowerCaseString& traceIdKey() {
+  CONSTRUCT_ON_FIRST_USE(Http::LowerCaseString, "x-b3-traceid");
+}
+const Http::LowerCaseString& spanIdKey() {
+  CONSTRUCT_ON_FIRST_USE(Http::LowerCaseString, "x-b3-spanid");
+}
+const Http::LowerCaseString& parentSpanIdKey() {
+  CONSTRUCT_ON_FIRST_USE(Http::LowerCaseString, "x-b3-parentspanid");
+}
+const Http::LowerCaseString& sampledKey() {
+  CONSTRUCT_ON_FIRST_USE(Http::LowerCaseString, "x-b3-sampled");
+}
+
+std::string headerValue(const Http::RequestHeaderMap& headers, const Http::LowerCaseString& key) {
+  const auto result = headers.get(key);
+  return result.empty() ? std::string() : std::string(result[0]->value().getStringView());
+}
+
+} // namespace
+
+Tracing::SpanPtr InMemoryTracer::startSpan(const Tracing::Config&,
+                                           Http::RequestHeaderMap& request_headers,
+                                           const StreamInfo::StreamInfo&,
+                                           const Tracing::Decision tracing_decision) {
+  // The trace of the caller is continued if the context has one.
+  std::string trace_id = headerValue(request_headers, traceIdKey());
+  std::string parent_span_id;
+  if (trace_id.empty()) {
+    trace_id = nextId();
+  } else {
+    parent_span_id = headerValue(request_headers, spanIdKey());
+  }
+  const std::string sampled = headerValue(request_headers, sampledKey());
+  return std::make_unique<Span>(*this, std::string(), std::move(trace_id),
+                                std::move(parent_span_id),
+                                sampled.empty() ? tracing_decision.traced : sampled == "1");
+}
+
+std::string InMemoryTracer::nextId() { return Hex::uint64ToHex(next_id_++); }
+
+InMemoryTracer::Span::Span(InMemoryTracer& tracer, std::string&& operation,
+                           std::string&& trace_id, std::string&& parent_span_id, bool sampled)
+    : tracer_(tracer.shared_from_this()) {
+  span_.operation = std::move(operation);
+  span_.trace_id = std::move(trace_id);
+  span_.span_id = tracer.nextId();
+  span_.parent_span_id = std::move(parent_span_id);
+  span_.sampled = sampled;
+}
+
+void InMemoryTracer::Span::finishSpan() {
+  if (finished_) {
+    return;
+  }
+  finished_ = true;
+  tracer_->finished_spans_.push_back(span_);
+}
+
+void InMemoryTracer::Span::injectContext(Http::RequestHeaderMap& request_headers) {
+  request_headers.setCopy(traceIdKey(), span_.trace_id);
+  request_headers.setCopy(spanIdKey(), span_.span_id);
+  if (!span_.parent_span_id.empty()) {
+    request_headers.setCopy(parentSpanIdKey(), span_.parent_span_id);
+  }
+  request_headers.setCopy(sampledKey(), span_.sampled ? "1" : "0");
+}
+
+Tracing::SpanPtr InMemoryTracer::Span::spawnChild(const Tracing::Config&, const std::string& name,
+                                                  SystemTime) {
+  return std::make_unique<Span>(*tracer_, std::string(name), std::string(span_.trace_id),
+                                std::string(span_.span_id), span_.sampled);
+}
+
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
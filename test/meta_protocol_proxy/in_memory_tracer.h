@@ -0,0 +1,90 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "envoy/common/time.h"
+#include "envoy/tracing/http_tracer.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+
+/**
+ * InMemoryTracer stands in for a tracing provider, it keeps the finished spans in memory instead of
+ * reporting them. It can be given to TracingConfigImpl to check the spans of the requests and the
+ * trace context they carry without a collector.
+ *
+ * The trace context is read from and injected into the B3 keys. A span continues the trace of the
+ * context it's started with, and the IDs of the new spans are allocated in sequence.
+ */
+class InMemoryTracer : public Tracing::HttpTracer,
+                       public std::enable_shared_from_this<InMemoryTracer> {
+public:
+  struct FinishedSpan {
+    std::string operation;
+    std::string trace_id;
+    std::string span_id;
+    // Empty if the span is the root of its trace.
+    std::string parent_span_id;
+    bool sampled;
+    std::vector<std::pair<std::string, std::string>> tags;
+  };
+
+  // Tracing::HttpTracer
+  Tracing::SpanPtr startSpan(const Tracing::Config& config, Http::RequestHeaderMap& request_headers,
+                             const StreamInfo::StreamInfo& stream_info,
+                             const Tracing::Decision tracing_decision) override;
+
+  /**
+   * @return the spans which have been finished, in the order they're finished.
+   */
+  const std::vector<FinishedSpan>& finishedSpans() const { return finished_spans_; }
+
+  void clear() { finished_spans_.clear(); }
+
+private:
+  class Span : public Tracing::Span {
+  public:
+    Span(InMemoryTracer& tracer, std::string&& operation, std::string&& trace_id,
+         std::string&& parent_span_id, bool sampled);
+
+    // Tracing::Span
+    void setOperation(absl::string_view operation) override {
+      span_.operation = std::string(operation);
+    }
+    void setTag(absl::string_view name, absl::string_view value) override {
+      span_.tags.emplace_back(std::string(name), std::string(value));
+    }
+    void log(SystemTime, const std::string&) override {}
+    void finishSpan() override;
+    void injectContext(Http::RequestHeaderMap& request_headers) override;
+    Tracing::SpanPtr spawnChild(const Tracing::Config& config, const std::string& name,
+                                SystemTime start_time) override;
+    void setSampled(bool sampled) override { span_.sampled = sampled; }
+    std::string getBaggage(absl::string_view) override { return {}; }
+    void setBaggage(absl::string_view, absl::string_view) override {}
+    std::string getTraceIdAsHex() const override { return span_.trace_id; }
+
+  private:
+    // The tracer is kept alive by its spans, as a span may outlive its configuration.
+    const std::shared_ptr<InMemoryTracer> tracer_;
+    FinishedSpan span_;
+    bool finished_{false};
+  };
+
+  std::string nextId();
+
+  uint64_t next_id_{1};
+  std::vector<FinishedSpan> finished_spans_;
+};
+
+using InMemoryTracerSharedPtr = std::shared_ptr<InMemoryTracer>;
+
+} // namespace MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy
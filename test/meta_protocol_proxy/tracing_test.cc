@@ -0,0 +1,178 @@
+#include <memory>
+#include <string>
+
+#include "source/common/buffer/buffer_impl.h"
+#include "source/common/http/header_map_impl.h"
+#include "source/common/tracing/http_tracer_impl.h"
+
+#include "src/application_protocols/dubbo/dubbo_codec.h"
+#include "src/meta_protocol_proxy/codec_impl.h"
+#include "src/meta_protocol_proxy/stream_info.h"
+#include "src/meta_protocol_proxy/tracing.h"
+
+#include "test/application_protocols/dubbo/dubbo_test_messages.h"
+#include "test/meta_protocol_proxy/in_memory_tracer.h"
+#include "test/mocks/network/mocks.h"
+#include "test/test_common/simulated_time_system.h"
+
+#include "gtest/gtest.h"
+
+namespace Envoy {
+namespace Extensions {
+namespace NetworkFilters {
+namespace MetaProtocolProxy {
+namespace {
+
+constexpr absl::string_view Interface = "org.apache.dubbo.samples.basic.api.DemoService";
+
+bool hasTag(const InMemoryTracer::FinishedSpan& span, const std::string& name,
+            const std::string& value) {
+  for (const auto& tag : span.tags) {
+    if (tag.first == name && tag.second == value) {
+      return true;
+    }
+  }
+  return false;
+}
+
+class TracingConfigImplTest : public testing::Test {
+public:
+  TracingConfigImplTest()
+      : tracer_(std::make_shared<InMemoryTracer>()),
+        stream_info_(time_system_, connection_.addressProviderSharedPtr()) {}
+
+  TracingConfigImplPtr createConfig(const TracingConfigImpl::TracingConfig& config = {}) {
+    return std::make_unique<TracingConfigImpl>(config, "dubbo", tracer_);
+  }
+
+  // Decodes a Dubbo request with the given attachments, as the connection manager decodes it.
+  MetadataSharedPtr decodeRequest(const Dubbo::Attachments& attachments) {
+    Buffer::OwnedImpl buffer;
+    Dubbo::encodeRequest(buffer, 7, std::string(Interface), "sayHello", attachments);
+    auto metadata = std::make_shared<MetadataImpl>();
+    EXPECT_EQ(DecodeStatus::Done, codec_.decode(buffer, *metadata));
+    return metadata;
+  }
+
+  Event::SimulatedTimeSystem time_system_;
+  testing::NiceMock<Network::MockConnection> connection_;
+  InMemoryTracerSharedPtr tracer_;
+  MessageStreamInfo stream_info_;
+  Dubbo::DubboCodec codec_;
+};
+
+TEST_F(TracingConfigImplTest, Sampling) {
+  TracingConfigImplPtr all = createConfig();
+  EXPECT_TRUE(all->sampled(0));
+  EXPECT_TRUE(all->sampled(9999));
+
+  TracingConfigImpl::TracingConfig config;
+  config.mutable_random_sampling()->set_value(25);
+  TracingConfigImplPtr quarter = createConfig(config);
+  EXPECT_TRUE(quarter->sampled(0));
+  EXPECT_TRUE(quarter->sampled(2499));
+  EXPECT_FALSE(quarter->sampled(2500));
+  EXPECT_FALSE(quarter->sampled(9999));
+  EXPECT_TRUE(quarter->sampled(10000));
+
+  config.mutable_random_sampling()->set_value(0);
+  TracingConfigImplPtr none = createConfig(config);
+  EXPECT_FALSE(none->sampled(0));
+}
+
+// The server span continues the trace of the context in the attachments of the request.
+TEST_F(TracingConfigImplTest, ExtractContext) {
+  TracingConfigImplPtr config = createConfig();
+  MetadataSharedPtr request = decodeRequest({{"x-b3-traceid", "463ac35c9f6413ad"},
+                                             {"x-b3-spanid", "a2fb4a1d1a96d312"},
+                                             {"x-b3-sampled", "0"}});
+  stream_info_.setRequestMetadata(request);
+  auto response = std::make_shared<MetadataImpl>();
+  response->setMessageType(MessageType::Response);
+  response->setResponseStatus(ResponseStatus::Ok);
+  stream_info_.setResponseMetadata(response);
+
+  Tracing::SpanPtr span = config->startSpan(*request, stream_info_);
+  config->finishSpan(*span, stream_info_);
+
+  ASSERT_EQ(1, tracer_->finishedSpans().size());
+  const InMemoryTracer::FinishedSpan& finished = tracer_->finishedSpans()[0];
+  EXPECT_EQ("463ac35c9f6413ad", finished.trace_id);
+  EXPECT_EQ("a2fb4a1d1a96d312", finished.parent_span_id);
+  // The decision of the caller is kept by the tracer.
+  EXPECT_FALSE(finished.sampled);
+  EXPECT_EQ(absl::StrCat(Interface, ".sayHello"), finished.operation);
+  EXPECT_TRUE(hasTag(finished, "rpc.system", "dubbo"));
+  EXPECT_TRUE(hasTag(finished, "rpc.service", std::string(Interface)));
+  EXPECT_TRUE(hasTag(finished, "rpc.method", "sayHello"));
+  EXPECT_TRUE(hasTag(finished, "request_id", "7"));
+  EXPECT_TRUE(hasTag(finished, "response_status", "Ok"));
+  EXPECT_FALSE(hasTag(finished, Tracing::Tags::get().Error, Tracing::Tags::get().True));
+}
+
+// A request without a context starts a new trace, which is sampled by the proxy.
+TEST_F(TracingConfigImplTest, StartTrace) {
+  TracingConfigImplPtr config = createConfig();
+  MetadataSharedPtr request = decodeRequest({});
+  stream_info_.setRequestMetadata(request);
+  stream_info_.onLocalReply();
+
+  Tracing::SpanPtr span = config->startSpan(*request, stream_info_);
+  config->finishSpan(*span, stream_info_);
+
+  ASSERT_EQ(1, tracer_->finishedSpans().size());
+  const InMemoryTracer::FinishedSpan& finished = tracer_->finishedSpans()[0];
+  EXPECT_FALSE(finished.trace_id.empty());
+  EXPECT_TRUE(finished.parent_span_id.empty());
+  EXPECT_TRUE(finished.sampled);
+  EXPECT_TRUE(hasTag(finished, "response_status", "LocalReply"));
+  EXPECT_TRUE(hasTag(finished, Tracing::Tags::get().Error, Tracing::Tags::get().True));
+}
+
+// The context of the client span is injected into the upstream request as attachments, the way the
+// router puts it in the mutation of the request for the codec to encode.
+TEST_F(TracingConfigImplTest, InjectContext) {
+  TracingConfigImplPtr config = createConfig();
+  MetadataSharedPtr request = decodeRequest(
+      {{"x-b3-traceid", "463ac35c9f6413ad"}, {"x-b3-spanid", "a2fb4a1d1a96d312"}, {"path", "a"}});
+  stream_info_.setRequestMetadata(request);
+
+  Tracing::SpanPtr span = config->startSpan(*request, stream_info_);
+  Tracing::SpanPtr upstream_span =
+      span->spawnChild(Tracing::EgressConfig::get(), "router egress", time_system_.systemTime());
+  Http::RequestHeaderMapPtr context = Http::RequestHeaderMapImpl::create();
+  upstream_span->injectContext(*context);
+  MutationImpl mutation;
+  context->iterate([&mutation](const Http::HeaderEntry& entry) -> Http::HeaderMap::Iterate {
+    mutation.putString(entry.key().getStringView(), entry.value().getStringView());
+    return Http::HeaderMap::Iterate::Continue;
+  });
+
+  Buffer::OwnedImpl upstream_buffer;
+  codec_.encode(*request, mutation, upstream_buffer);
+  ASSERT_NE(0, upstream_buffer.length());
+  auto upstream_request = std::make_shared<MetadataImpl>();
+  ASSERT_EQ(DecodeStatus::Done, codec_.decode(upstream_buffer, *upstream_request));
+
+  upstream_span->finishSpan();
+  config->finishSpan(*span, stream_info_);
+  ASSERT_EQ(2, tracer_->finishedSpans().size());
+  const InMemoryTracer::FinishedSpan& client = tracer_->finishedSpans()[0];
+  const InMemoryTracer::FinishedSpan& server = tracer_->finishedSpans()[1];
+  EXPECT_EQ(server.span_id, client.parent_span_id);
+
+  EXPECT_EQ("463ac35c9f6413ad", upstream_request->getString("x-b3-traceid"));
+  EXPECT_EQ(client.span_id, upstream_request->getString("x-b3-spanid"));
+  EXPECT_EQ(server.span_id, upstream_request->getString("x-b3-parentspanid"));
+  EXPECT_EQ("1", upstream_request->getString("x-b3-sampled"));
+  // The other attachments of the request are kept.
+  EXPECT_EQ("a", upstream_request->getString("path"));
+  EXPECT_EQ(Interface, upstream_request->getString("interface"));
+  EXPECT_EQ("sayHello", upstream_request->getString("method"));
+}
+
+} // namespace
+} // namespace  MetaProtocolProxy
+} // namespace NetworkFilters
+} // namespace Extensions
+} // namespace Envoy